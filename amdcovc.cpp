@@ -20,22 +20,48 @@
 
 #define _BSD_SOURCE
 #include <iostream>
-#include <exception>
 #include <dlfcn.h>
 #include <fstream>
+#include <sstream>
 #include <algorithm>
 #include <cstdio>
 #include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <string>
+#include <vector>
+#include <array>
+#include <unordered_set>
+#include <unordered_map>
 #include <memory>
 #include <cstdarg>
 #include <cmath>
+#include <cctype>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <csignal>
+#include <ctime>
+#include <cstdint>
+#include <climits>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+#include <dirent.h>
 #include <fcntl.h>
-#include <CL/cl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 extern "C" {
 #include <pci/pci.h>
 }
@@ -44,9 +70,14 @@ extern "C" {
 #define LINUX 1
 #endif
 #include "adl_sdk.h"
+#include "amdcovc_shm.h"
 
 #define AMDCOVC_VERSION "0.2"
 
+/* root directory for /dev/ati and /proc/ati (AMDCOVC_SYSROOT environment variable).
+ * Allows to run program against fake device tree */
+static const char* sysRoot = "";
+
 // Memory allocation function
 void* __stdcall ADL_Main_Memory_Alloc (int iSize)
 {
@@ -67,11 +98,12 @@ void __stdcall ADL_Main_Memory_Free (void** lpBuffer)
 class Error: public std::exception
 {
 private:
+    int code;
     std::string description;
 public:
-    explicit Error(const char* _description) : description(_description)
+    explicit Error(const char* _description) : code(0), description(_description)
     { }
-    Error(int error, const char* _description)
+    Error(int error, const char* _description) : code(error)
     {
         char errorBuf[32];
         snprintf(errorBuf, 32, "code %d: ", error);
@@ -82,8 +114,24 @@ public:
     { }
     const char* what() const noexcept
     { return description.c_str(); }
+    // ADL error code (0 if not ADL error)
+    int getCode() const
+    { return code; }
+};
+
+/* optional groups of ADL functions. Callers should check them by
+ * ATIADLHandle::hasCapability and skip unsupported queries */
+enum ADLCapability
+{
+    ADLCAP_POWER_CONTROL = 0,   // Overdrive5 PowerControl
+    ADLCAP_ADL2,                // ADL2 (context-based) API
+    ADLCAP_ADL2_POWER_CONTROL,  // Overdrive5 PowerControl in ADL2 API
+    ADLCAP_ADL2_SET,            // Overdrive5 set functions in ADL2 API
+    ADLCAP_MAX
 };
 
+static const int ADLCAP_REQUIRED = -1;
+
 class ATIADLHandle
 {
 private:
@@ -120,28 +168,94 @@ private:
                 int* defaultValue);
     typedef int (*ADL_Overdrive5_PowerControl_Set_T)(int adapterIndex, int value);
     
+    /* ADL2 (context-based) API */
+    typedef int (*ADL2_Main_Control_Create_T)(ADL_MAIN_MALLOC_CALLBACK, int,
+                ADL_CONTEXT_HANDLE* context);
+    typedef int (*ADL2_Main_Control_Destroy_T)(ADL_CONTEXT_HANDLE context);
+    typedef int (*ADL2_Overdrive5_CurrentActivity_Get_T)(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, ADLPMActivity* activity);
+    typedef int (*ADL2_Overdrive5_Temperature_Get_T)(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, int thermalCtrlIndex, ADLTemperature *temperature);
+    typedef int (*ADL2_Overdrive5_FanSpeedInfo_Get_T)(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, int thermalCtrlIndex, ADLFanSpeedInfo* fanSpeedInfo);
+    typedef int (*ADL2_Overdrive5_FanSpeed_Get_T)(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, int thermalCtrlIndex, ADLFanSpeedValue* fanSpeedValue);
+    typedef int (*ADL2_Overdrive5_ODParameters_Get_T)(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, ADLODParameters* odParameters);
+    typedef int (*ADL2_Overdrive5_ODPerformanceLevels_Get_T)(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, int idefault, ADLODPerformanceLevels* odPerformanceLevels);
+    typedef int (*ADL2_Overdrive5_PowerControlInfo_Get_T)(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, ADLPowerControlInfo* powerControlInfo);
+    typedef int (*ADL2_Overdrive5_PowerControl_Get_T)(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, int* currentValue, int* defaultValue);
+    typedef int (*ADL2_Overdrive5_FanSpeed_Set_T)(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, int thermalCtrlIndex, ADLFanSpeedValue* fanSpeedValue);
+    typedef int (*ADL2_Overdrive5_FanSpeedToDefault_Set_T)(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, int thermalCtrlIndex);
+    typedef int (*ADL2_Overdrive5_ODPerformanceLevels_Set_T)(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, ADLODPerformanceLevels* odPerformanceLevels);
+    typedef int (*ADL2_Overdrive5_PowerControl_Set_T)(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, int value);
+    
+    /* symbol table: symbols of required functions are resolved at startup,
+     * symbols of optional capability are resolved at first use of this capability */
+    enum ADLSymbol
+    {
+        SYM_ADL_Main_Control_Create = 0,
+        SYM_ADL_Main_Control_Destroy,
+        SYM_ADL_ConsoleMode_FileDescriptor_Set,
+        SYM_ADL_Adapter_NumberOfAdapters_Get,
+        SYM_ADL_Adapter_Active_Get,
+        SYM_ADL_Adapter_AdapterInfo_Get,
+        SYM_ADL_Overdrive5_CurrentActivity_Get,
+        SYM_ADL_Overdrive5_Temperature_Get,
+        SYM_ADL_Overdrive5_FanSpeedInfo_Get,
+        SYM_ADL_Overdrive5_FanSpeed_Get,
+        SYM_ADL_Overdrive5_ODParameters_Get,
+        SYM_ADL_Overdrive5_ODPerformanceLevels_Get,
+        SYM_ADL_Overdrive5_FanSpeed_Set,
+        SYM_ADL_Overdrive5_FanSpeedToDefault_Set,
+        SYM_ADL_Overdrive5_ODPerformanceLevels_Set,
+        SYM_ADL_Overdrive5_PowerControlInfo_Get,
+        SYM_ADL_Overdrive5_PowerControl_Get,
+        SYM_ADL_Overdrive5_PowerControl_Set,
+        SYM_ADL2_Main_Control_Create,
+        SYM_ADL2_Main_Control_Destroy,
+        SYM_ADL2_Overdrive5_CurrentActivity_Get,
+        SYM_ADL2_Overdrive5_Temperature_Get,
+        SYM_ADL2_Overdrive5_FanSpeedInfo_Get,
+        SYM_ADL2_Overdrive5_FanSpeed_Get,
+        SYM_ADL2_Overdrive5_ODParameters_Get,
+        SYM_ADL2_Overdrive5_ODPerformanceLevels_Get,
+        SYM_ADL2_Overdrive5_PowerControlInfo_Get,
+        SYM_ADL2_Overdrive5_PowerControl_Get,
+        SYM_ADL2_Overdrive5_FanSpeed_Set,
+        SYM_ADL2_Overdrive5_FanSpeedToDefault_Set,
+        SYM_ADL2_Overdrive5_ODPerformanceLevels_Set,
+        SYM_ADL2_Overdrive5_PowerControl_Set,
+        SYM_MAX
+    };
+    
+    struct SymbolEntry
+    {
+        const char* name;
+        int capability;     // ADLCAP_REQUIRED or ADLCapability
+    };
+    static const SymbolEntry symbolTable[SYM_MAX];
+    
     void* handle;
-    void* getSym(const char* name);
-    
-    ADL_Main_Control_Create_T pADL_Main_Control_Create;
-    ADL_Main_Control_Destroy_T pADL_Main_Control_Destroy;
-    ADL_ConsoleMode_FileDescriptor_Set_T pADL_ConsoleMode_FileDescriptor_Set;
-    ADL_Adapter_NumberOfAdapters_Get_T pADL_Adapter_NumberOfAdapters_Get;
-    ADL_Adapter_Active_Get_T pADL_Adapter_Active_Get;
-    ADL_Adapter_AdapterInfo_Get_T pADL_Adapter_AdapterInfo_Get;
-    ADL_Overdrive5_CurrentActivity_Get_T pADL_Overdrive5_CurrentActivity_Get;
-    ADL_Overdrive5_Temperature_Get_T pADL_Overdrive5_Temperature_Get;
-    ADL_Overdrive5_FanSpeedInfo_Get_T pADL_Overdrive5_FanSpeedInfo_Get;
-    ADL_Overdrive5_FanSpeed_Get_T pADL_Overdrive5_FanSpeed_Get;
-    ADL_Overdrive5_ODParameters_Get_T pADL_Overdrive5_ODParameters_Get;
-    ADL_Overdrive5_ODPerformanceLevels_Get_T pADL_Overdrive5_ODPerformanceLevels_Get;
-    ADL_Overdrive5_FanSpeed_Set_T pADL_Overdrive5_FanSpeed_Set;
-    ADL_Overdrive5_FanSpeedToDefault_Set_T pADL_Overdrive5_FanSpeedToDefault_Set;
-    ADL_Overdrive5_ODPerformanceLevels_Set_T pADL_Overdrive5_ODPerformanceLevels_Set;
-    ADL_Overdrive5_PowerControlInfo_Get_T pADL_Overdrive5_PowerControlInfo_Get;
-    ADL_Overdrive5_PowerControl_Get_T pADL_Overdrive5_PowerControl_Get;
-    ADL_Overdrive5_PowerControl_Set_T pADL_Overdrive5_PowerControl_Set;
+    mutable void* symbols[SYM_MAX];
+    mutable std::once_flag capabilityFlags[ADLCAP_MAX];
+    mutable bool capabilitySupported[ADLCAP_MAX];
     
+    void* getSym(const char* name) const;
+    void* getOptionalSym(const char* name) const;
+    void resolveCapability(int capability) const;
+    void* getFunc(ADLSymbol symbol) const;
+    
+    template<typename T>
+    T func(ADLSymbol symbol) const
+    { return (T)getFunc(symbol); }
 public:
     ATIADLHandle();
     ~ATIADLHandle();
@@ -174,75 +288,103 @@ public:
     void Overdrive5_PowerControl_Get(int adapterIndex, int* currentValue,
                 int* defaultValue) const;
     void Overdrive5_PowerControl_Set(int adapterIndex, int value) const;
+    
+    /* returns true if all functions of capability are available. Resolves
+     * functions of capability if it is first use */
+    bool hasCapability(ADLCapability capability) const;
+    // returns bitmask of available capabilities (1<<ADLCapability)
+    unsigned int getCapabilities() const;
+    
+    /* ADL2 API. These functions are available only if isADL2Supported() */
+    bool isADL2Supported() const
+    { return hasCapability(ADLCAP_ADL2); }
+    
+    void Main_Control_Create(ADL_MAIN_MALLOC_CALLBACK callback,
+                int iEnumConnectedAdapters, ADL_CONTEXT_HANDLE* context) const;
+    void Main_Control_Destroy(ADL_CONTEXT_HANDLE context) const;
+    void Overdrive5_CurrentActivity_Get(ADL_CONTEXT_HANDLE context, int adapterIndex,
+                ADLPMActivity* activity) const;
+    void Overdrive5_Temperature_Get(ADL_CONTEXT_HANDLE context, int adapterIndex,
+                int thermalCtrlIndex, ADLTemperature* temperature) const;
+    void Overdrive5_FanSpeedInfo_Get(ADL_CONTEXT_HANDLE context, int adapterIndex,
+                int thermalCtrlIndex, ADLFanSpeedInfo* fanSpeedInfo) const;
+    void Overdrive5_FanSpeed_Get(ADL_CONTEXT_HANDLE context, int adapterIndex,
+                int thermalCtrlIndex, ADLFanSpeedValue* fanSpeedValue) const;
+    void Overdrive5_ODParameters_Get(ADL_CONTEXT_HANDLE context, int adapterIndex,
+                ADLODParameters* odParameters) const;
+    void Overdrive5_ODPerformanceLevels_Get(ADL_CONTEXT_HANDLE context, int adapterIndex,
+                int idefault, ADLODPerformanceLevels* odPerformanceLevels) const;
+    void Overdrive5_PowerControlInfo_Get(ADL_CONTEXT_HANDLE context, int adapterIndex,
+                ADLPowerControlInfo* powerControlInfo) const;
+    void Overdrive5_PowerControl_Get(ADL_CONTEXT_HANDLE context, int adapterIndex,
+                int* currentValue, int* defaultValue) const;
+    void Overdrive5_FanSpeed_Set(ADL_CONTEXT_HANDLE context, int adapterIndex,
+                int thermalCtrlIndex, ADLFanSpeedValue* fanSpeedValue) const;
+    void Overdrive5_FanSpeedToDefault_Set(ADL_CONTEXT_HANDLE context, int adapterIndex,
+                int thermalCtrlIndex) const;
+    void Overdrive5_ODPerformanceLevels_Set(ADL_CONTEXT_HANDLE context, int adapterIndex,
+                ADLODPerformanceLevels* odPerformanceLevels) const;
+    void Overdrive5_PowerControl_Set(ADL_CONTEXT_HANDLE context, int adapterIndex,
+                int value) const;
+};
+
+const ATIADLHandle::SymbolEntry ATIADLHandle::symbolTable[SYM_MAX] =
+{
+    { "ADL_Main_Control_Create", ADLCAP_REQUIRED },
+    { "ADL_Main_Control_Destroy", ADLCAP_REQUIRED },
+    { "ADL_ConsoleMode_FileDescriptor_Set", ADLCAP_REQUIRED },
+    { "ADL_Adapter_NumberOfAdapters_Get", ADLCAP_REQUIRED },
+    { "ADL_Adapter_Active_Get", ADLCAP_REQUIRED },
+    { "ADL_Adapter_AdapterInfo_Get", ADLCAP_REQUIRED },
+    { "ADL_Overdrive5_CurrentActivity_Get", ADLCAP_REQUIRED },
+    { "ADL_Overdrive5_Temperature_Get", ADLCAP_REQUIRED },
+    { "ADL_Overdrive5_FanSpeedInfo_Get", ADLCAP_REQUIRED },
+    { "ADL_Overdrive5_FanSpeed_Get", ADLCAP_REQUIRED },
+    { "ADL_Overdrive5_ODParameters_Get", ADLCAP_REQUIRED },
+    { "ADL_Overdrive5_ODPerformanceLevels_Get", ADLCAP_REQUIRED },
+    { "ADL_Overdrive5_FanSpeed_Set", ADLCAP_REQUIRED },
+    { "ADL_Overdrive5_FanSpeedToDefault_Set", ADLCAP_REQUIRED },
+    { "ADL_Overdrive5_ODPerformanceLevels_Set", ADLCAP_REQUIRED },
+    { "ADL_Overdrive5_PowerControlInfo_Get", ADLCAP_POWER_CONTROL },
+    { "ADL_Overdrive5_PowerControl_Get", ADLCAP_POWER_CONTROL },
+    { "ADL_Overdrive5_PowerControl_Set", ADLCAP_POWER_CONTROL },
+    { "ADL2_Main_Control_Create", ADLCAP_ADL2 },
+    { "ADL2_Main_Control_Destroy", ADLCAP_ADL2 },
+    { "ADL2_Overdrive5_CurrentActivity_Get", ADLCAP_ADL2 },
+    { "ADL2_Overdrive5_Temperature_Get", ADLCAP_ADL2 },
+    { "ADL2_Overdrive5_FanSpeedInfo_Get", ADLCAP_ADL2 },
+    { "ADL2_Overdrive5_FanSpeed_Get", ADLCAP_ADL2 },
+    { "ADL2_Overdrive5_ODParameters_Get", ADLCAP_ADL2 },
+    { "ADL2_Overdrive5_ODPerformanceLevels_Get", ADLCAP_ADL2 },
+    { "ADL2_Overdrive5_PowerControlInfo_Get", ADLCAP_ADL2_POWER_CONTROL },
+    { "ADL2_Overdrive5_PowerControl_Get", ADLCAP_ADL2_POWER_CONTROL },
+    { "ADL2_Overdrive5_FanSpeed_Set", ADLCAP_ADL2_SET },
+    { "ADL2_Overdrive5_FanSpeedToDefault_Set", ADLCAP_ADL2_SET },
+    { "ADL2_Overdrive5_ODPerformanceLevels_Set", ADLCAP_ADL2_SET },
+    { "ADL2_Overdrive5_PowerControl_Set", ADLCAP_ADL2_POWER_CONTROL }
 };
 
-ATIADLHandle::ATIADLHandle() 
-try : handle(nullptr),
-    pADL_Main_Control_Create(nullptr), pADL_Main_Control_Destroy(nullptr),
-    pADL_ConsoleMode_FileDescriptor_Set(nullptr),
-    pADL_Adapter_NumberOfAdapters_Get(nullptr), pADL_Adapter_Active_Get(nullptr),
-    pADL_Adapter_AdapterInfo_Get(nullptr), pADL_Overdrive5_CurrentActivity_Get(nullptr),
-    pADL_Overdrive5_Temperature_Get(nullptr), pADL_Overdrive5_FanSpeedInfo_Get(nullptr),
-    pADL_Overdrive5_FanSpeed_Get(nullptr), pADL_Overdrive5_ODParameters_Get(nullptr),
-    pADL_Overdrive5_ODPerformanceLevels_Get(nullptr),
-    pADL_Overdrive5_FanSpeed_Set(nullptr),
-    pADL_Overdrive5_FanSpeedToDefault_Set(nullptr),
-    pADL_Overdrive5_ODPerformanceLevels_Set(nullptr),
-    pADL_Overdrive5_PowerControlInfo_Get(nullptr),
-    pADL_Overdrive5_PowerControl_Get(nullptr),
-    pADL_Overdrive5_PowerControl_Set(nullptr)
+ATIADLHandle::ATIADLHandle() : handle(nullptr)
 {
+    std::fill(symbols, symbols+SYM_MAX, nullptr);
+    std::fill(capabilitySupported, capabilitySupported+ADLCAP_MAX, false);
     dlerror(); // clear old errors
     handle = dlopen("libatiadlxx.so", RTLD_LAZY|RTLD_GLOBAL);
     if (handle == nullptr)
         throw Error(dlerror());
-    
-    pADL_Main_Control_Create = (ADL_Main_Control_Create_T)
-                getSym("ADL_Main_Control_Create");
-    pADL_Main_Control_Destroy = (ADL_Main_Control_Destroy_T)
-                getSym("ADL_Main_Control_Destroy");
-    pADL_ConsoleMode_FileDescriptor_Set = (ADL_ConsoleMode_FileDescriptor_Set_T)
-                getSym("ADL_ConsoleMode_FileDescriptor_Set");
-    pADL_Adapter_NumberOfAdapters_Get = (ADL_Adapter_NumberOfAdapters_Get_T)
-                getSym("ADL_Adapter_NumberOfAdapters_Get");
-    pADL_Adapter_Active_Get = (ADL_Adapter_Active_Get_T)
-                getSym("ADL_Adapter_Active_Get");
-    pADL_Adapter_AdapterInfo_Get = (ADL_Adapter_AdapterInfo_Get_T)
-                getSym("ADL_Adapter_AdapterInfo_Get");
-    pADL_Overdrive5_CurrentActivity_Get = (ADL_Overdrive5_CurrentActivity_Get_T)
-                getSym("ADL_Overdrive5_CurrentActivity_Get");
-    pADL_Overdrive5_Temperature_Get = (ADL_Overdrive5_Temperature_Get_T)
-                getSym("ADL_Overdrive5_Temperature_Get");
-    pADL_Overdrive5_FanSpeedInfo_Get = (ADL_Overdrive5_FanSpeedInfo_Get_T)
-                getSym("ADL_Overdrive5_FanSpeedInfo_Get");
-    pADL_Overdrive5_FanSpeed_Get = (ADL_Overdrive5_FanSpeed_Get_T)
-                getSym("ADL_Overdrive5_FanSpeed_Get");
-    pADL_Overdrive5_ODParameters_Get = (ADL_Overdrive5_ODParameters_Get_T)
-                getSym("ADL_Overdrive5_ODParameters_Get");
-    pADL_Overdrive5_ODPerformanceLevels_Get = (ADL_Overdrive5_ODPerformanceLevels_Get_T)
-                getSym("ADL_Overdrive5_ODPerformanceLevels_Get");
-    pADL_Overdrive5_FanSpeed_Set = (ADL_Overdrive5_FanSpeed_Set_T)
-                getSym("ADL_Overdrive5_FanSpeed_Set");
-    pADL_Overdrive5_FanSpeedToDefault_Set = (ADL_Overdrive5_FanSpeedToDefault_Set_T)
-                getSym("ADL_Overdrive5_FanSpeedToDefault_Set");
-    pADL_Overdrive5_ODPerformanceLevels_Set = (ADL_Overdrive5_ODPerformanceLevels_Set_T)
-                getSym("ADL_Overdrive5_ODPerformanceLevels_Set");
-    pADL_Overdrive5_PowerControlInfo_Get = (ADL_Overdrive5_PowerControlInfo_Get_T)
-                getSym("ADL_Overdrive5_PowerControlInfo_Get");
-    pADL_Overdrive5_PowerControl_Get = (ADL_Overdrive5_PowerControl_Get_T)
-                getSym("ADL_Overdrive5_PowerControl_Get");
-    pADL_Overdrive5_PowerControl_Set = (ADL_Overdrive5_PowerControl_Set_T)
-                getSym("ADL_Overdrive5_PowerControl_Set");
-}
-catch(...)
-{
-    if (handle != nullptr)
+    try
+    {
+        for (int i = 0; i < SYM_MAX; i++)
+            if (symbolTable[i].capability == ADLCAP_REQUIRED)
+                symbols[i] = getSym(symbolTable[i].name);
+    }
+    catch(...)
     {
         dlerror(); // clear old errors
         if (dlclose(handle)) // if closing failed
             throw Error(dlerror());
+        throw;
     }
-    throw;
 }
 
 ATIADLHandle::~ATIADLHandle()
@@ -255,7 +397,7 @@ ATIADLHandle::~ATIADLHandle()
     }
 }
 
-void* ATIADLHandle::getSym(const char* symbolName)
+void* ATIADLHandle::getSym(const char* symbolName) const
 {
     void* symbol = nullptr;
     dlerror(); // clear old errors
@@ -266,45 +408,99 @@ void* ATIADLHandle::getSym(const char* symbolName)
     return symbol;
 }
 
+void* ATIADLHandle::getOptionalSym(const char* symbolName) const
+{
+    dlerror(); // clear old errors
+    void* symbol = dlsym(handle, symbolName);
+    dlerror(); // missing symbol is not error
+    return symbol;
+}
+
+void ATIADLHandle::resolveCapability(int capability) const
+{
+    bool supported = true;
+    for (int i = 0; i < SYM_MAX; i++)
+        if (symbolTable[i].capability == capability)
+        {
+            symbols[i] = getOptionalSym(symbolTable[i].name);
+            supported = supported && symbols[i]!=nullptr;
+        }
+    capabilitySupported[capability] = supported;
+}
+
+bool ATIADLHandle::hasCapability(ADLCapability capability) const
+{
+    // call_once: capabilities can be checked by many threads
+    std::call_once(capabilityFlags[capability], &ATIADLHandle::resolveCapability,
+                this, int(capability));
+    return capabilitySupported[capability];
+}
+
+unsigned int ATIADLHandle::getCapabilities() const
+{
+    unsigned int capabilities = 0;
+    for (int c = 0; c < ADLCAP_MAX; c++)
+        if (hasCapability(ADLCapability(c)))
+            capabilities |= 1U<<c;
+    return capabilities;
+}
+
+void* ATIADLHandle::getFunc(ADLSymbol symbol) const
+{
+    const int capability = symbolTable[symbol].capability;
+    if (capability != ADLCAP_REQUIRED && !hasCapability(ADLCapability(capability)))
+    {
+        std::string msg = symbolTable[symbol].name;
+        msg += " is not supported";
+        throw Error(ADL_ERR_NOT_SUPPORTED, msg.c_str());
+    }
+    return symbols[symbol];
+}
+
 void ATIADLHandle::Main_Control_Create(ADL_MAIN_MALLOC_CALLBACK callback,
                             int iEnumConnectedAdapters) const
 {
-    int error = pADL_Main_Control_Create(callback, iEnumConnectedAdapters);
+    int error = func<ADL_Main_Control_Create_T>(
+                SYM_ADL_Main_Control_Create)(callback, iEnumConnectedAdapters);
     if (error != ADL_OK)
         throw Error(error, "ADL_Main_Control_Create error");
 }
 
 void ATIADLHandle::Main_Control_Destroy() const
 {
-    int error = pADL_Main_Control_Destroy();
+    int error = func<ADL_Main_Control_Destroy_T>(SYM_ADL_Main_Control_Destroy)();
     if (error != ADL_OK)
         throw Error(error, "ADL_Main_Control_Destroy error");
 }
 
 void ATIADLHandle::ConsoleMode_FileDescriptor_Set(int fileDescriptor) const
 {
-    int error = pADL_ConsoleMode_FileDescriptor_Set(fileDescriptor);
+    int error = func<ADL_ConsoleMode_FileDescriptor_Set_T>(
+                SYM_ADL_ConsoleMode_FileDescriptor_Set)(fileDescriptor);
     if (error != ADL_OK)
         throw Error(error, "ADL_ConsoleMode_FileDescriptor_Set error");
 }
 
 void ATIADLHandle::Adapter_NumberOfAdapters_Get(int* number) const
 {
-    int error = pADL_Adapter_NumberOfAdapters_Get(number);
+    int error = func<ADL_Adapter_NumberOfAdapters_Get_T>(
+                SYM_ADL_Adapter_NumberOfAdapters_Get)(number);
     if (error != ADL_OK)
         throw Error(error, "ADL_Adapter_NumberOfAdapters_Get error");
 }
 
 void ATIADLHandle::Adapter_Active_Get(int adapterIndex, int* status) const
 {
-    int error = pADL_Adapter_Active_Get(adapterIndex, status);
+    int error = func<ADL_Adapter_Active_Get_T>(
+                SYM_ADL_Adapter_Active_Get)(adapterIndex, status);
     if (error != ADL_OK)
         throw Error(error, "ADL_Adapter_Active_Get error");
 }
 
 void ATIADLHandle::Adapter_Info_Get(LPAdapterInfo info, int inputSize) const
 {
-    int error = pADL_Adapter_AdapterInfo_Get(info, inputSize);
+    int error = func<ADL_Adapter_AdapterInfo_Get_T>(
+                SYM_ADL_Adapter_AdapterInfo_Get)(info, inputSize);
     if (error != ADL_OK)
         throw Error(error, "ADL_AdapterInfo_Get error");
 }
@@ -312,7 +508,8 @@ void ATIADLHandle::Adapter_Info_Get(LPAdapterInfo info, int inputSize) const
 void ATIADLHandle::Overdrive5_CurrentActivity_Get(int adapterIndex,
                 ADLPMActivity* activity) const
 {
-    int error = pADL_Overdrive5_CurrentActivity_Get(adapterIndex, activity);
+    int error = func<ADL_Overdrive5_CurrentActivity_Get_T>(
+                SYM_ADL_Overdrive5_CurrentActivity_Get)(adapterIndex, activity);
     if (error != ADL_OK)
         throw Error(error, "ADL_Overdrive5_CurrentActivity_Get error");
 }
@@ -320,8 +517,9 @@ void ATIADLHandle::Overdrive5_CurrentActivity_Get(int adapterIndex,
 void ATIADLHandle::Overdrive5_Temperature_Get(int adapterIndex, int thermalCtrlIndex,
                 ADLTemperature *temperature) const
 {
-    int error = pADL_Overdrive5_Temperature_Get(adapterIndex, thermalCtrlIndex,
-                    temperature);
+    int error = func<ADL_Overdrive5_Temperature_Get_T>(
+                SYM_ADL_Overdrive5_Temperature_Get)(adapterIndex, thermalCtrlIndex,
+                temperature);
     if (error != ADL_OK)
         throw Error(error, "ADL_Overdrive5_Temperature_Get error");
 }
@@ -329,8 +527,9 @@ void ATIADLHandle::Overdrive5_Temperature_Get(int adapterIndex, int thermalCtrlI
 void ATIADLHandle::Overdrive5_FanSpeedInfo_Get(int adapterIndex, int thermalCtrlIndex,
                 ADLFanSpeedInfo* fanSpeedInfo) const
 {
-    int error = pADL_Overdrive5_FanSpeedInfo_Get(adapterIndex, thermalCtrlIndex,
-                    fanSpeedInfo);
+    int error = func<ADL_Overdrive5_FanSpeedInfo_Get_T>(
+                SYM_ADL_Overdrive5_FanSpeedInfo_Get)(adapterIndex, thermalCtrlIndex,
+                fanSpeedInfo);
     if (error != ADL_OK)
         throw Error(error, "ADL_Overdrive5_FanSpeedInfo_Get error");
 }
@@ -338,8 +537,9 @@ void ATIADLHandle::Overdrive5_FanSpeedInfo_Get(int adapterIndex, int thermalCtrl
 void ATIADLHandle::Overdrive5_FanSpeed_Get(int adapterIndex, int thermalCtrlIndex,
                 ADLFanSpeedValue* fanSpeedValue) const
 {
-    int error = pADL_Overdrive5_FanSpeed_Get(adapterIndex, thermalCtrlIndex,
-                    fanSpeedValue);
+    int error = func<ADL_Overdrive5_FanSpeed_Get_T>(
+                SYM_ADL_Overdrive5_FanSpeed_Get)(adapterIndex, thermalCtrlIndex,
+                fanSpeedValue);
     if (error != ADL_OK)
         throw Error(error, "ADL_Overdrive5_FanSpeed_Get error");
 }
@@ -347,7 +547,8 @@ void ATIADLHandle::Overdrive5_FanSpeed_Get(int adapterIndex, int thermalCtrlInde
 void ATIADLHandle::Overdrive5_ODParameters_Get(int adapterIndex,
                 ADLODParameters* odParameters) const
 {
-    int error = pADL_Overdrive5_ODParameters_Get(adapterIndex, odParameters);
+    int error = func<ADL_Overdrive5_ODParameters_Get_T>(
+                SYM_ADL_Overdrive5_ODParameters_Get)(adapterIndex, odParameters);
     if (error != ADL_OK)
         throw Error(error, "ADL_Overdrive5_ODParameters_Get error");
 }
@@ -355,8 +556,9 @@ void ATIADLHandle::Overdrive5_ODParameters_Get(int adapterIndex,
 void ATIADLHandle::Overdrive5_ODPerformanceLevels_Get(int adapterIndex, int idefault,
                 ADLODPerformanceLevels* odPerformanceLevels) const
 {
-    int error = pADL_Overdrive5_ODPerformanceLevels_Get(adapterIndex, idefault,
-                    odPerformanceLevels);
+    int error = func<ADL_Overdrive5_ODPerformanceLevels_Get_T>(
+                SYM_ADL_Overdrive5_ODPerformanceLevels_Get)(adapterIndex, idefault,
+                odPerformanceLevels);
     if (error != ADL_OK)
         throw Error(error, "ADL_Overdrive5_ODPerformanceLevels_Get error");
 }
@@ -364,8 +566,9 @@ void ATIADLHandle::Overdrive5_ODPerformanceLevels_Get(int adapterIndex, int idef
 void ATIADLHandle::Overdrive5_FanSpeed_Set(int adapterIndex, int thermalCtrlIndex,
                 ADLFanSpeedValue* fanSpeedValue) const
 {
-    int error = pADL_Overdrive5_FanSpeed_Set(adapterIndex, thermalCtrlIndex,
-                    fanSpeedValue);
+    int error = func<ADL_Overdrive5_FanSpeed_Set_T>(
+                SYM_ADL_Overdrive5_FanSpeed_Set)(adapterIndex, thermalCtrlIndex,
+                fanSpeedValue);
     if (error != ADL_OK)
         throw Error(error, "ADL_Overdrive5_FanSpeed_Set error");
 }
@@ -373,7 +576,9 @@ void ATIADLHandle::Overdrive5_FanSpeed_Set(int adapterIndex, int thermalCtrlInde
 void ATIADLHandle::Overdrive5_FanSpeedToDefault_Set(int adapterIndex,
                 int thermalCtrlIndex) const
 {
-    int error = pADL_Overdrive5_FanSpeedToDefault_Set(adapterIndex, thermalCtrlIndex);
+    int error = func<ADL_Overdrive5_FanSpeedToDefault_Set_T>(
+                SYM_ADL_Overdrive5_FanSpeedToDefault_Set)(adapterIndex,
+                thermalCtrlIndex);
     if (error != ADL_OK)
         throw Error(error, "ADL_Overdrive5_FanSpeedToDefault_Set error");
 }
@@ -381,7 +586,9 @@ void ATIADLHandle::Overdrive5_FanSpeedToDefault_Set(int adapterIndex,
 void ATIADLHandle::Overdrive5_ODPerformanceLevels_Set(int adapterIndex,
                 ADLODPerformanceLevels* odPerformanceLevels) const
 {
-    int error = pADL_Overdrive5_ODPerformanceLevels_Set(adapterIndex, odPerformanceLevels);
+    int error = func<ADL_Overdrive5_ODPerformanceLevels_Set_T>(
+                SYM_ADL_Overdrive5_ODPerformanceLevels_Set)(adapterIndex,
+                odPerformanceLevels);
     if (error != ADL_OK)
         throw Error(error, "ADL_Overdrive5_ODPerformanceLevels_Set error");
 }
@@ -389,8 +596,9 @@ void ATIADLHandle::Overdrive5_ODPerformanceLevels_Set(int adapterIndex,
 void ATIADLHandle::Overdrive5_PowerControlInfo_Get(int adapterIndex,
                 ADLPowerControlInfo* powerControlInfo) const
 {
-    int error = pADL_Overdrive5_PowerControlInfo_Get(adapterIndex,
-                    powerControlInfo);
+    int error = func<ADL_Overdrive5_PowerControlInfo_Get_T>(
+                SYM_ADL_Overdrive5_PowerControlInfo_Get)(adapterIndex,
+                powerControlInfo);
     if (error != ADL_OK)
         throw Error(error, "ADL_Overdrive5_PowerControlInfo_Get error");
 }
@@ -398,8 +606,9 @@ void ATIADLHandle::Overdrive5_PowerControlInfo_Get(int adapterIndex,
 void ATIADLHandle::Overdrive5_PowerControl_Get(int adapterIndex, int* currentValue,
                 int* defaultValue) const
 {
-    int error = pADL_Overdrive5_PowerControl_Get(adapterIndex, currentValue,
-                    defaultValue);
+    int error = func<ADL_Overdrive5_PowerControl_Get_T>(
+                SYM_ADL_Overdrive5_PowerControl_Get)(adapterIndex, currentValue,
+                defaultValue);
     if (error != ADL_OK)
         throw Error(error, "ADL_Overdrive5_PowerControl_Get error");
 }
@@ -407,22 +616,293 @@ void ATIADLHandle::Overdrive5_PowerControl_Get(int adapterIndex, int* currentVal
 
 void ATIADLHandle::Overdrive5_PowerControl_Set(int adapterIndex, int value) const
 {
-    int error = pADL_Overdrive5_PowerControl_Set(adapterIndex, value);
+    int error = func<ADL_Overdrive5_PowerControl_Set_T>(
+                SYM_ADL_Overdrive5_PowerControl_Set)(adapterIndex, value);
     if (error != ADL_OK)
         throw Error(error, "ADL_Overdrive5_PowerControl_Set error");
 }
 
+void ATIADLHandle::Main_Control_Create(ADL_MAIN_MALLOC_CALLBACK callback,
+                int iEnumConnectedAdapters, ADL_CONTEXT_HANDLE* context) const
+{
+    int error = func<ADL2_Main_Control_Create_T>(
+                SYM_ADL2_Main_Control_Create)(callback, iEnumConnectedAdapters,
+                context);
+    if (error != ADL_OK)
+        throw Error(error, "ADL2_Main_Control_Create error");
+}
+
+void ATIADLHandle::Main_Control_Destroy(ADL_CONTEXT_HANDLE context) const
+{
+    int error = func<ADL2_Main_Control_Destroy_T>(
+                SYM_ADL2_Main_Control_Destroy)(context);
+    if (error != ADL_OK)
+        throw Error(error, "ADL2_Main_Control_Destroy error");
+}
+
+void ATIADLHandle::Overdrive5_CurrentActivity_Get(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, ADLPMActivity* activity) const
+{
+    int error = func<ADL2_Overdrive5_CurrentActivity_Get_T>(
+                SYM_ADL2_Overdrive5_CurrentActivity_Get)(context, adapterIndex,
+                activity);
+    if (error != ADL_OK)
+        throw Error(error, "ADL2_Overdrive5_CurrentActivity_Get error");
+}
+
+void ATIADLHandle::Overdrive5_Temperature_Get(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, int thermalCtrlIndex, ADLTemperature *temperature) const
+{
+    int error = func<ADL2_Overdrive5_Temperature_Get_T>(
+                SYM_ADL2_Overdrive5_Temperature_Get)(context, adapterIndex,
+                thermalCtrlIndex, temperature);
+    if (error != ADL_OK)
+        throw Error(error, "ADL2_Overdrive5_Temperature_Get error");
+}
+
+void ATIADLHandle::Overdrive5_FanSpeedInfo_Get(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, int thermalCtrlIndex, ADLFanSpeedInfo* fanSpeedInfo) const
+{
+    int error = func<ADL2_Overdrive5_FanSpeedInfo_Get_T>(
+                SYM_ADL2_Overdrive5_FanSpeedInfo_Get)(context, adapterIndex,
+                thermalCtrlIndex, fanSpeedInfo);
+    if (error != ADL_OK)
+        throw Error(error, "ADL2_Overdrive5_FanSpeedInfo_Get error");
+}
+
+void ATIADLHandle::Overdrive5_FanSpeed_Get(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, int thermalCtrlIndex, ADLFanSpeedValue* fanSpeedValue) const
+{
+    int error = func<ADL2_Overdrive5_FanSpeed_Get_T>(
+                SYM_ADL2_Overdrive5_FanSpeed_Get)(context, adapterIndex,
+                thermalCtrlIndex, fanSpeedValue);
+    if (error != ADL_OK)
+        throw Error(error, "ADL2_Overdrive5_FanSpeed_Get error");
+}
+
+void ATIADLHandle::Overdrive5_ODParameters_Get(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, ADLODParameters* odParameters) const
+{
+    int error = func<ADL2_Overdrive5_ODParameters_Get_T>(
+                SYM_ADL2_Overdrive5_ODParameters_Get)(context, adapterIndex,
+                odParameters);
+    if (error != ADL_OK)
+        throw Error(error, "ADL2_Overdrive5_ODParameters_Get error");
+}
+
+void ATIADLHandle::Overdrive5_ODPerformanceLevels_Get(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, int idefault,
+                ADLODPerformanceLevels* odPerformanceLevels) const
+{
+    int error = func<ADL2_Overdrive5_ODPerformanceLevels_Get_T>(
+                SYM_ADL2_Overdrive5_ODPerformanceLevels_Get)(context, adapterIndex,
+                idefault, odPerformanceLevels);
+    if (error != ADL_OK)
+        throw Error(error, "ADL2_Overdrive5_ODPerformanceLevels_Get error");
+}
+
+void ATIADLHandle::Overdrive5_PowerControlInfo_Get(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, ADLPowerControlInfo* powerControlInfo) const
+{
+    int error = func<ADL2_Overdrive5_PowerControlInfo_Get_T>(
+                SYM_ADL2_Overdrive5_PowerControlInfo_Get)(context, adapterIndex,
+                powerControlInfo);
+    if (error != ADL_OK)
+        throw Error(error, "ADL2_Overdrive5_PowerControlInfo_Get error");
+}
+
+void ATIADLHandle::Overdrive5_PowerControl_Get(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, int* currentValue, int* defaultValue) const
+{
+    int error = func<ADL2_Overdrive5_PowerControl_Get_T>(
+                SYM_ADL2_Overdrive5_PowerControl_Get)(context, adapterIndex,
+                currentValue, defaultValue);
+    if (error != ADL_OK)
+        throw Error(error, "ADL2_Overdrive5_PowerControl_Get error");
+}
+
+void ATIADLHandle::Overdrive5_FanSpeed_Set(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, int thermalCtrlIndex, ADLFanSpeedValue* fanSpeedValue) const
+{
+    int error = func<ADL2_Overdrive5_FanSpeed_Set_T>(
+                SYM_ADL2_Overdrive5_FanSpeed_Set)(context, adapterIndex,
+                thermalCtrlIndex, fanSpeedValue);
+    if (error != ADL_OK)
+        throw Error(error, "ADL2_Overdrive5_FanSpeed_Set error");
+}
+
+void ATIADLHandle::Overdrive5_FanSpeedToDefault_Set(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, int thermalCtrlIndex) const
+{
+    int error = func<ADL2_Overdrive5_FanSpeedToDefault_Set_T>(
+                SYM_ADL2_Overdrive5_FanSpeedToDefault_Set)(context, adapterIndex,
+                thermalCtrlIndex);
+    if (error != ADL_OK)
+        throw Error(error, "ADL2_Overdrive5_FanSpeedToDefault_Set error");
+}
+
+void ATIADLHandle::Overdrive5_ODPerformanceLevels_Set(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, ADLODPerformanceLevels* odPerformanceLevels) const
+{
+    int error = func<ADL2_Overdrive5_ODPerformanceLevels_Set_T>(
+                SYM_ADL2_Overdrive5_ODPerformanceLevels_Set)(context, adapterIndex,
+                odPerformanceLevels);
+    if (error != ADL_OK)
+        throw Error(error, "ADL2_Overdrive5_ODPerformanceLevels_Set error");
+}
+
+void ATIADLHandle::Overdrive5_PowerControl_Set(ADL_CONTEXT_HANDLE context,
+                int adapterIndex, int value) const
+{
+    int error = func<ADL2_Overdrive5_PowerControl_Set_T>(
+                SYM_ADL2_Overdrive5_PowerControl_Set)(context, adapterIndex, value);
+    if (error != ADL_OK)
+        throw Error(error, "ADL2_Overdrive5_PowerControl_Set error");
+}
+
+/*
+ * OpenCL initialization
+ */
+
+/* fglrx creates /dev/ati/cardN nodes while initializing its OpenCL platform. This is
+ * needed only if no X11 server is running and devices are not yet created, hence
+ * libOpenCL is loaded at runtime and only when it is needed */
+
+typedef int (*clGetPlatformIDs_T)(unsigned int numEntries, void* platforms,
+            unsigned int* numPlatforms);
+
+class OpenCLInitializer
+{
+private:
+    std::once_flag initFlag;
+    std::thread initThread;
+    
+    static std::string getMarkerName();
+    static bool getBootId(char* buf, size_t bufSize);
+    bool isDoneInThisBoot() const;
+    void markDone() const;
+    void initialize();
+public:
+    ~OpenCLInitializer();
+    
+    // start initialization in background if it can be needed
+    void start(int devId);
+    // force initialization (waits for background initialization)
+    void force()
+    { std::call_once(initFlag, &OpenCLInitializer::initialize, this); }
+};
+
+OpenCLInitializer::~OpenCLInitializer()
+{
+    if (initThread.joinable())
+        initThread.join();
+}
+
+std::string OpenCLInitializer::getMarkerName()
+{ return std::string(sysRoot) + "/run/amdcovc/clinit"; }
+
+bool OpenCLInitializer::getBootId(char* buf, size_t bufSize)
+{
+    FILE* file = fopen("/proc/sys/kernel/random/boot_id", "rb");
+    if (file==nullptr)
+        return false;
+    const size_t readSize = fread(buf, 1, bufSize-1, file);
+    fclose(file);
+    buf[readSize] = 0;
+    return readSize!=0;
+}
+
+/* marker holds boot id of system in which initialization has been already done */
+bool OpenCLInitializer::isDoneInThisBoot() const
+{
+    char bootId[64], markerBootId[64];
+    if (!getBootId(bootId, 64))
+        return false;
+    FILE* file = fopen(getMarkerName().c_str(), "rb");
+    if (file==nullptr)
+        return false;
+    const size_t readSize = fread(markerBootId, 1, 63, file);
+    fclose(file);
+    markerBootId[readSize] = 0;
+    return ::strcmp(bootId, markerBootId)==0;
+}
+
+void OpenCLInitializer::markDone() const
+{
+    char bootId[64];
+    if (!getBootId(bootId, 64))
+        return;
+    // errors are ignored, marker is only hint
+    const std::string dirName = std::string(sysRoot) + "/run/amdcovc";
+    mkdir(dirName.c_str(), 0755);
+    const std::string markerName = getMarkerName();
+    FILE* file = fopen(markerName.c_str(), "wb");
+    if (file==nullptr)
+        return;
+    fputs(bootId, file);
+    fclose(file);
+}
+
+void OpenCLInitializer::initialize()
+{
+    void* clHandle = dlopen("libOpenCL.so.1", RTLD_LAZY|RTLD_GLOBAL);
+    if (clHandle==nullptr)
+        clHandle = dlopen("libOpenCL.so", RTLD_LAZY|RTLD_GLOBAL);
+    if (clHandle==nullptr)
+        return; // no OpenCL, opening device just fails
+    clGetPlatformIDs_T pclGetPlatformIDs =
+            (clGetPlatformIDs_T)dlsym(clHandle, "clGetPlatformIDs");
+    if (pclGetPlatformIDs==nullptr)
+        return;
+    unsigned int platformsNum;
+    /// force initializing these stupid devices
+    pclGetPlatformIDs(0, nullptr, &platformsNum);
+    markDone();
+    // library is not unloaded, OpenCL implementations do not like it
+}
+
+void OpenCLInitializer::start(int devId)
+{
+    if (initThread.joinable())
+        return; // already started
+    char devName[512];
+    snprintf(devName, 512, "%s/dev/ati/card%u", sysRoot, devId);
+    if (access(devName, F_OK)==0 || isDoneInThisBoot())
+        return; // devices already created
+    initThread = std::thread(&OpenCLInitializer::force, this);
+}
+
+static OpenCLInitializer openCLInitializer;
+
 class ADLMainControl
 {
 private:
     const ATIADLHandle& handle;
     int fd;
+    ADL_CONTEXT_HANDLE context;
     bool mainControlCreated;
     bool withX;
 public:
-    explicit ADLMainControl(const ATIADLHandle& handle, int devId);
+    /* if ownContext is true, then control uses own ADL2 context. Context can be
+     * created only if main ADL control has been already created */
+    explicit ADLMainControl(const ATIADLHandle& handle, int devId,
+                bool ownContext = false);
     ~ADLMainControl();
     
+    bool isContextSupported() const
+    { return handle.isADL2Supported(); }
+    /* returns true if set functions use own context of this control, so they
+     * can be called concurrently with other controls */
+    bool isContextSetSupported() const
+    { return context!=nullptr && handle.hasCapability(ADLCAP_ADL2_SET); }
+    // returns true if setPowerControl uses own context of this control
+    bool isContextPowerControlSetSupported() const
+    { return isContextSetSupported() && handle.hasCapability(ADLCAP_ADL2_POWER_CONTROL); }
+    // returns true if PowerControl functions are available for this control
+    bool isPowerControlSupported() const
+    { return handle.hasCapability(context!=nullptr ? ADLCAP_ADL2_POWER_CONTROL :
+                ADLCAP_POWER_CONTROL); }
+    
     int getAdaptersNum() const;
     bool isAdapterActive(int adapterIndex) const;
     void getAdapterInfo(AdapterInfo* infos) const;
@@ -430,14 +910,16 @@ public:
     int getTemperature(int adapterIndex, int thermalCtrlIndex) const;
     void getFanSpeedInfo(int adapterIndex, int thermalCtrlIndex,
             ADLFanSpeedInfo& info) const;
-    int getFanSpeed(int adapterIndex, int thermalCtrlIndex) const;
+    // if userDefined is given, then it is set if fan speed is set by user
+    int getFanSpeed(int adapterIndex, int thermalCtrlIndex,
+            bool* userDefined = nullptr) const;
     void getODParameters(int adapterIndex, ADLODParameters& odParameters) const;
     void getODPerformanceLevels(int adapterIndex, bool isDefault, int perfLevelsNum,
             ADLODPerformanceLevel* perfLevels) const;
     void setFanSpeed(int adapterIndex, int thermalCtrlIndex, int fanSpeed) const;
     void setFanSpeedToDefault(int adapterIndex, int thermalCtrlIndex) const;
     void setODPerformanceLevels(int adapterIndex, int perfLevelsNum,
-            ADLODPerformanceLevel* perfLevels) const;
+            const ADLODPerformanceLevel* perfLevels) const;
     void getPowerControlInfo(int adapterIndex,
             ADLPowerControlInfo& powerControlInfo) const;
     void getPowerControl(int adapterIndex, int& currentValue,
@@ -445,9 +927,16 @@ public:
     void setPowerControl(int adapterIndex, int value) const;
 };
 
-ADLMainControl::ADLMainControl(const ATIADLHandle& _handle, int devId)
-try : handle(_handle), fd(-1), mainControlCreated(false), withX(true)
+ADLMainControl::ADLMainControl(const ATIADLHandle& _handle, int devId, bool ownContext)
+try : handle(_handle), fd(-1), context(nullptr), mainControlCreated(false), withX(true)
 {
+    if (ownContext)
+    {
+        if (!handle.isADL2Supported())
+            throw Error("ADL2 API is not supported");
+        handle.Main_Control_Create(ADL_Main_Memory_Alloc, 0, &context);
+        return;
+    }
     try
     { handle.Main_Control_Create(ADL_Main_Memory_Alloc, 0); }
     catch(const Error& error)
@@ -457,15 +946,13 @@ try : handle(_handle), fd(-1), mainControlCreated(false), withX(true)
                     "working correctly\nif no running X11 server." << std::endl;
     
         withX = false;
-        char devName[64];
-        snprintf(devName, 64, "/dev/ati/card%u", devId);
+        char devName[512];
+        snprintf(devName, 512, "%s/dev/ati/card%u", sysRoot, devId);
         errno = 0;
         fd = open(devName, O_RDWR);
         if (fd==-1)
         {
-            cl_uint platformsNum;
-            /// force initializing these stupid devices
-            clGetPlatformIDs(0, nullptr, &platformsNum);
+            openCLInitializer.force();
             errno = 0;
             fd = open(devName, O_RDWR);
             if (fd==-1)
@@ -487,6 +974,11 @@ catch(...)
 
 ADLMainControl::~ADLMainControl()
 {
+    if (context!=nullptr)
+        try
+        { handle.Main_Control_Destroy(context); }
+        catch(const Error& error)
+        { }
     if (fd!=-1)
         close(fd);
 }
@@ -518,14 +1010,20 @@ void ADLMainControl::getAdapterInfo(AdapterInfo* infos) const
 void ADLMainControl::getCurrentActivity(int adapterIndex, ADLPMActivity& activity) const
 {
     activity.iSize = sizeof(ADLPMActivity);
-    handle.Overdrive5_CurrentActivity_Get(adapterIndex, &activity);
+    if (context!=nullptr)
+        handle.Overdrive5_CurrentActivity_Get(context, adapterIndex, &activity);
+    else
+        handle.Overdrive5_CurrentActivity_Get(adapterIndex, &activity);
 }
 
 int ADLMainControl::getTemperature(int adapterIndex, int thermalCtrlIndex) const
 {
     ADLTemperature temp;
     temp.iSize = sizeof(ADLTemperature);
-    handle.Overdrive5_Temperature_Get(adapterIndex, thermalCtrlIndex, &temp);
+    if (context!=nullptr)
+        handle.Overdrive5_Temperature_Get(context, adapterIndex, thermalCtrlIndex, &temp);
+    else
+        handle.Overdrive5_Temperature_Get(adapterIndex, thermalCtrlIndex, &temp);
     return temp.iTemperature;
 }
 
@@ -533,23 +1031,36 @@ void ADLMainControl::getFanSpeedInfo(int adapterIndex, int thermalCtrlIndex,
                 ADLFanSpeedInfo& info) const
 {
     info.iSize = sizeof(ADLFanSpeedInfo);
-    handle.Overdrive5_FanSpeedInfo_Get(adapterIndex, thermalCtrlIndex, &info);
+    if (context!=nullptr)
+        handle.Overdrive5_FanSpeedInfo_Get(context, adapterIndex, thermalCtrlIndex, &info);
+    else
+        handle.Overdrive5_FanSpeedInfo_Get(adapterIndex, thermalCtrlIndex, &info);
 }
 
-int ADLMainControl::getFanSpeed(int adapterIndex, int thermalCtrlIndex) const
+int ADLMainControl::getFanSpeed(int adapterIndex, int thermalCtrlIndex,
+            bool* userDefined) const
 {
     ADLFanSpeedValue fanSpeedValue;
     fanSpeedValue.iSpeedType = ADL_DL_FANCTRL_SPEED_TYPE_PERCENT;
     fanSpeedValue.iFlags = 0;
     fanSpeedValue.iSize = sizeof(ADLFanSpeedValue);
-    handle.Overdrive5_FanSpeed_Get(adapterIndex, thermalCtrlIndex, &fanSpeedValue);
+    if (context!=nullptr)
+        handle.Overdrive5_FanSpeed_Get(context, adapterIndex, thermalCtrlIndex,
+                    &fanSpeedValue);
+    else
+        handle.Overdrive5_FanSpeed_Get(adapterIndex, thermalCtrlIndex, &fanSpeedValue);
+    if (userDefined!=nullptr)
+        *userDefined = (fanSpeedValue.iFlags & ADL_DL_FANCTRL_FLAG_USER_DEFINED_SPEED)!=0;
     return fanSpeedValue.iFanSpeed;
 }
 
 void ADLMainControl::getODParameters(int adapterIndex, ADLODParameters& odParameters) const
 {
     odParameters.iSize = sizeof(ADLODParameters);
-    handle.Overdrive5_ODParameters_Get(adapterIndex, &odParameters);
+    if (context!=nullptr)
+        handle.Overdrive5_ODParameters_Get(context, adapterIndex, &odParameters);
+    else
+        handle.Overdrive5_ODParameters_Get(adapterIndex, &odParameters);
 }
 
 void ADLMainControl::getODPerformanceLevels(int adapterIndex, bool isDefault,
@@ -560,7 +1071,11 @@ void ADLMainControl::getODPerformanceLevels(int adapterIndex, bool isDefault,
     std::unique_ptr<char[]> odPlBuf(new char[odPLBufSize]);
     ADLODPerformanceLevels* odPLevels = (ADLODPerformanceLevels*)odPlBuf.get();
     odPLevels->iSize = odPLBufSize;
-    handle.Overdrive5_ODPerformanceLevels_Get(adapterIndex, isDefault, odPLevels);
+    if (context!=nullptr)
+        handle.Overdrive5_ODPerformanceLevels_Get(context, adapterIndex, isDefault,
+                    odPLevels);
+    else
+        handle.Overdrive5_ODPerformanceLevels_Get(adapterIndex, isDefault, odPLevels);
     std::copy(odPLevels->aLevels, odPLevels->aLevels+perfLevelsNum, perfLevels);
 }
 
@@ -570,16 +1085,23 @@ void ADLMainControl::setFanSpeed(int adapterIndex, int thermalCtrlIndex, int fan
     fanSpeedValue.iSize = sizeof(ADLFanSpeedValue);
     fanSpeedValue.iSpeedType = ADL_DL_FANCTRL_SPEED_TYPE_PERCENT;
     fanSpeedValue.iFanSpeed = fanSpeed;
-    handle.Overdrive5_FanSpeed_Set(adapterIndex, thermalCtrlIndex, &fanSpeedValue);
+    if (isContextSetSupported())
+        handle.Overdrive5_FanSpeed_Set(context, adapterIndex, thermalCtrlIndex,
+                    &fanSpeedValue);
+    else
+        handle.Overdrive5_FanSpeed_Set(adapterIndex, thermalCtrlIndex, &fanSpeedValue);
 }
 
 void ADLMainControl::setFanSpeedToDefault(int adapterIndex, int thermalCtrlIndex) const
 {
-    handle.Overdrive5_FanSpeedToDefault_Set(adapterIndex, thermalCtrlIndex);
+    if (isContextSetSupported())
+        handle.Overdrive5_FanSpeedToDefault_Set(context, adapterIndex, thermalCtrlIndex);
+    else
+        handle.Overdrive5_FanSpeedToDefault_Set(adapterIndex, thermalCtrlIndex);
 }
 
 void ADLMainControl::setODPerformanceLevels(int adapterIndex, int perfLevelsNum,
-            ADLODPerformanceLevel* perfLevels) const
+            const ADLODPerformanceLevel* perfLevels) const
 {
     const size_t odPLBufSize = sizeof(ADLODPerformanceLevels)+
                     sizeof(ADLODPerformanceLevel)*(perfLevelsNum-1);
@@ -588,24 +1110,37 @@ void ADLMainControl::setODPerformanceLevels(int adapterIndex, int perfLevelsNum,
     odPLevels->iSize = odPLBufSize;
     odPLevels->iReserved = 0;
     std::copy(perfLevels, perfLevels+perfLevelsNum, odPLevels->aLevels);
-    handle.Overdrive5_ODPerformanceLevels_Set(adapterIndex, odPLevels);
+    if (isContextSetSupported())
+        handle.Overdrive5_ODPerformanceLevels_Set(context, adapterIndex, odPLevels);
+    else
+        handle.Overdrive5_ODPerformanceLevels_Set(adapterIndex, odPLevels);
 }
 
 void ADLMainControl::getPowerControlInfo(int adapterIndex,
             ADLPowerControlInfo& powerControlInfo) const
 {
-    handle.Overdrive5_PowerControlInfo_Get(adapterIndex, &powerControlInfo);
+    if (context!=nullptr)
+        handle.Overdrive5_PowerControlInfo_Get(context, adapterIndex, &powerControlInfo);
+    else
+        handle.Overdrive5_PowerControlInfo_Get(adapterIndex, &powerControlInfo);
 }
 
 void ADLMainControl::getPowerControl(int adapterIndex, int& currentValue,
             int& defaultValue) const
 {
-    handle.Overdrive5_PowerControl_Get(adapterIndex, &currentValue, &defaultValue);
+    if (context!=nullptr)
+        handle.Overdrive5_PowerControl_Get(context, adapterIndex, &currentValue,
+                    &defaultValue);
+    else
+        handle.Overdrive5_PowerControl_Get(adapterIndex, &currentValue, &defaultValue);
 }
 
 void ADLMainControl::setPowerControl(int adapterIndex, int value) const
 {
-    handle.Overdrive5_PowerControl_Set(adapterIndex, value);
+    if (isContextPowerControlSetSupported())
+        handle.Overdrive5_PowerControl_Set(context, adapterIndex, value);
+    else
+        handle.Overdrive5_PowerControl_Set(adapterIndex, value);
 }
 
 static pci_access* pciAccess = nullptr;
@@ -620,786 +1155,6421 @@ static void pciAccessError(char* msg, ...)
     exit(-1);
 }
 
-static void initializePCIAccess()
+static bool pciInitialized = false;
+static bool pciBusScanned = false;
+
+// only allocates libpci structure (to get path to PCI IDs database)
+static void allocatePCIAccess()
 {
+    if (pciAccess!=nullptr)
+        return;
     pciAccess = pci_alloc();
     if (pciAccess==nullptr)
         throw Error("Can't allocate PCIAccess");
     pciAccess->error = pciAccessError;
-    pci_filter_init(pciAccess, &pciFilter);
-    pci_init(pciAccess);
-    pci_scan_bus(pciAccess);
 }
 
-static void getFromPCI(int deviceIndex, AdapterInfo& adapterInfo)
+/* initialize libpci. Bus is scanned only if scanBus is true
+ * (name lookup does not require scanning) */
+static void initializePCIAccess(bool scanBus)
 {
-    if (pciAccess==nullptr)
-        initializePCIAccess();
-    char fnameBuf[64];
-    snprintf(fnameBuf, 64, "/proc/ati/%u/name", deviceIndex);
-    std::string tmp, pciBusStr;
+    allocatePCIAccess();
+    if (!pciInitialized)
     {
-        std::ifstream procNameIs(fnameBuf);
-        procNameIs.exceptions(std::ios::badbit|std::ios::failbit);
-        procNameIs >> tmp >> tmp >> pciBusStr;
-    }
-    unsigned int busNum, devNum, funcNum;
-    if (pciBusStr.size() < 9)
-        throw Error("Wrong PCI Bus string");
-    char* pciStrPtr = (char*)pciBusStr.data()+4;
-    char* pciStrPtrNew;
-    errno  = 0;
-    busNum = strtoul(pciStrPtr, &pciStrPtrNew, 10);
-    if (errno!=0 || pciStrPtr==pciStrPtrNew)
-        throw Error(errno, "Can't parse BusID");
-    pciStrPtr = pciStrPtrNew+1;
-    errno  = 0;
-    devNum = strtoul(pciStrPtr, &pciStrPtr, 10);
-    if (errno!=0 || pciStrPtr==pciStrPtrNew)
-        throw Error(errno, "Can't parse DevID");
-    pciStrPtr = pciStrPtrNew+1;
-    errno  = 0;
-    funcNum = strtoul(pciStrPtr, &pciStrPtr, 10);
-    if (errno!=0 || pciStrPtr==pciStrPtrNew)
-        throw Error(errno, "Can't parse FuncID");
-    pci_dev* dev = pciAccess->devices;
-    for (; dev!=nullptr; dev=dev->next)
-        if (dev->bus==busNum && dev->dev==devNum && dev->func==funcNum)
-        {
-            char deviceBuf[128];
-            deviceBuf[0] = 0;
-            pci_lookup_name(pciAccess, deviceBuf, 128, PCI_LOOKUP_DEVICE,
-                    dev->vendor_id, dev->device_id);
-            adapterInfo.iBusNumber = busNum;
-            adapterInfo.iDeviceNumber = devNum;
-            adapterInfo.iFunctionNumber = funcNum;
-            adapterInfo.iVendorID = dev->vendor_id;
-            strcpy(adapterInfo.strAdapterName, deviceBuf);
-            break;
+        pci_filter_init(pciAccess, &pciFilter);
+        if (*sysRoot!=0)
+        {
+            // bus scanning reads sysfs or procfs under system root
+            const std::string sysfsPath = std::string(sysRoot) + "/sys/bus/pci";
+            const std::string procPath = std::string(sysRoot) + "/proc/bus/pci";
+            pci_set_param(pciAccess, (char*)"sysfs.path", (char*)sysfsPath.c_str());
+            pci_set_param(pciAccess, (char*)"proc.path", (char*)procPath.c_str());
         }
+        pci_init(pciAccess);
+        pciInitialized = true;
+    }
+    if (scanBus && !pciBusScanned)
+    {
+        pci_scan_bus(pciAccess);
+        pciBusScanned = true;
+    }
 }
 
-static void getActiveAdaptersIndices(ADLMainControl& mainControl, int adaptersNum,
-                    std::vector<int>& activeAdapters)
+/* read small text file into buffer, returns false if file can't be read */
+static bool readSmallFile(const char* filename, char* buf, size_t bufSize)
 {
-    activeAdapters.clear();
-    for (int i = 0; i < adaptersNum; i++)
-        if (mainControl.isAdapterActive(i))
-            activeAdapters.push_back(i);
+    int fd = open(filename, O_RDONLY);
+    if (fd==-1)
+        return false;
+    ssize_t readSize = read(fd, buf, bufSize-1);
+    close(fd);
+    if (readSize <= 0)
+        return false;
+    buf[readSize] = 0;
+    return true;
 }
 
-static void printAdaptersInfo(ADLMainControl& mainControl, int adaptersNum,
-            const std::vector<int>& activeAdapters,
-            const std::vector<int>& choosenAdapters, bool useChoosen)
+// read hexadecimal value from sysfs attribute (like '0x1002')
+static bool readSysfsHexValue(const char* filename, unsigned int& value)
 {
-    std::unique_ptr<AdapterInfo[]> adapterInfos(new AdapterInfo[adaptersNum]);
-    ::memset(adapterInfos.get(), 0, sizeof(AdapterInfo)*adaptersNum);
-    mainControl.getAdapterInfo(adapterInfos.get());
-    int i = 0;
-    auto choosenIter = choosenAdapters.begin();
-    for (int ai = 0; ai < adaptersNum; ai++)
-    {
-        if (!mainControl.isAdapterActive(ai))
-            continue;
-        if (useChoosen && (choosenIter==choosenAdapters.end() || *choosenIter!=i))
-        { i++; continue; }
-        
-        if (adapterInfos[ai].strAdapterName[0]==0)
-            getFromPCI(adapterInfos[ai].iAdapterIndex, adapterInfos[ai]);
-        
-        ADLPMActivity activity;
-        int pwrCtrlVal, pwrCtrlDef;
-        mainControl.getCurrentActivity(ai, activity);
-        mainControl.getPowerControl(ai, pwrCtrlVal, pwrCtrlDef);
-        std::cout << "Adapter " << i << ": " << adapterInfos[ai].strAdapterName << "\n"
-                "  Core: " << activity.iEngineClock/100.0 << " MHz, "
-                "Mem: " << activity.iMemoryClock/100.0 << " MHz, "
-                "Vddc: " << activity.iVddc/1000.0 << " V, "
-                "Load: " << activity.iActivityPercent << "%, "
-                "Temp: " << mainControl.getTemperature(ai, 0)/1000.0 << " C, "
-                "Fan: " << mainControl.getFanSpeed(ai, 0) << "%, "
-                "PwrCtrl: " << std::showpos << pwrCtrlVal << "%"
-                << std::noshowpos << std::endl;
-        ADLODParameters odParams;
-        mainControl.getODParameters(ai, odParams);
-        std::cout << "  Max Ranges: Core: " << odParams.sEngineClock.iMin/100.0 << " - " <<
-            odParams.sEngineClock.iMax/100.0 << " MHz, "
-            "Mem: " << odParams.sMemoryClock.iMin/100.0 << " - " <<
-                odParams.sMemoryClock.iMax/100.0 << " MHz, "
-            "Vddc: " << odParams.sVddc.iMin/1000.0 << " - " <<
-                odParams.sVddc.iMax/1000.0 << " V" << std::endl;
-        int levelsNum = odParams.iNumberOfPerformanceLevels;
-        std::unique_ptr<ADLODPerformanceLevel[]> odPLevels(
-                new ADLODPerformanceLevel[levelsNum]);
-        mainControl.getODPerformanceLevels(ai, false, levelsNum, odPLevels.get());
-        std::cout << "  PerfLevels: Core: " << odPLevels[0].iEngineClock/100.0 << " - " <<
-            odPLevels[levelsNum-1].iEngineClock/100.0 << " MHz, "
-            "Mem: " << odPLevels[0].iMemoryClock/100.0 << " - " <<
-            odPLevels[levelsNum-1].iMemoryClock/100.0 << " MHz, "
-            "Vddc: " << odPLevels[0].iVddc/1000.0 << " - " <<
-            odPLevels[levelsNum-1].iVddc/1000.0 << " V\n";
-        if (useChoosen)
-            ++choosenIter;
-        i++;
-    }
+    char buf[32];
+    if (!readSmallFile(filename, buf, 32))
+        return false;
+    char* endptr;
+    errno = 0;
+    unsigned long v = strtoul(buf, &endptr, 16);
+    if (errno!=0 || endptr==buf)
+        return false;
+    value = v;
+    return true;
 }
 
-static void printAdaptersInfoVerbose(ADLMainControl& mainControl, int adaptersNum,
-            const std::vector<int>& activeAdapters,
-            const std::vector<int>& choosenAdapters, bool useChoosen)
+/* find PCI domain of device in sysfs (lowest domain if device address is
+ * in many domains). Returns -1 if device or sysfs is not available */
+static int findPCIDomainInSysfs(unsigned int busNum, unsigned int devNum,
+            unsigned int funcNum)
 {
-    std::unique_ptr<AdapterInfo[]> adapterInfos(new AdapterInfo[adaptersNum]);
-    ::memset(adapterInfos.get(), 0, sizeof(AdapterInfo)*adaptersNum);
-    mainControl.getAdapterInfo(adapterInfos.get());
-    int i = 0;
-    auto choosenIter = choosenAdapters.begin();
-    for (int ai = 0; ai < adaptersNum; ai++)
+    const std::string dirName = std::string(sysRoot) + "/sys/bus/pci/devices";
+    DIR* dir = opendir(dirName.c_str());
+    if (dir==nullptr)
+        return -1;
+    int domain = -1;
+    while (dirent* entry = readdir(dir))
     {
-        if (!mainControl.isAdapterActive(ai))
-            continue;
-        if (useChoosen && (choosenIter==choosenAdapters.end() || *choosenIter!=i))
-        { i++; continue; }
-        if (adapterInfos[ai].strAdapterName[0]==0)
-            getFromPCI(adapterInfos[ai].iAdapterIndex, adapterInfos[ai]);
-        std::cout << "Adapter " << i << ": " << adapterInfos[ai].strAdapterName << "\n"
-                "  Device Topology: " << adapterInfos[ai].iBusNumber << ':' <<
-                adapterInfos[ai].iDeviceNumber << ":" <<
-                adapterInfos[ai].iFunctionNumber << "\n"
-                "  Vendor ID: " << adapterInfos[ai].iVendorID << std::endl;
-        ADLFanSpeedInfo fsInfo;
-        ADLPMActivity activity;
-        int pwrCtrlVal, pwrCtrlDef;
-        ADLPowerControlInfo pwrCtrlInfo;
-        mainControl.getCurrentActivity(ai, activity);
-        std::cout << "  Current CoreClock: " << activity.iEngineClock/100.0 << " MHz\n"
-                "  Current MemoryClock: " << activity.iMemoryClock/100.0 << " MHz\n"
-                "  Current Voltage: " << activity.iVddc/1000.0 << " V\n"
-                "  GPU Load: " << activity.iActivityPercent << "%\n"
-                "  Current PerfLevel: " << activity.iCurrentPerformanceLevel << "\n"
-                "  Current BusSpeed: " << activity.iCurrentBusSpeed << "\n"
-                "  Current BusLanes: " << activity.iCurrentBusLanes<< "\n";
-        
-        int temperature = mainControl.getTemperature(ai, 0);
-        std::cout << "  Temperature: " << temperature/1000.0 << " C\n";
-        mainControl.getFanSpeedInfo(ai, 0, fsInfo);
-        std::cout << "  FanSpeed Min: " << fsInfo.iMinPercent << "%\n"
-                "  FanSpeed Max: " << fsInfo.iMaxPercent << "%\n"
-                "  FanSpeed MinRPM: " << fsInfo.iMinRPM << " RPM\n"
-                "  FanSpeed MaxRPM: " << fsInfo.iMaxRPM << " RPM" << "\n";
-        std::cout << "  Current FanSpeed: " << mainControl.getFanSpeed(ai, 0) << "%\n";
-        mainControl.getPowerControlInfo(ai, pwrCtrlInfo);
-        mainControl.getPowerControl(ai, pwrCtrlVal, pwrCtrlDef);
-        std::cout << "  PowerControl Min: " << std::showpos << pwrCtrlInfo.iMinValue << "%\n"
-                "  PowerControl Max: " << pwrCtrlInfo.iMaxValue << "%\n"
-                "  Current PowerControl: " << pwrCtrlVal << "%\n" << std::noshowpos;
-        ADLODParameters odParams;
-        mainControl.getODParameters(ai, odParams);
-        std::cout << "  CoreClock: " << odParams.sEngineClock.iMin/100.0 << " - " <<
-                odParams.sEngineClock.iMax/100.0 << " MHz, step: " <<
-                odParams.sEngineClock.iStep/100.0 << " MHz\n"
-                "  MemClock: " << odParams.sMemoryClock.iMin/100.0 << " - " <<
-                odParams.sMemoryClock.iMax/100.0 << " MHz, step: " <<
-                odParams.sMemoryClock.iStep/100.0 << " MHz\n"
-                "  Voltage: " << odParams.sVddc.iMin/1000.0 << " - " <<
-                odParams.sVddc.iMax/1000.0 << " V, step: " <<
-                odParams.sVddc.iStep/1000.0 << " V\n";
-        std::unique_ptr<ADLODPerformanceLevel[]> odPLevels(
-                new ADLODPerformanceLevel[odParams.iNumberOfPerformanceLevels]);
-        mainControl.getODPerformanceLevels(ai, false, odParams.iNumberOfPerformanceLevels,
-                                odPLevels.get());
-        std::cout << "  Performance levels: " << odParams.iNumberOfPerformanceLevels << "\n";
-        for (int j = 0; j < odParams.iNumberOfPerformanceLevels; j++)
-            std::cout << "    Performance Level: " << j << "\n"
-                "      CoreClock: " << odPLevels[j].iEngineClock/100.0 << " MHz\n"
-                "      MemClock: " << odPLevels[j].iMemoryClock/100.0 << " MHz\n"
-                "      Voltage: " << odPLevels[j].iVddc/1000.0 << " V\n";
-        mainControl.getODPerformanceLevels(ai, true, odParams.iNumberOfPerformanceLevels,
-                                odPLevels.get());
-        std::cout << "  Default Performance levels: " <<
-                        odParams.iNumberOfPerformanceLevels << "\n";
-        for (int j = 0; j < odParams.iNumberOfPerformanceLevels; j++)
-            std::cout << "    Performance Level: " << j << "\n"
-                "      CoreClock: " << odPLevels[j].iEngineClock/100.0 << " MHz\n"
-                "      MemClock: " << odPLevels[j].iMemoryClock/100.0 << " MHz\n"
-                "      Voltage: " << odPLevels[j].iVddc/1000.0 << " V\n";
-        std::cout.flush();
-        if (useChoosen)
-            ++choosenIter;
-        i++;
+        unsigned int d, b, dv, f;
+        if (sscanf(entry->d_name, "%x:%x:%x.%x", &d, &b, &dv, &f)==4 &&
+            b==busNum && dv==devNum && f==funcNum && (domain==-1 || int(d) < domain))
+            domain = d;
+    }
+    closedir(dir);
+    return domain;
+}
+
+/* get PCI vendor and device ID directly from sysfs, without scanning bus.
+ * returns false if sysfs is not available */
+static bool getPCIIdsFromSysfs(unsigned int domain, unsigned int busNum,
+            unsigned int devNum, unsigned int funcNum, unsigned int& vendorId,
+            unsigned int& deviceId)
+{
+    char fnameBuf[512];
+    snprintf(fnameBuf, 512, "%s/sys/bus/pci/devices/%04x:%02x:%02x.%x/vendor",
+             sysRoot, domain, busNum, devNum, funcNum);
+    if (!readSysfsHexValue(fnameBuf, vendorId))
+        return false;
+    snprintf(fnameBuf, 512, "%s/sys/bus/pci/devices/%04x:%02x:%02x.%x/device",
+             sysRoot, domain, busNum, devNum, funcNum);
+    return readSysfsHexValue(fnameBuf, deviceId);
+}
+
+/* persistent cache of adapter names resolved from PCI IDs database.
+ * File is memory-mapped, entries are keyed by PCI topology and vendor/device ID.
+ * Cache is invalidated if the PCI IDs database has been changed, entry is replaced
+ * if other device is at its topology */
+class PCINameCache
+{
+public:
+    struct Entry
+    {
+        uint32_t domain;
+        uint8_t busNum;
+        uint8_t devNum;
+        uint8_t funcNum;
+        uint8_t reserved;
+        uint16_t vendorId;
+        uint16_t deviceId;
+        char name[128];
+    };
+private:
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t entriesNum;
+        int64_t pciIdsMTime;
+        int64_t pciIdsSize;
+    };
+    
+    bool loaded;
+    bool changed;
+    int64_t pciIdsMTime;
+    int64_t pciIdsSize;
+    std::vector<Entry> entries;
+    
+    void load();
+    std::string getFileName() const;
+public:
+    PCINameCache() : loaded(false), changed(false), pciIdsMTime(0), pciIdsSize(0)
+    { }
+    
+    const Entry* find(unsigned int domain, unsigned int busNum, unsigned int devNum,
+                unsigned int funcNum, unsigned int vendorId, unsigned int deviceId);
+    void store(unsigned int domain, unsigned int busNum, unsigned int devNum,
+                unsigned int funcNum, unsigned int vendorId, unsigned int deviceId,
+                const char* name);
+    // write cache if changed. Errors are ignored (cache is only optimization)
+    void save();
+};
+
+static const char pciNameCacheMagic[8] = { 'A', 'M', 'D', 'C', 'O', 'V', 'C', 'N' };
+static const uint32_t pciNameCacheVersion = 2;
+static const char* pciNameCacheDir = "/var/cache/amdcovc";
+
+std::string PCINameCache::getFileName() const
+{
+    return std::string(sysRoot) + pciNameCacheDir + "/pcinames";
+}
+
+void PCINameCache::load()
+{
+    loaded = true;
+    // PCI IDs database (file path is known just after allocation)
+    allocatePCIAccess();
+    struct stat pciIdsStat;
+    if (pciAccess->id_file_name==nullptr || stat(pciAccess->id_file_name, &pciIdsStat)!=0)
+        return;
+    pciIdsMTime = pciIdsStat.st_mtime;
+    pciIdsSize = pciIdsStat.st_size;
+    
+    int fd = open(getFileName().c_str(), O_RDONLY);
+    if (fd==-1)
+        return;
+    struct stat cacheStat;
+    if (fstat(fd, &cacheStat)!=0 || size_t(cacheStat.st_size) < sizeof(Header))
+    {
+        close(fd);
+        return;
+    }
+    const size_t mapSize = cacheStat.st_size;
+    void* map = mmap(nullptr, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map==MAP_FAILED)
+        return;
+    const Header* header = (const Header*)map;
+    if (::memcmp(header->magic, pciNameCacheMagic, 8)==0 && header->version==pciNameCacheVersion &&
+        header->pciIdsMTime==pciIdsMTime && header->pciIdsSize==pciIdsSize &&
+        mapSize == sizeof(Header) + header->entriesNum*sizeof(Entry))
+    {
+        const Entry* mapEntries = (const Entry*)(header+1);
+        entries.assign(mapEntries, mapEntries + header->entriesNum);
+        for (Entry& entry: entries)
+            entry.name[127] = 0;
+    }
+    else // invalidate
+        changed = true;
+    munmap(map, mapSize);
+}
+
+const PCINameCache::Entry* PCINameCache::find(unsigned int domain, unsigned int busNum,
+            unsigned int devNum, unsigned int funcNum, unsigned int vendorId,
+            unsigned int deviceId)
+{
+    if (!loaded)
+        load();
+    for (const Entry& entry: entries)
+        if (entry.domain==domain && entry.busNum==busNum && entry.devNum==devNum &&
+            entry.funcNum==funcNum && entry.vendorId==vendorId &&
+            entry.deviceId==deviceId)
+            return &entry;
+    return nullptr;
+}
+
+void PCINameCache::store(unsigned int domain, unsigned int busNum, unsigned int devNum,
+            unsigned int funcNum, unsigned int vendorId, unsigned int deviceId,
+            const char* name)
+{
+    if (!loaded)
+        load();
+    Entry newEntry;
+    ::memset(&newEntry, 0, sizeof(Entry));
+    newEntry.domain = domain;
+    newEntry.busNum = busNum;
+    newEntry.devNum = devNum;
+    newEntry.funcNum = funcNum;
+    newEntry.vendorId = vendorId;
+    newEntry.deviceId = deviceId;
+    snprintf(newEntry.name, 128, "%s", name);
+    changed = true;
+    // replace entry for this topology (device set has been changed)
+    for (Entry& entry: entries)
+        if (entry.domain==domain && entry.busNum==busNum && entry.devNum==devNum &&
+            entry.funcNum==funcNum)
+        {
+            entry = newEntry;
+            return;
+        }
+    entries.push_back(newEntry);
+}
+
+void PCINameCache::save()
+{
+    if (!changed || pciIdsSize==0)
+        return;
+    changed = false;
+    const std::string dirName = std::string(sysRoot) + pciNameCacheDir;
+    mkdir(dirName.c_str(), 0755);
+    std::string tmpName = dirName + "/pcinames.XXXXXX";
+    int fd = mkstemp(&tmpName[0]);
+    if (fd==-1)
+        return;
+    Header header;
+    ::memcpy(header.magic, pciNameCacheMagic, 8);
+    header.version = pciNameCacheVersion;
+    header.entriesNum = entries.size();
+    header.pciIdsMTime = pciIdsMTime;
+    header.pciIdsSize = pciIdsSize;
+    const size_t entriesSize = entries.size()*sizeof(Entry);
+    bool good = write(fd, &header, sizeof(Header))==ssize_t(sizeof(Header)) &&
+            write(fd, entries.data(), entriesSize)==ssize_t(entriesSize);
+    good = fchmod(fd, 0644)==0 && good;
+    close(fd);
+    if (!good || rename(tmpName.c_str(), getFileName().c_str())!=0)
+        unlink(tmpName.c_str());
+}
+
+static PCINameCache pciNameCache;
+
+static void getFromPCI(int deviceIndex, AdapterInfo& adapterInfo)
+{
+    char fnameBuf[512];
+    snprintf(fnameBuf, 512, "%s/proc/ati/%u/name", sysRoot, deviceIndex);
+    char procNameBuf[256];
+    if (!readSmallFile(fnameBuf, procNameBuf, 256))
+        throw Error(errno, "Can't read device name from /proc/ati");
+    unsigned int domainNum, busNum, devNum, funcNum;
+    int domain;
+    // format: 'DRIVER ID PCI:BUS:DEV:FUNC' or 'DRIVER ID PCI:DOMAIN:BUS:DEV:FUNC'
+    if (sscanf(procNameBuf, "%*s %*s PCI:%u:%u:%u:%u", &domainNum, &busNum, &devNum,
+                &funcNum) == 4)
+        domain = domainNum;
+    else if (sscanf(procNameBuf, "%*s %*s PCI:%u:%u:%u", &busNum, &devNum,
+                &funcNum) == 3)
+        domain = findPCIDomainInSysfs(busNum, devNum, funcNum);
+    else
+        throw Error("Wrong PCI Bus string");
+    
+    unsigned int vendorId, deviceId;
+    if (domain==-1 || !getPCIIdsFromSysfs(domain, busNum, devNum, funcNum,
+                vendorId, deviceId))
+    {
+        // no sysfs, find device in scanned bus (in any domain if domain is unknown)
+        initializePCIAccess(true);
+        pci_dev* dev = pciAccess->devices;
+        for (; dev!=nullptr; dev=dev->next)
+            if ((domain==-1 || dev->domain==domain) && dev->bus==busNum &&
+                dev->dev==devNum && dev->func==funcNum)
+                break;
+        if (dev==nullptr)
+            return;
+        domain = dev->domain;
+        vendorId = dev->vendor_id;
+        deviceId = dev->device_id;
+    }
+    
+    char deviceBuf[128];
+    const PCINameCache::Entry* cacheEntry = pciNameCache.find(domain, busNum, devNum,
+                funcNum, vendorId, deviceId);
+    if (cacheEntry!=nullptr)
+        ::memcpy(deviceBuf, cacheEntry->name, 128);
+    else
+    {
+        initializePCIAccess(false);
+        deviceBuf[0] = 0;
+        pci_lookup_name(pciAccess, deviceBuf, 128, PCI_LOOKUP_DEVICE, vendorId, deviceId);
+        pciNameCache.store(domain, busNum, devNum, funcNum, vendorId, deviceId,
+                    deviceBuf);
+    }
+    adapterInfo.iBusNumber = busNum;
+    adapterInfo.iDeviceNumber = devNum;
+    adapterInfo.iFunctionNumber = funcNum;
+    adapterInfo.iVendorID = vendorId;
+    strcpy(adapterInfo.strAdapterName, deviceBuf);
+}
+
+static void cleanupPCIAccess()
+{
+    pciNameCache.save();
+    if (pciAccess!=nullptr)
+        pci_cleanup(pciAccess);
+    pciAccess = nullptr;
+}
+
+static void getActiveAdaptersIndices(ADLMainControl& mainControl, int adaptersNum,
+                    std::vector<int>& activeAdapters)
+{
+    activeAdapters.clear();
+    for (int i = 0; i < adaptersNum; i++)
+        if (mainControl.isAdapterActive(i))
+            activeAdapters.push_back(i);
+}
+
+/* opened ADL with active adapters and infos of all adapters, used by main mode
+ * and by subcommands */
+struct ADLAdapters
+{
+    ATIADLHandle handle;
+    ADLMainControl mainControl;
+    int adaptersNum;
+    /* list for converting user indices to input indices to ADL interface */
+    std::vector<int> activeAdapters;
+    std::unique_ptr<AdapterInfo[]> adapterInfos;
+    
+    ADLAdapters() : mainControl(handle, 0), adaptersNum(mainControl.getAdaptersNum()),
+            adapterInfos(new AdapterInfo[adaptersNum])
+    {
+        getActiveAdaptersIndices(mainControl, adaptersNum, activeAdapters);
+        ::memset(adapterInfos.get(), 0, sizeof(AdapterInfo)*adaptersNum);
+        mainControl.getAdapterInfo(adapterInfos.get());
+    }
+};
+
+/* snapshot of all queried metrics of single adapter. Collected in one pass
+ * before printing, printing routines only format snapshots */
+struct AdapterSnapshot
+{
+    int userIndex;      // adapter index visible by user
+    int adapterIndex;   // ADL adapter index
+    const AdapterInfo* info;
+    bool verbose;       // whether extra informations has been collected
+    ADLPMActivity activity;
+    int temperature;    // in millidegrees Celsius
+    int fanSpeed;
+    bool powerControlSupported;
+    int powerControl;
+    int powerControlDefault;
+    ADLODParameters odParams;
+    std::vector<ADLODPerformanceLevel> perfLevels;
+    // verbose only
+    ADLFanSpeedInfo fanSpeedInfo;
+    ADLPowerControlInfo powerControlInfo;
+    std::vector<ADLODPerformanceLevel> defaultPerfLevels;
+};
+
+static void collectAdapterSnapshot(const ADLMainControl& mainControl, int adapterIndex,
+            bool verbose, AdapterSnapshot& snapshot)
+{
+    snapshot.adapterIndex = adapterIndex;
+    snapshot.verbose = verbose;
+    mainControl.getCurrentActivity(adapterIndex, snapshot.activity);
+    snapshot.temperature = mainControl.getTemperature(adapterIndex, 0);
+    snapshot.fanSpeed = mainControl.getFanSpeed(adapterIndex, 0);
+    /* PowerControl is not available in older drivers and older devices,
+     * in this case it will not be printed */
+    snapshot.powerControlSupported = mainControl.isPowerControlSupported();
+    if (snapshot.powerControlSupported)
+        try
+        { mainControl.getPowerControl(adapterIndex, snapshot.powerControl,
+                    snapshot.powerControlDefault); }
+        catch(const Error& error)
+        {
+            if (error.getCode()!=ADL_ERR_NOT_SUPPORTED)
+                throw;
+            snapshot.powerControlSupported = false;
+        }
+    mainControl.getODParameters(adapterIndex, snapshot.odParams);
+    const int levelsNum = snapshot.odParams.iNumberOfPerformanceLevels;
+    snapshot.perfLevels.resize(levelsNum);
+    mainControl.getODPerformanceLevels(adapterIndex, false, levelsNum,
+                    snapshot.perfLevels.data());
+    if (!verbose)
+        return;
+    mainControl.getFanSpeedInfo(adapterIndex, 0, snapshot.fanSpeedInfo);
+    if (snapshot.powerControlSupported)
+        mainControl.getPowerControlInfo(adapterIndex, snapshot.powerControlInfo);
+    snapshot.defaultPerfLevels.resize(levelsNum);
+    mainControl.getODPerformanceLevels(adapterIndex, true, levelsNum,
+                    snapshot.defaultPerfLevels.data());
+}
+
+/* pool of workers, each with own ADL2 control. Contexts and threads are created
+ * once and reused by every run, so repeated runs (watch ticks) cost only
+ * job itself. Job k is run by worker k%workersNum. Jobs of workers whose context
+ * can not be created are run serially by main control after parallel jobs */
+class AdapterWorkers
+{
+public:
+    typedef std::function<void(size_t, const ADLMainControl&)> Job;
+private:
+    const ATIADLHandle& handle;
+    const ADLMainControl& mainControl;
+    const size_t workersNum;
+    std::vector<std::unique_ptr<ADLMainControl> > controls; // null if no context
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable startCond;
+    std::condition_variable doneCond;
+    unsigned long generation;
+    size_t doneNum;
+    bool stopping;
+    const Job* job;
+    size_t jobsNum;
+    std::vector<std::exception_ptr>* errors;
+    
+    void work(size_t w);
+public:
+    AdapterWorkers(const ATIADLHandle& handle, const ADLMainControl& mainControl,
+            size_t workersNum);
+    ~AdapterWorkers();
+    
+    /* run job for every index below jobsNum. errors[k] is set if job k failed.
+     * Jobs without own context are not run if any parallel job failed */
+    void run(size_t jobsNum, const Job& job, std::vector<std::exception_ptr>& errors);
+};
+
+AdapterWorkers::AdapterWorkers(const ATIADLHandle& _handle,
+            const ADLMainControl& _mainControl, size_t _workersNum)
+            : handle(_handle), mainControl(_mainControl), workersNum(_workersNum),
+              controls(_workersNum), generation(0), doneNum(0), stopping(false),
+              job(nullptr), jobsNum(0), errors(nullptr)
+{
+    threads.reserve(workersNum);
+    try
+    {
+        for (size_t w = 0; w < workersNum; w++)
+            threads.push_back(std::thread(&AdapterWorkers::work, this, w));
+    }
+    catch(...)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        startCond.notify_all();
+        for (std::thread& thread: threads)
+            thread.join();
+        throw;
+    }
+}
+
+AdapterWorkers::~AdapterWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    startCond.notify_all();
+    for (std::thread& thread: threads)
+        thread.join();
+}
+
+void AdapterWorkers::work(size_t w)
+{
+    try
+    { controls[w].reset(new ADLMainControl(handle, 0, true)); }
+    catch(...)
+    { } // jobs of this worker are run by main control
+    unsigned long doneGeneration = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        startCond.wait(lock, [this, doneGeneration]()
+                { return stopping || generation!=doneGeneration; });
+        if (stopping)
+            break;
+        doneGeneration = generation;
+        lock.unlock();
+        if (controls[w])
+            for (size_t k = w; k < jobsNum; k += workersNum)
+                try
+                { (*job)(k, *controls[w]); }
+                catch(...)
+                { (*errors)[k] = std::current_exception(); }
+        lock.lock();
+        if (++doneNum == workersNum)
+            doneCond.notify_one();
+    }
+    lock.unlock();
+    controls[w].reset();
+}
+
+void AdapterWorkers::run(size_t _jobsNum, const Job& _job,
+            std::vector<std::exception_ptr>& _errors)
+{
+    _errors.assign(_jobsNum, nullptr);
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        job = &_job;
+        jobsNum = _jobsNum;
+        errors = &_errors;
+        doneNum = 0;
+        generation++;
+        startCond.notify_all();
+        doneCond.wait(lock, [this]() { return doneNum==workersNum; });
+    }
+    for (size_t k = 0; k < _jobsNum; k++)
+        if (_errors[k])
+            return;
+    for (size_t k = 0; k < _jobsNum; k++)
+        if (!controls[k%workersNum])
+            try
+            { _job(k, mainControl); }
+            catch(...)
+            { _errors[k] = std::current_exception(); }
+}
+
+/* returns workers for parallel queries or null if they can not be used
+ * (no ADL2 API or less than two adapters) */
+static std::unique_ptr<AdapterWorkers> createAdapterWorkers(const ATIADLHandle& handle,
+            const ADLMainControl& mainControl, size_t adaptersNum)
+{
+    if (adaptersNum < 2 || !handle.isADL2Supported())
+        return std::unique_ptr<AdapterWorkers>();
+    return std::unique_ptr<AdapterWorkers>(new AdapterWorkers(handle, mainControl,
+                adaptersNum));
+}
+
+/* collect snapshots for choosen adapters (or all active adapters), in parallel
+ * if workers are given. adapterInfos will be completed by names from PCI if needed */
+static void collectAdapterSnapshots(const ATIADLHandle& handle,
+            const ADLMainControl& mainControl,
+            AdapterInfo* adapterInfos, const std::vector<int>& activeAdapters,
+            const std::vector<int>& choosenAdapters, bool useChoosen, bool verbose,
+            AdapterWorkers* workers, std::vector<AdapterSnapshot>& snapshots)
+{
+    const size_t snapshotsNum = useChoosen ? choosenAdapters.size() : activeAdapters.size();
+    snapshots.resize(snapshotsNum);
+    for (size_t k = 0; k < snapshotsNum; k++)
+    {
+        const int i = useChoosen ? choosenAdapters[k] : int(k);
+        const int ai = activeAdapters[i];
+        // libpci is not thread-safe, resolve names before collecting
+        if (adapterInfos[ai].strAdapterName[0]==0)
+            getFromPCI(adapterInfos[ai].iAdapterIndex, adapterInfos[ai]);
+        AdapterSnapshot& snapshot = snapshots[k];
+        snapshot.userIndex = i;
+        snapshot.adapterIndex = ai;
+        snapshot.info = adapterInfos + ai;
+    }
+    if (workers!=nullptr && snapshotsNum > 1)
+    {
+        std::vector<std::exception_ptr> errors;
+        workers->run(snapshotsNum, [&snapshots, verbose](size_t k,
+                    const ADLMainControl& control)
+        { collectAdapterSnapshot(control, snapshots[k].adapterIndex, verbose,
+                    snapshots[k]); }, errors);
+        // report first error in adapter order
+        for (const std::exception_ptr& error: errors)
+            if (error)
+                std::rethrow_exception(error);
+    }
+    else
+        for (AdapterSnapshot& snapshot: snapshots)
+            collectAdapterSnapshot(mainControl, snapshot.adapterIndex, verbose, snapshot);
+}
+
+static void printAdaptersInfo(const std::vector<AdapterSnapshot>& snapshots)
+{
+    for (const AdapterSnapshot& snapshot: snapshots)
+    {
+        const ADLPMActivity& activity = snapshot.activity;
+        std::cout << "Adapter " << snapshot.userIndex << ": " <<
+                snapshot.info->strAdapterName << "\n"
+                "  Core: " << activity.iEngineClock/100.0 << " MHz, "
+                "Mem: " << activity.iMemoryClock/100.0 << " MHz, "
+                "Vddc: " << activity.iVddc/1000.0 << " V, "
+                "Load: " << activity.iActivityPercent << "%, "
+                "Temp: " << snapshot.temperature/1000.0 << " C, "
+                "Fan: " << snapshot.fanSpeed << "%, ";
+        if (snapshot.powerControlSupported)
+            std::cout << "PwrCtrl: " << std::showpos << snapshot.powerControl << "%"
+                    << std::noshowpos << std::endl;
+        else
+            std::cout << "PwrCtrl: N/A" << std::endl;
+        const ADLODParameters& odParams = snapshot.odParams;
+        std::cout << "  Max Ranges: Core: " << odParams.sEngineClock.iMin/100.0 << " - " <<
+            odParams.sEngineClock.iMax/100.0 << " MHz, "
+            "Mem: " << odParams.sMemoryClock.iMin/100.0 << " - " <<
+                odParams.sMemoryClock.iMax/100.0 << " MHz, "
+            "Vddc: " << odParams.sVddc.iMin/1000.0 << " - " <<
+                odParams.sVddc.iMax/1000.0 << " V" << std::endl;
+        const std::vector<ADLODPerformanceLevel>& odPLevels = snapshot.perfLevels;
+        const int levelsNum = odPLevels.size();
+        std::cout << "  PerfLevels: Core: " << odPLevels[0].iEngineClock/100.0 << " - " <<
+            odPLevels[levelsNum-1].iEngineClock/100.0 << " MHz, "
+            "Mem: " << odPLevels[0].iMemoryClock/100.0 << " - " <<
+            odPLevels[levelsNum-1].iMemoryClock/100.0 << " MHz, "
+            "Vddc: " << odPLevels[0].iVddc/1000.0 << " - " <<
+            odPLevels[levelsNum-1].iVddc/1000.0 << " V\n";
+    }
+}
+
+static void printAdaptersInfoVerbose(const std::vector<AdapterSnapshot>& snapshots)
+{
+    for (const AdapterSnapshot& snapshot: snapshots)
+    {
+        const AdapterInfo& info = *snapshot.info;
+        std::cout << "Adapter " << snapshot.userIndex << ": " << info.strAdapterName << "\n"
+                "  Device Topology: " << info.iBusNumber << ':' <<
+                info.iDeviceNumber << ":" << info.iFunctionNumber << "\n"
+                "  Vendor ID: " << info.iVendorID << std::endl;
+        const ADLPMActivity& activity = snapshot.activity;
+        std::cout << "  Current CoreClock: " << activity.iEngineClock/100.0 << " MHz\n"
+                "  Current MemoryClock: " << activity.iMemoryClock/100.0 << " MHz\n"
+                "  Current Voltage: " << activity.iVddc/1000.0 << " V\n"
+                "  GPU Load: " << activity.iActivityPercent << "%\n"
+                "  Current PerfLevel: " << activity.iCurrentPerformanceLevel << "\n"
+                "  Current BusSpeed: " << activity.iCurrentBusSpeed << "\n"
+                "  Current BusLanes: " << activity.iCurrentBusLanes<< "\n";
+        
+        std::cout << "  Temperature: " << snapshot.temperature/1000.0 << " C\n";
+        const ADLFanSpeedInfo& fsInfo = snapshot.fanSpeedInfo;
+        std::cout << "  FanSpeed Min: " << fsInfo.iMinPercent << "%\n"
+                "  FanSpeed Max: " << fsInfo.iMaxPercent << "%\n"
+                "  FanSpeed MinRPM: " << fsInfo.iMinRPM << " RPM\n"
+                "  FanSpeed MaxRPM: " << fsInfo.iMaxRPM << " RPM" << "\n";
+        std::cout << "  Current FanSpeed: " << snapshot.fanSpeed << "%\n";
+        if (snapshot.powerControlSupported)
+        {
+            const ADLPowerControlInfo& pwrCtrlInfo = snapshot.powerControlInfo;
+            std::cout << "  PowerControl Min: " << std::showpos <<
+                    pwrCtrlInfo.iMinValue << "%\n"
+                    "  PowerControl Max: " << pwrCtrlInfo.iMaxValue << "%\n"
+                    "  Current PowerControl: " << snapshot.powerControl << "%\n" <<
+                    std::noshowpos;
+        }
+        else
+            std::cout << "  PowerControl: N/A\n";
+        const ADLODParameters& odParams = snapshot.odParams;
+        std::cout << "  CoreClock: " << odParams.sEngineClock.iMin/100.0 << " - " <<
+                odParams.sEngineClock.iMax/100.0 << " MHz, step: " <<
+                odParams.sEngineClock.iStep/100.0 << " MHz\n"
+                "  MemClock: " << odParams.sMemoryClock.iMin/100.0 << " - " <<
+                odParams.sMemoryClock.iMax/100.0 << " MHz, step: " <<
+                odParams.sMemoryClock.iStep/100.0 << " MHz\n"
+                "  Voltage: " << odParams.sVddc.iMin/1000.0 << " - " <<
+                odParams.sVddc.iMax/1000.0 << " V, step: " <<
+                odParams.sVddc.iStep/1000.0 << " V\n";
+        const std::vector<ADLODPerformanceLevel>& odPLevels = snapshot.perfLevels;
+        std::cout << "  Performance levels: " << odParams.iNumberOfPerformanceLevels << "\n";
+        for (int j = 0; j < odParams.iNumberOfPerformanceLevels; j++)
+            std::cout << "    Performance Level: " << j << "\n"
+                "      CoreClock: " << odPLevels[j].iEngineClock/100.0 << " MHz\n"
+                "      MemClock: " << odPLevels[j].iMemoryClock/100.0 << " MHz\n"
+                "      Voltage: " << odPLevels[j].iVddc/1000.0 << " V\n";
+        const std::vector<ADLODPerformanceLevel>& defPLevels = snapshot.defaultPerfLevels;
+        std::cout << "  Default Performance levels: " <<
+                        odParams.iNumberOfPerformanceLevels << "\n";
+        for (int j = 0; j < odParams.iNumberOfPerformanceLevels; j++)
+            std::cout << "    Performance Level: " << j << "\n"
+                "      CoreClock: " << defPLevels[j].iEngineClock/100.0 << " MHz\n"
+                "      MemClock: " << defPLevels[j].iMemoryClock/100.0 << " MHz\n"
+                "      Voltage: " << defPLevels[j].iVddc/1000.0 << " V\n";
+        std::cout.flush();
+    }
+}
+
+/*
+ * Machine-readable output
+ */
+
+enum class OutputFormat
+{
+    TEXT = 0,
+    JSON,
+    CSV,
+    TSV
+};
+
+static OutputFormat parseOutputFormat(const char* string)
+{
+    if (::strcmp(string, "text")==0)
+        return OutputFormat::TEXT;
+    else if (::strcmp(string, "json")==0)
+        return OutputFormat::JSON;
+    else if (::strcmp(string, "csv")==0)
+        return OutputFormat::CSV;
+    else if (::strcmp(string, "tsv")==0)
+        return OutputFormat::TSV;
+    throw Error("Unknown output format");
+}
+
+/* buffer for machine-readable reports. Kept between reports to avoid
+ * allocations, whole report is written by single write call */
+class ReportBuffer
+{
+private:
+    std::string buffer;
+public:
+    void clear()
+    { buffer.clear(); }
+    const std::string& getContent() const
+    { return buffer; }
+    
+    void append(char c)
+    { buffer.push_back(c); }
+    void append(const char* string)
+    { buffer.append(string); }
+    void appendInt(long value);
+    // append value/scale (scale is power of 10) without trailing zeros
+    void appendScaled(long value, long scale);
+    void appendJSONString(const char* string);
+    void appendDSVString(const char* string, char separator);
+    
+    void writeTo(int fd);
+};
+
+void ReportBuffer::appendInt(long value)
+{
+    char buf[24];
+    char* p = buf+24;
+    unsigned long v = (value<0) ? -(unsigned long)value : value;
+    do {
+        *--p = '0' + v%10;
+        v /= 10;
+    } while (v!=0);
+    if (value<0)
+        *--p = '-';
+    buffer.append(p, buf+24-p);
+}
+
+void ReportBuffer::appendScaled(long value, long scale)
+{
+    if (value<0)
+    {
+        buffer.push_back('-');
+        value = -value;
+    }
+    appendInt(value/scale);
+    long frac = value%scale;
+    if (frac==0)
+        return;
+    buffer.push_back('.');
+    for (scale /= 10; frac!=0; scale /= 10)
+    {
+        buffer.push_back('0' + frac/scale);
+        frac %= scale;
+    }
+}
+
+void ReportBuffer::appendJSONString(const char* string)
+{
+    buffer.push_back('"');
+    for (; *string!=0; string++)
+    {
+        const unsigned char c = *string;
+        if (c=='"' || c=='\\')
+        {
+            buffer.push_back('\\');
+            buffer.push_back(c);
+        }
+        else if (c < 0x20)
+        {
+            char buf[8];
+            snprintf(buf, 8, "\\u%04x", c);
+            buffer.append(buf);
+        }
+        else
+            buffer.push_back(c);
+    }
+    buffer.push_back('"');
+}
+
+/* CSV: quote string if needed, TSV: replace tabs and newlines by spaces */
+void ReportBuffer::appendDSVString(const char* string, char separator)
+{
+    if (separator=='\t')
+    {
+        for (; *string!=0; string++)
+            buffer.push_back((*string=='\t' || *string=='\n' || *string=='\r') ?
+                        ' ' : *string);
+        return;
+    }
+    if (::strpbrk(string, ",\"\r\n")==nullptr)
+    {
+        buffer.append(string);
+        return;
+    }
+    buffer.push_back('"');
+    for (; *string!=0; string++)
+    {
+        if (*string=='"')
+            buffer.push_back('"');
+        buffer.push_back(*string);
+    }
+    buffer.push_back('"');
+}
+
+void ReportBuffer::writeTo(int fd)
+{
+    const char* data = buffer.data();
+    size_t remaining = buffer.size();
+    while (remaining!=0)
+    {
+        ssize_t written = ::write(fd, data, remaining);
+        if (written<0)
+        {
+            if (errno==EINTR)
+                continue;
+            throw Error(errno, "Can't write report");
+        }
+        data += written;
+        remaining -= written;
+    }
+}
+
+/* current time as seconds since epoch in milliseconds */
+static long getReportTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec*1000L + ts.tv_nsec/1000000;
+}
+
+static void formatJSONPerfLevels(ReportBuffer& out,
+            const std::vector<ADLODPerformanceLevel>& levels)
+{
+    out.append('[');
+    for (size_t j = 0; j < levels.size(); j++)
+    {
+        if (j!=0)
+            out.append(',');
+        out.append("{\"core_clock\":");
+        out.appendScaled(levels[j].iEngineClock, 100);
+        out.append(",\"memory_clock\":");
+        out.appendScaled(levels[j].iMemoryClock, 100);
+        out.append(",\"vddc\":");
+        out.appendScaled(levels[j].iVddc, 1000);
+        out.append('}');
+    }
+    out.append(']');
+}
+
+/* members "time" and "adapters" of JSON report. Units: clocks in MHz, voltages in V,
+ * temperature in C, time in seconds. Verbose-only fields are skipped for snapshots
+ * collected without verbose */
+static void formatAdaptersJSONFields(ReportBuffer& out, long timeMs,
+            const std::vector<AdapterSnapshot>& snapshots)
+{
+    out.append("\"time\":");
+    out.appendScaled(timeMs, 1000);
+    out.append(",\"adapters\":[");
+    for (size_t k = 0; k < snapshots.size(); k++)
+    {
+        const AdapterSnapshot& snapshot = snapshots[k];
+        const AdapterInfo& info = *snapshot.info;
+        const ADLPMActivity& activity = snapshot.activity;
+        const ADLFanSpeedInfo& fsInfo = snapshot.fanSpeedInfo;
+        const ADLODParameters& odParams = snapshot.odParams;
+        if (k!=0)
+            out.append(',');
+        out.append("{\"index\":");
+        out.appendInt(snapshot.userIndex);
+        out.append(",\"name\":");
+        out.appendJSONString(info.strAdapterName);
+        out.append(",\"bus\":");
+        out.appendInt(info.iBusNumber);
+        out.append(",\"device\":");
+        out.appendInt(info.iDeviceNumber);
+        out.append(",\"function\":");
+        out.appendInt(info.iFunctionNumber);
+        out.append(",\"vendor_id\":");
+        out.appendInt(info.iVendorID);
+        out.append(",\"core_clock\":");
+        out.appendScaled(activity.iEngineClock, 100);
+        out.append(",\"memory_clock\":");
+        out.appendScaled(activity.iMemoryClock, 100);
+        out.append(",\"vddc\":");
+        out.appendScaled(activity.iVddc, 1000);
+        out.append(",\"load\":");
+        out.appendInt(activity.iActivityPercent);
+        out.append(",\"perf_level\":");
+        out.appendInt(activity.iCurrentPerformanceLevel);
+        out.append(",\"bus_speed\":");
+        out.appendInt(activity.iCurrentBusSpeed);
+        out.append(",\"bus_lanes\":");
+        out.appendInt(activity.iCurrentBusLanes);
+        out.append(",\"temperature\":");
+        out.appendScaled(snapshot.temperature, 1000);
+        out.append(",\"fan_speed\":");
+        out.appendInt(snapshot.fanSpeed);
+        if (snapshot.verbose)
+        {
+            out.append(",\"fan_speed_min\":");
+            out.appendInt(fsInfo.iMinPercent);
+            out.append(",\"fan_speed_max\":");
+            out.appendInt(fsInfo.iMaxPercent);
+            out.append(",\"fan_speed_min_rpm\":");
+            out.appendInt(fsInfo.iMinRPM);
+            out.append(",\"fan_speed_max_rpm\":");
+            out.appendInt(fsInfo.iMaxRPM);
+        }
+        if (snapshot.powerControlSupported)
+        {
+            out.append(",\"power_control\":");
+            out.appendInt(snapshot.powerControl);
+            out.append(",\"power_control_default\":");
+            out.appendInt(snapshot.powerControlDefault);
+            if (snapshot.verbose)
+            {
+                out.append(",\"power_control_min\":");
+                out.appendInt(snapshot.powerControlInfo.iMinValue);
+                out.append(",\"power_control_max\":");
+                out.appendInt(snapshot.powerControlInfo.iMaxValue);
+            }
+        }
+        else if (snapshot.verbose)
+            out.append(",\"power_control\":null,\"power_control_default\":null,"
+                    "\"power_control_min\":null,\"power_control_max\":null");
+        else
+            out.append(",\"power_control\":null,\"power_control_default\":null");
+        out.append(",\"core_clock_min\":");
+        out.appendScaled(odParams.sEngineClock.iMin, 100);
+        out.append(",\"core_clock_max\":");
+        out.appendScaled(odParams.sEngineClock.iMax, 100);
+        out.append(",\"core_clock_step\":");
+        out.appendScaled(odParams.sEngineClock.iStep, 100);
+        out.append(",\"memory_clock_min\":");
+        out.appendScaled(odParams.sMemoryClock.iMin, 100);
+        out.append(",\"memory_clock_max\":");
+        out.appendScaled(odParams.sMemoryClock.iMax, 100);
+        out.append(",\"memory_clock_step\":");
+        out.appendScaled(odParams.sMemoryClock.iStep, 100);
+        out.append(",\"vddc_min\":");
+        out.appendScaled(odParams.sVddc.iMin, 1000);
+        out.append(",\"vddc_max\":");
+        out.appendScaled(odParams.sVddc.iMax, 1000);
+        out.append(",\"vddc_step\":");
+        out.appendScaled(odParams.sVddc.iStep, 1000);
+        out.append(",\"perf_levels\":");
+        formatJSONPerfLevels(out, snapshot.perfLevels);
+        if (snapshot.verbose)
+        {
+            out.append(",\"default_perf_levels\":");
+            formatJSONPerfLevels(out, snapshot.defaultPerfLevels);
+        }
+        out.append('}');
+    }
+    out.append(']');
+}
+
+/* one JSON object per report (single line). Snapshots must be collected
+ * with verbose */
+static void formatAdaptersInfoJSON(ReportBuffer& out, long timeMs,
+            const std::vector<AdapterSnapshot>& snapshots)
+{
+    out.append('{');
+    formatAdaptersJSONFields(out, timeMs, snapshots);
+    out.append("}\n");
+}
+
+static const char* dsvColumns[] =
+{
+    "time", "index", "name", "bus", "device", "function", "vendor_id",
+    "core_clock", "memory_clock", "vddc", "load", "perf_level", "bus_speed",
+    "bus_lanes", "temperature", "fan_speed", "fan_speed_min", "fan_speed_max",
+    "fan_speed_min_rpm", "fan_speed_max_rpm", "power_control",
+    "power_control_default", "power_control_min", "power_control_max",
+    "core_clock_min", "core_clock_max", "core_clock_step", "memory_clock_min",
+    "memory_clock_max", "memory_clock_step", "vddc_min", "vddc_max", "vddc_step",
+    "level", "level_core_clock", "level_memory_clock", "level_vddc",
+    "default_level_core_clock", "default_level_memory_clock", "default_level_vddc"
+};
+
+/* CSV or TSV: one row per adapter and performance level, same units as in JSON.
+ * Empty fields if PowerControl is not supported */
+static void formatAdaptersInfoDSV(ReportBuffer& out, char separator, bool header,
+            long timeMs, const std::vector<AdapterSnapshot>& snapshots)
+{
+    if (header)
+    {
+        const size_t columnsNum = sizeof(dsvColumns)/sizeof(const char*);
+        for (size_t i = 0; i < columnsNum; i++)
+        {
+            if (i!=0)
+                out.append(separator);
+            out.append(dsvColumns[i]);
+        }
+        out.append('\n');
+    }
+    for (const AdapterSnapshot& snapshot: snapshots)
+    {
+        const AdapterInfo& info = *snapshot.info;
+        const ADLPMActivity& activity = snapshot.activity;
+        const ADLFanSpeedInfo& fsInfo = snapshot.fanSpeedInfo;
+        const ADLODParameters& odParams = snapshot.odParams;
+        for (size_t j = 0; j < snapshot.perfLevels.size(); j++)
+        {
+            out.appendScaled(timeMs, 1000);
+            out.append(separator);
+            out.appendInt(snapshot.userIndex);
+            out.append(separator);
+            out.appendDSVString(info.strAdapterName, separator);
+            out.append(separator);
+            out.appendInt(info.iBusNumber);
+            out.append(separator);
+            out.appendInt(info.iDeviceNumber);
+            out.append(separator);
+            out.appendInt(info.iFunctionNumber);
+            out.append(separator);
+            out.appendInt(info.iVendorID);
+            out.append(separator);
+            out.appendScaled(activity.iEngineClock, 100);
+            out.append(separator);
+            out.appendScaled(activity.iMemoryClock, 100);
+            out.append(separator);
+            out.appendScaled(activity.iVddc, 1000);
+            out.append(separator);
+            out.appendInt(activity.iActivityPercent);
+            out.append(separator);
+            out.appendInt(activity.iCurrentPerformanceLevel);
+            out.append(separator);
+            out.appendInt(activity.iCurrentBusSpeed);
+            out.append(separator);
+            out.appendInt(activity.iCurrentBusLanes);
+            out.append(separator);
+            out.appendScaled(snapshot.temperature, 1000);
+            out.append(separator);
+            out.appendInt(snapshot.fanSpeed);
+            out.append(separator);
+            out.appendInt(fsInfo.iMinPercent);
+            out.append(separator);
+            out.appendInt(fsInfo.iMaxPercent);
+            out.append(separator);
+            out.appendInt(fsInfo.iMinRPM);
+            out.append(separator);
+            out.appendInt(fsInfo.iMaxRPM);
+            out.append(separator);
+            if (snapshot.powerControlSupported)
+            {
+                out.appendInt(snapshot.powerControl);
+                out.append(separator);
+                out.appendInt(snapshot.powerControlDefault);
+                out.append(separator);
+                out.appendInt(snapshot.powerControlInfo.iMinValue);
+                out.append(separator);
+                out.appendInt(snapshot.powerControlInfo.iMaxValue);
+            }
+            else
+            {
+                out.append(separator);
+                out.append(separator);
+                out.append(separator);
+            }
+            out.append(separator);
+            out.appendScaled(odParams.sEngineClock.iMin, 100);
+            out.append(separator);
+            out.appendScaled(odParams.sEngineClock.iMax, 100);
+            out.append(separator);
+            out.appendScaled(odParams.sEngineClock.iStep, 100);
+            out.append(separator);
+            out.appendScaled(odParams.sMemoryClock.iMin, 100);
+            out.append(separator);
+            out.appendScaled(odParams.sMemoryClock.iMax, 100);
+            out.append(separator);
+            out.appendScaled(odParams.sMemoryClock.iStep, 100);
+            out.append(separator);
+            out.appendScaled(odParams.sVddc.iMin, 1000);
+            out.append(separator);
+            out.appendScaled(odParams.sVddc.iMax, 1000);
+            out.append(separator);
+            out.appendScaled(odParams.sVddc.iStep, 1000);
+            out.append(separator);
+            out.appendInt(j);
+            const ADLODPerformanceLevel& level = snapshot.perfLevels[j];
+            out.append(separator);
+            out.appendScaled(level.iEngineClock, 100);
+            out.append(separator);
+            out.appendScaled(level.iMemoryClock, 100);
+            out.append(separator);
+            out.appendScaled(level.iVddc, 1000);
+            const ADLODPerformanceLevel& defLevel = snapshot.defaultPerfLevels[j];
+            out.append(separator);
+            out.appendScaled(defLevel.iEngineClock, 100);
+            out.append(separator);
+            out.appendScaled(defLevel.iMemoryClock, 100);
+            out.append(separator);
+            out.appendScaled(defLevel.iVddc, 1000);
+            out.append('\n');
+        }
     }
 }
 
 static void parseAdaptersList(const char* string, std::vector<int>& adapters,
                               bool& allAdapters)
 {
-    adapters.clear();
-    allAdapters = false;
-    if (::strcmp(string, "all")==0)
+    adapters.clear();
+    allAdapters = false;
+    if (::strcmp(string, "all")==0)
+    {
+        allAdapters = true;
+        return;
+    }
+    while (true)
+    {
+        char* endptr;
+        errno = 0;
+        int adapterIndex = strtol(string, &endptr, 10);
+        if (errno!=0 || endptr==string)
+            throw Error("Can't parse adapter index");
+        
+        string = endptr;
+        if (*string == '-')
+        {   // if range
+            string++;
+            errno = 0;
+            int adapterIndexEnd = strtol(string, &endptr, 10);
+            if (errno!=0 || endptr==string)
+                throw Error("Can't parse adapter index");
+            string = endptr;
+            if (adapterIndex>adapterIndexEnd)
+                throw Error("Wrong range of adapter indices in adapter list");
+            for (int i = adapterIndex; i <= adapterIndexEnd; i++)
+                adapters.push_back(i);
+        }
+        else
+            adapters.push_back(adapterIndex);
+        if (*string==0)
+            break;
+        if (*string==',')
+            string++;
+        else
+            throw Error("Garbages at adapter list");
+    }
+    std::sort(adapters.begin(), adapters.end());
+    adapters.resize(std::unique(adapters.begin(), adapters.end()) - adapters.begin());
+}
+
+/* adapter list given by '-a' or '--adapters' option */
+struct AdaptersOption
+{
+    std::vector<int> choosenAdapters;
+    bool useAdaptersList;
+    bool chooseAllAdapters;
+    
+    AdaptersOption() : useAdaptersList(false), chooseAllAdapters(false)
+    { }
+    
+    /* parses option at argv[i] ('-aLIST', '-a LIST', '--adapters=LIST' or
+     * '--adapters LIST'). Returns false if it is not adapters option */
+    bool parse(int argc, const char** argv, int& i)
+    {
+        const char* list;
+        if (::strncmp(argv[i], "--adapters=", 11)==0)
+            list = argv[i]+11;
+        else if (::strcmp(argv[i], "--adapters")==0 || ::strcmp(argv[i], "-a")==0)
+        {
+            if (i+1 >= argc)
+                throw Error("Adapter list not supplied");
+            list = argv[++i];
+        }
+        else if (::strncmp(argv[i], "-a", 2)==0)
+            list = argv[i]+2;
+        else
+            return false;
+        parseAdaptersList(list, choosenAdapters, chooseAllAdapters);
+        useAdaptersList = true;
+        return true;
+    }
+    
+    // true if only choosen adapters are used
+    bool useChoosen() const
+    { return useAdaptersList && !chooseAllAdapters; }
+    
+    bool isChoosen(int index) const
+    {
+        return !useChoosen() || std::binary_search(choosenAdapters.begin(),
+                    choosenAdapters.end(), index);
+    }
+    
+    void checkRange(int activeAdaptersNum) const
+    {
+        if (useChoosen())
+            for (int adapterIndex: choosenAdapters)
+                if (adapterIndex>=activeAdaptersNum || adapterIndex<0)
+                    throw Error("Some adapter indices out of range");
+    }
+};
+
+enum class OVCParamType
+{
+    CORE_CLOCK,
+    MEMORY_CLOCK,
+    VDDC_VOLTAGE,
+    FAN_SPEED,
+    POWER_CONTROL
+};
+
+enum: int {
+    LAST_PERFLEVEL = -1
+};
+
+struct OVCParameter
+{
+    OVCParamType type;
+    std::vector<int> adapters;
+    bool allAdapters;
+    int partId;
+    double value;
+    bool useDefault;
+    std::string argText;
+};
+
+static bool parseOVCParameter(const char* string, OVCParameter& param)
+{
+    const char* afterName = strchr(string, ':');
+    if (afterName==nullptr)
+    {
+        afterName = strchr(string, '=');
+        if (afterName==nullptr)
+        {
+            std::cerr << "This is not parameter: '" << string << "'!" << std::endl;
+            return false;
+        }
+    }
+    std::string name(string, afterName);
+    param.argText = string;
+    param.adapters.clear();
+    param.adapters.push_back(0); // default is 0
+    param.allAdapters = false;
+    param.partId = 0;
+    param.useDefault = false;
+    bool partIdSet = false;
+    if (name=="coreclk")
+    {
+        param.type = OVCParamType::CORE_CLOCK;
+        param.partId = LAST_PERFLEVEL;
+    }
+    else if (name=="memclk")
+    {
+        param.type = OVCParamType::MEMORY_CLOCK;
+        param.partId = LAST_PERFLEVEL;
+    }
+    else if (name=="vcore")
+    {
+        param.type = OVCParamType::VDDC_VOLTAGE;
+        param.partId = LAST_PERFLEVEL;
+    }
+    else if (name=="fanspeed")
+    {
+        param.type = OVCParamType::FAN_SPEED;
+        partIdSet = false;
+    }
+    else if (name=="powercontrol" || name=="pwrctrl")
+    {
+        param.type = OVCParamType::POWER_CONTROL;
+        partIdSet = false;
+    }
+    else if (name=="icoreclk")
+    {
+        param.type = OVCParamType::CORE_CLOCK;
+        partIdSet = true;
+    }
+    else if (name=="imemclk")
+    {
+        param.type = OVCParamType::MEMORY_CLOCK;
+        partIdSet = true;
+    }
+    else if (name=="ivcore")
+    {
+        param.type = OVCParamType::VDDC_VOLTAGE;
+        partIdSet = true;
+    }
+    else
+    {
+        std::cout << "Wrong parameter name in '" << string << "'!" << std::endl;
+        return false;
+    }
+    
+    char* next;
+    if (*afterName==':')
+    {   // if is
+        afterName++;
+        try
+        {
+            const char* afterList = ::strchr(afterName, ':');
+            if (afterList==nullptr)
+                afterList = ::strchr(afterName, '=');
+            if (afterList==nullptr)
+                afterList += strlen(afterName); // to end
+            if (afterList!=afterName)
+            {
+                std::string listString(afterName, afterList);
+                parseAdaptersList(listString.c_str(), param.adapters, param.allAdapters);
+                afterName = afterList;
+            }
+        }
+        catch(const Error& error)
+        {
+            std::cerr << "Can't parse adapter list for '" << string << "': " <<
+                        error.what() << std::endl;
+            return false;
+        }
+    }
+    else if (*afterName==0)
+    {
+        std::cerr << "Unterminated parameter '" << string << "'!" << std::endl;
+        return false;
+    }
+    
+    if (*afterName==':' && !partIdSet)
+    {
+        afterName++;
+        errno = 0;
+        int value = strtol(afterName, &next, 10);
+        if (errno!=0)
+        {
+            std::cerr << "Can't parse partId in '" << string << "'!" << std::endl;
+            return false;
+        }
+        if (afterName != next)
+            param.partId = value;
+        afterName = next;
+    }
+    else if (*afterName==0)
+    {
+        std::cerr << "Unterminated parameter '" << string << "'!" << std::endl;
+        return false;
+    }
+    
+    if (*afterName=='=')
+    {
+        afterName++;
+        errno = 0;
+        if (::strcmp(afterName, "default")==0)
+        {
+            param.useDefault = true;
+            afterName += 7;
+        }
+        else
+        {
+            param.value = strtod(afterName, &next);
+            if (errno!=0 || afterName==next)
+            {
+                std::cerr << "Can't parse value in '" << string << "'!" << std::endl;
+                return false;
+            }
+            afterName = next;
+        }
+        if (*afterName!=0)
+        {
+            std::cerr << "Garbages in '" << string << "'!" << std::endl;
+            return false;
+        }
+    }
+    else
+    {
+        std::cerr << "Unterminated parameter '" << string << "'!" << std::endl;
+        return false;
+    }
+    /*std::cout << "param: " << int(param.type) << ", dev: " << param.adapterIndex <<
+            ", pid: " << param.partId << ", value=" << param.value << std::endl;*/
+    return true;
+}
+
+/* read parameters from file (or standard input if filename is '-'). Parameters are
+ * separated by whitespaces, comments start with '#'. Returns false if any
+ * parameter can not be parsed */
+static bool readOVCParameters(const char* filename, std::vector<OVCParameter>& params)
+{
+    std::ifstream ifs;
+    if (::strcmp(filename, "-")!=0)
+    {
+        ifs.open(filename);
+        if (!ifs)
+            throw Error(errno, "Can't open parameters file");
+    }
+    std::istream& is = ifs.is_open() ? static_cast<std::istream&>(ifs) : std::cin;
+    bool failed = false;
+    std::string line;
+    OVCParameter param;
+    while (std::getline(is, line))
+    {
+        const size_t commentPos = line.find('#');
+        if (commentPos!=std::string::npos)
+            line.resize(commentPos);
+        size_t pos = 0;
+        while (true)
+        {
+            pos = line.find_first_not_of(" \t\r", pos);
+            if (pos==std::string::npos)
+                break;
+            size_t end = line.find_first_of(" \t\r", pos);
+            if (end==std::string::npos)
+                end = line.size();
+            const std::string token = line.substr(pos, end-pos);
+            if (parseOVCParameter(token.c_str(), param))
+                params.push_back(param);
+            else
+                failed = true;
+            pos = end;
+        }
+    }
+    if (is.bad())
+        throw Error("Can't read parameters file");
+    return !failed;
+}
+
+/* pending edit of single setting. Later parameters override earlier edits */
+struct OVCEdit
+{
+    bool isSet;
+    bool useDefault;
+    double value;
+    const OVCParameter* param;  // parameter which sets this edit
+};
+
+// fields of performance level in edits of level
+enum: int {
+    OVC_LEVEL_CORE_CLOCK = 0,
+    OVC_LEVEL_MEMORY_CLOCK,
+    OVC_LEVEL_VDDC,
+    OVC_LEVEL_FIELDS_NUM
+};
+
+/* parameters compiled for adapter: fan speed, PowerControl and dense array of
+ * edits of performance levels (OVC_LEVEL_FIELDS_NUM edits per level) */
+struct OVCAdapterPlan
+{
+    OVCEdit fanSpeed;
+    OVCEdit powerControl;
+    bool levelsUsed;
+    std::vector<OVCEdit> levelEdits;
+};
+
+struct AdapterIterator
+{
+    const std::vector<int>& adapters;
+    bool allAdapters;
+    int allAdaptersNum;
+    int position;
+    
+    AdapterIterator(const std::vector<int>& _adapters, bool _allAdapters,
+            int _allAdaptersNum) : adapters(_adapters), allAdapters(_allAdapters),
+            allAdaptersNum(_allAdaptersNum), position(0)
+    { }
+    
+    AdapterIterator& operator++()
+    {
+        position++;
+        return *this;
+    }
+    
+    operator bool() const
+    {
+        return (!allAdapters && position < int(adapters.size())) ||
+                (allAdapters && position < allAdaptersNum);
+    }
+    bool operator!() const
+    {
+        return !((!allAdapters && position < int(adapters.size())) ||
+                (allAdapters && position < allAdaptersNum));
+    }
+    int operator*() const
+    { return allAdapters ? position : adapters[position]; }
+};
+
+/* settings of single adapter to set. Also used as snapshot of current settings
+ * to restore adapter if any setting fails */
+struct AdapterSetup
+{
+    int userIndex;
+    int adapterIndex;
+    bool fanSpeedSet;
+    bool fanSpeedDefault;
+    int fanSpeed;
+    bool powerControlSet;
+    int powerControl;
+    bool perfLevelsSet;
+    std::vector<ADLODPerformanceLevel> perfLevels;
+};
+
+static void setAdapterSetup(const ADLMainControl& mainControl, const AdapterSetup& setup)
+{
+    if (setup.fanSpeedSet)
+    {
+        if (!setup.fanSpeedDefault)
+            mainControl.setFanSpeed(setup.adapterIndex, 0 /* must be zero */,
+                        setup.fanSpeed);
+        else
+            mainControl.setFanSpeedToDefault(setup.adapterIndex, 0);
+    }
+    if (setup.powerControlSet)
+        mainControl.setPowerControl(setup.adapterIndex, setup.powerControl);
+    if (setup.perfLevelsSet)
+        mainControl.setODPerformanceLevels(setup.adapterIndex, setup.perfLevels.size(),
+                    setup.perfLevels.data());
+}
+
+/* set setups of adapters. If ADL2 set functions are available (also for PowerControl
+ * if it is set), then adapters are set in parallel by adapter workers, otherwise
+ * serially. If any setting fails, then every adapter is restored from its snapshot
+ * and first error (in adapter order) is thrown */
+static void setAdapterSetups(const ATIADLHandle& handle, const ADLMainControl& mainControl,
+            const std::vector<AdapterSetup>& setups,
+            const std::vector<AdapterSetup>& snapshots)
+{
+    const size_t setupsNum = setups.size();
+    std::vector<std::exception_ptr> errors(setupsNum);
+    bool powerControlSet = false;
+    for (const AdapterSetup& setup: setups)
+        powerControlSet |= setup.powerControlSet;
+    std::unique_ptr<AdapterWorkers> workers;
+    // ADL1 set functions can not be called concurrently
+    if (handle.hasCapability(ADLCAP_ADL2_SET) &&
+        (!powerControlSet || handle.hasCapability(ADLCAP_ADL2_POWER_CONTROL)))
+        workers = createAdapterWorkers(handle, mainControl, setupsNum);
+    if (workers)
+        workers->run(setupsNum, [&setups](size_t k, const ADLMainControl& control)
+        { setAdapterSetup(control, setups[k]); }, errors);
+    else
+        for (size_t k = 0; k < setupsNum; k++)
+        {
+            try
+            { setAdapterSetup(mainControl, setups[k]); }
+            catch(...)
+            {
+                errors[k] = std::current_exception();
+                break;
+            }
+        }
+    
+    size_t failedIndex = 0;
+    while (failedIndex < setupsNum && !errors[failedIndex])
+        failedIndex++;
+    if (failedIndex == setupsNum)
+        return;
+    // roll back: every adapter (also partially set) is restored
+    std::cerr << "Setting failed for adapter " << setups[failedIndex].userIndex <<
+            ", restoring previous settings" << std::endl;
+    for (const AdapterSetup& snapshot: snapshots)
+    {
+        try
+        { setAdapterSetup(mainControl, snapshot); }
+        catch(const Error& error)
+        {
+            std::cerr << "Can't restore settings of adapter " << snapshot.userIndex <<
+                    ": " << error.what() << std::endl;
+        }
+    }
+    std::rethrow_exception(errors[failedIndex]);
+}
+
+static void setOVCParameters(const ATIADLHandle& handle,
+            const ADLMainControl& mainControl, int adaptersNum,
+            const std::vector<int>& activeAdapters,
+            const std::vector<OVCParameter>& ovcParams, bool printWarning = true)
+{
+    if (printWarning)
+    {
+        std::cout << "WARNING: setting AMD Overdrive parameters!" << std::endl;
+        std::cout <<
+            "\nIMPORTANT NOTICE: Before any setting of AMD Overdrive parameters,\n"
+            "please STOP ANY GPU computations and GPU renderings.\n"
+            "Please use this utility CAREFULLY, because it can DAMAGE your hardware!\n" 
+            << std::endl;
+    }
+    
+    const int realAdaptersNum = activeAdapters.size();
+    const OVCEdit emptyEdit = { false, false, 0.0, nullptr };
+    std::vector<OVCAdapterPlan> plans(realAdaptersNum,
+                OVCAdapterPlan{ emptyEdit, emptyEdit, false, { } });
+    
+    // check parameters and mark adapters with changed performance levels
+    bool failed = false;
+    for (const OVCParameter& param: ovcParams)
+    {
+        if (!param.allAdapters)
+        {
+            bool listFailed = false;
+            for (int adapterIndex: param.adapters)
+                if (!listFailed && (adapterIndex>=realAdaptersNum || adapterIndex<0))
+                {
+                    std::cerr << "Some adapter indices out of range in '" <<
+                                    param.argText << "'!" << std::endl;
+                    listFailed = failed = true;
+                }
+        }
+        if (param.type==OVCParamType::FAN_SPEED)
+        {
+            if(param.partId!=0)
+            {
+                std::cerr << "Thermal Control Index is not 0 in '" <<
+                        param.argText << "'!" << std::endl;
+                failed = true;
+            }
+            if(!param.useDefault && (param.value<0.0 || param.value>100.0))
+            {
+                std::cerr << "FanSpeed value out of range in '" <<
+                        param.argText << "'!" << std::endl;
+                failed = true;
+            }
+        }
+        else if (param.type==OVCParamType::POWER_CONTROL)
+        {
+            if (!mainControl.isPowerControlSupported())
+            {
+                std::cerr << "PowerControl is not supported in '" <<
+                        param.argText << "'!" << std::endl;
+                failed = true;
+            }
+            if(param.partId!=0)
+            {
+                std::cerr << "Thermal Control Index is not 0 in '" <<
+                        param.argText << "'!" << std::endl;
+                failed = true;
+            }
+            // restrict to +20%
+            if(!param.useDefault && (param.value<-50.0 || param.value>20.0))
+            {
+                std::cerr << "PowerControl value out of range in '" <<
+                        param.argText << "'!" << std::endl;
+                failed = true;
+            }
+        }
+        else
+            for (AdapterIterator ait(param.adapters, param.allAdapters, realAdaptersNum);
+                        ait; ++ait)
+                if (*ait < realAdaptersNum && *ait >= 0)
+                    plans[*ait].levelsUsed = true;
+    }
+    if (failed)
+    {
+        std::cerr << "NO ANY settings applied. Error in parameters!" << std::endl;
+        throw Error("Wrong parameters!");
+    }
+    
+    // read performance levels of adapters with changed levels
+    std::vector<ADLODParameters> odParams(realAdaptersNum);
+    std::vector<std::vector<ADLODPerformanceLevel> > perfLevels(realAdaptersNum);
+    std::vector<std::vector<ADLODPerformanceLevel> > defaultPerfLevels(realAdaptersNum);
+    for (int i = 0; i < realAdaptersNum; i++)
+        if (plans[i].levelsUsed)
+        {
+            const int ai = activeAdapters[i];
+            mainControl.getODParameters(ai, odParams[i]);
+            const int levelsNum = odParams[i].iNumberOfPerformanceLevels;
+            perfLevels[i].resize(levelsNum);
+            defaultPerfLevels[i].resize(levelsNum);
+            mainControl.getODPerformanceLevels(ai, 0, levelsNum, perfLevels[i].data());
+            mainControl.getODPerformanceLevels(ai, 1, levelsNum,
+                        defaultPerfLevels[i].data());
+            plans[i].levelEdits.assign(levelsNum*OVC_LEVEL_FIELDS_NUM, emptyEdit);
+        }
+    
+    // compile parameters to plans of adapters (last parameter wins)
+    for (const OVCParameter& param: ovcParams)
+    {
+        bool levelFailed = false;
+        for (AdapterIterator ait(param.adapters, param.allAdapters, realAdaptersNum);
+                    ait; ++ait)
+        {
+            OVCAdapterPlan& plan = plans[*ait];
+            const OVCEdit edit = { true, param.useDefault, param.value, &param };
+            if (param.type==OVCParamType::FAN_SPEED)
+            {
+                plan.fanSpeed = edit;
+                continue;
+            }
+            if (param.type==OVCParamType::POWER_CONTROL)
+            {
+                plan.powerControl = edit;
+                continue;
+            }
+            const int levelsNum = odParams[*ait].iNumberOfPerformanceLevels;
+            const int partId = (param.partId!=LAST_PERFLEVEL) ? param.partId : levelsNum-1;
+            if (partId >= levelsNum || partId < 0)
+            {
+                if (!levelFailed)
+                    std::cerr << "Performance level out of range in '" <<
+                            param.argText << "'!" << std::endl;
+                levelFailed = failed = true;
+                continue;
+            }
+            const int field = (param.type==OVCParamType::CORE_CLOCK) ?
+                    OVC_LEVEL_CORE_CLOCK : (param.type==OVCParamType::MEMORY_CLOCK) ?
+                    OVC_LEVEL_MEMORY_CLOCK : OVC_LEVEL_VDDC;
+            plan.levelEdits[partId*OVC_LEVEL_FIELDS_NUM + field] = edit;
+        }
+    }
+    
+    // check ranges of edits
+    static const char* rangeMessages[OVC_LEVEL_FIELDS_NUM] =
+    { "Core clock out of range in '", "Memory clock out of range in '",
+      "Voltage out of range in '" };
+    for (int i = 0; i < realAdaptersNum; i++)
+    {
+        const ADLODParameterRange ranges[OVC_LEVEL_FIELDS_NUM] =
+        { odParams[i].sEngineClock, odParams[i].sMemoryClock, odParams[i].sVddc };
+        const double scales[OVC_LEVEL_FIELDS_NUM] = { 100.0, 100.0, 1000.0 };
+        const std::vector<OVCEdit>& edits = plans[i].levelEdits;
+        for (size_t e = 0; e < edits.size(); e++)
+        {
+            const int field = e % OVC_LEVEL_FIELDS_NUM;
+            const OVCEdit& edit = edits[e];
+            if (edit.isSet && !edit.useDefault &&
+                (edit.value < ranges[field].iMin/scales[field] ||
+                 edit.value > ranges[field].iMax/scales[field]))
+            {
+                std::cerr << rangeMessages[field] << edit.param->argText << "'!" <<
+                        std::endl;
+                failed = true;
+            }
+        }
+    }
+    if (failed)
+    {
+        std::cerr << "NO ANY settings applied. Error in parameters!" << std::endl;
+        throw Error("Wrong parameters!");
+    }
+    
+    // print what has been changed
+    for (int i = 0; i < realAdaptersNum; i++)
+        if (plans[i].fanSpeed.isSet)
+        {
+            std::cout << "Setting fanspeed to ";
+            if (plans[i].fanSpeed.useDefault)
+                std::cout << "default";
+            else
+                std::cout << plans[i].fanSpeed.value << "%";
+            std::cout << " for adapter " << i << " at thermal controller 0" << std::endl;
+        }
+    for (int i = 0; i < realAdaptersNum; i++)
+        if (plans[i].powerControl.isSet)
+        {
+            std::cout << "Setting powercontrol to ";
+            if (plans[i].powerControl.useDefault)
+                std::cout << "default";
+            else
+                std::cout << std::showpos << plans[i].powerControl.value << "%" <<
+                        std::noshowpos;
+            std::cout << " for adapter " << i << " at thermal controller 0" << std::endl;
+        }
+    static const char* setMessages[OVC_LEVEL_FIELDS_NUM] =
+    { "Setting core clock to ", "Setting memory clock to ", "Setting Vddc voltage to " };
+    static const char* units[OVC_LEVEL_FIELDS_NUM] = { " MHz", " MHz", " V" };
+    for (int i = 0; i < realAdaptersNum; i++)
+    {
+        const std::vector<OVCEdit>& edits = plans[i].levelEdits;
+        for (size_t e = 0; e < edits.size(); e++)
+            if (edits[e].isSet)
+            {
+                const int field = e % OVC_LEVEL_FIELDS_NUM;
+                std::cout << setMessages[field];
+                if (edits[e].useDefault)
+                    std::cout << "default";
+                else
+                    std::cout << edits[e].value << units[field];
+                std::cout << " for adapter " << i << " at performance level " <<
+                        e/OVC_LEVEL_FIELDS_NUM << std::endl;
+            }
+    }
+    
+    // make setups and snapshots of current settings of changed adapters
+    std::vector<AdapterSetup> setups;
+    std::vector<AdapterSetup> snapshots;
+    for (int i = 0; i < realAdaptersNum; i++)
+    {
+        const OVCAdapterPlan& plan = plans[i];
+        const int ai = activeAdapters[i];
+        AdapterSetup setup;
+        setup.userIndex = i;
+        setup.adapterIndex = ai;
+        setup.fanSpeedSet = plan.fanSpeed.isSet;
+        setup.powerControlSet = plan.powerControl.isSet;
+        setup.perfLevelsSet = false;
+        setup.fanSpeedDefault = false;
+        setup.fanSpeed = setup.powerControl = 0;
+        AdapterSetup snapshot = setup;
+        if (plan.levelsUsed)
+        {
+            std::vector<ADLODPerformanceLevel> levels(perfLevels[i]);
+            const std::vector<OVCEdit>& edits = plan.levelEdits;
+            for (size_t e = 0; e < edits.size(); e++)
+            {
+                const OVCEdit& edit = edits[e];
+                if (!edit.isSet)
+                    continue;
+                const size_t j = e/OVC_LEVEL_FIELDS_NUM;
+                ADLODPerformanceLevel& level = levels[j];
+                const ADLODPerformanceLevel& defaultLevel = defaultPerfLevels[i][j];
+                switch(e % OVC_LEVEL_FIELDS_NUM)
+                {
+                    case OVC_LEVEL_CORE_CLOCK:
+                        level.iEngineClock = edit.useDefault ? defaultLevel.iEngineClock :
+                                int(round(edit.value*100.0));
+                        break;
+                    case OVC_LEVEL_MEMORY_CLOCK:
+                        level.iMemoryClock = edit.useDefault ? defaultLevel.iMemoryClock :
+                                int(round(edit.value*100.0));
+                        break;
+                    default:
+                        if (edit.useDefault)
+                            level.iVddc = defaultLevel.iVddc;
+                        else if (level.iVddc==0)
+                            std::cout << "Voltage for adapter " << i <<
+                                        " is not set!" << std::endl;
+                        else
+                            level.iVddc = int(round(edit.value*1000.0));
+                        break;
+                }
+                setup.perfLevelsSet = snapshot.perfLevelsSet = true;
+            }
+            if (setup.perfLevelsSet)
+            {
+                setup.perfLevels.swap(levels);
+                snapshot.perfLevels = perfLevels[i];
+            }
+        }
+        if (!setup.fanSpeedSet && !setup.powerControlSet && !setup.perfLevelsSet)
+            continue;
+        if (setup.fanSpeedSet)
+        {
+            bool userDefined;
+            snapshot.fanSpeed = mainControl.getFanSpeed(ai, 0, &userDefined);
+            snapshot.fanSpeedDefault = !userDefined;
+            setup.fanSpeedDefault = plan.fanSpeed.useDefault;
+            setup.fanSpeed = int(round(plan.fanSpeed.value));
+        }
+        if (setup.powerControlSet)
+        {
+            int pwrCtrlDef;
+            mainControl.getPowerControl(ai, snapshot.powerControl, pwrCtrlDef);
+            setup.powerControl = plan.powerControl.useDefault ? pwrCtrlDef :
+                    int(round(plan.powerControl.value));
+        }
+        setups.push_back(setup);
+        snapshots.push_back(snapshot);
+    }
+    setAdapterSetups(handle, mainControl, setups, snapshots);
+}
+
+static_assert(ATOMIC_BOOL_LOCK_FREE==2, "Stop flag must be usable in signal handler");
+
+/* stop is requested by signal or by failed thread. After request stopEventFd
+ * stays readable, so every thread waiting for it wakes up, also if request
+ * came just before its wait */
+static std::atomic<bool> stopRequested(false);
+static int stopEventFd = -1;
+
+static void requestStop()
+{
+    stopRequested = true;
+    if (stopEventFd!=-1)
+    {
+        const uint64_t value = 1;
+        if (write(stopEventFd, &value, sizeof(value)) < 0)
+            { } // eventfd counter can not overflow here
+    }
+}
+
+static void stopSignalHandler(int)
+{
+    requestStop();
+}
+
+static void installStopHandlers()
+{
+    if (stopEventFd==-1)
+    {
+        stopEventFd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+        if (stopEventFd==-1)
+            throw Error(errno, "Can't create eventfd");
+    }
+    struct sigaction sa;
+    ::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stopSignalHandler;
+    sigemptyset(&sa.sa_mask);
+    // no SA_RESTART: blocking calls (reading, waiting for child) end on stop
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    // lost terminal (dropped ssh session) must also restore settings
+    sigaction(SIGHUP, &sa, nullptr);
+    sigaction(SIGQUIT, &sa, nullptr);
+}
+
+/* periodic timer with absolute deadlines - sampling time does not accumulate
+ * drift between ticks. If tick is overrun, then missed ticks are skipped */
+class PeriodicTimer
+{
+private:
+    long long intervalNs;
+    timespec next;
+public:
+    explicit PeriodicTimer(double interval);
+
+    // returns false if stop has been requested
+    bool wait();
+};
+
+PeriodicTimer::PeriodicTimer(double interval)
+        : intervalNs((long long)(interval*1e9))
+{
+    if (intervalNs <= 0)
+        throw Error("Wrong timer interval");
+    clock_gettime(CLOCK_MONOTONIC, &next);
+}
+
+static inline long long timespecToNs(const timespec& ts)
+{
+    return (long long)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+bool PeriodicTimer::wait()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long nextNs = timespecToNs(next) + intervalNs;
+    const long long nowNs = timespecToNs(now);
+    if (nextNs <= nowNs) // overrun, skip missed ticks
+        nextNs += ((nowNs-nextNs)/intervalNs + 1)*intervalNs;
+    next.tv_sec = nextNs/1000000000LL;
+    next.tv_nsec = nextNs%1000000000LL;
+    // wait for deadline or stop event
+    pollfd stopPollFd = { stopEventFd, POLLIN, 0 };
+    while (!stopRequested)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        const long long remainingNs = nextNs - timespecToNs(now);
+        if (remainingNs <= 0)
+            break;
+        const timespec timeout = { time_t(remainingNs/1000000000LL),
+                    long(remainingNs%1000000000LL) };
+        if (ppoll(&stopPollFd, 1, &timeout, nullptr)<0 && errno!=EINTR)
+            throw Error(errno, "ppoll error");
+    }
+    return !stopRequested;
+}
+
+static double parseInterval(const char* string)
+{
+    char* endptr;
+    errno = 0;
+    double interval = strtod(string, &endptr);
+    if (errno!=0 || endptr==string || *endptr!=0)
+        throw Error("Can't parse interval");
+    if (interval < 0.001 || interval > 86400.0)
+        throw Error("Interval out of range");
+    return interval;
+}
+
+/*
+ * Shared-memory telemetry
+ */
+
+/* publishes samples to shared memory (layout in amdcovc_shm.h). Slot k holds
+ * k-th snapshot, snapshots must be collected for same adapters every time */
+class ShmPublisher
+{
+private:
+    std::string name;
+    AMDCOVCShmHeader* header;
+    AMDCOVCShmSlot* slots;
+    size_t size;
+    bool described;
+public:
+    ShmPublisher(const char* name, size_t adaptersNum, double interval);
+    ~ShmPublisher();
+    
+    void publish(const std::vector<AdapterSnapshot>& snapshots, long timeMs);
+};
+
+static std::string getShmName(const char* name)
+{
+    if (name==nullptr || *name==0)
+        return AMDCOVC_SHM_NAME;
+    return (name[0]=='/') ? std::string(name) : std::string("/") + name;
+}
+
+ShmPublisher::ShmPublisher(const char* _name, size_t adaptersNum, double interval)
+        : name(getShmName(_name)), header(nullptr), slots(nullptr),
+          size(amdcovcShmSize(adaptersNum)), described(false)
+{
+    // check whether other sampler uses this shared memory
+    AMDCOVCShm oldShm;
+    if (amdcovcShmOpen(&oldShm, name.c_str())==0)
+    {
+        const pid_t oldPid = oldShm.header->samplerPid;
+        amdcovcShmClose(&oldShm);
+        if (oldPid!=getpid() && kill(oldPid, 0)==0)
+            throw Error("Other sampler publishes to this shared memory");
+    }
+    shm_unlink(name.c_str()); // remove stale shared memory
+    int fd = shm_open(name.c_str(), O_RDWR|O_CREAT|O_EXCL, 0644);
+    if (fd==-1)
+        throw Error(errno, "Can't create shared memory");
+    if (ftruncate(fd, size)!=0)
+    {
+        const int error = errno;
+        close(fd);
+        shm_unlink(name.c_str());
+        throw Error(error, "Can't resize shared memory");
+    }
+    void* mem = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    const int error = errno;
+    close(fd);
+    if (mem==MAP_FAILED)
+    {
+        shm_unlink(name.c_str());
+        throw Error(error, "Can't map shared memory");
+    }
+    header = (AMDCOVCShmHeader*)mem;
+    slots = (AMDCOVCShmSlot*)(header+1);
+    header->version = AMDCOVC_SHM_VERSION;
+    header->adaptersNum = adaptersNum;
+    header->ringSize = AMDCOVC_SHM_RING_SIZE;
+    header->slotSize = sizeof(AMDCOVCShmSlot);
+    header->samplerPid = getpid();
+    header->intervalMs = (uint32_t)(interval*1000.0);
+    // readers check magic, it must be written last
+    __atomic_store_n(&header->magic, AMDCOVC_SHM_MAGIC, __ATOMIC_RELEASE);
+}
+
+ShmPublisher::~ShmPublisher()
+{
+    munmap(header, size);
+    shm_unlink(name.c_str());
+}
+
+void ShmPublisher::publish(const std::vector<AdapterSnapshot>& snapshots, long timeMs)
+{
+    const size_t slotsNum = std::min(snapshots.size(), size_t(header->adaptersNum));
+    for (size_t k = 0; k < slotsNum; k++)
+    {
+        const AdapterSnapshot& snapshot = snapshots[k];
+        AMDCOVCShmSlot& slot = slots[k];
+        const uint32_t seq = slot.sequence;
+        __atomic_store_n(&slot.sequence, seq+1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        if (!described)
+        {
+            const AdapterInfo& info = *snapshot.info;
+            slot.index = snapshot.userIndex;
+            slot.busNumber = info.iBusNumber;
+            slot.deviceNumber = info.iDeviceNumber;
+            slot.functionNumber = info.iFunctionNumber;
+            ::strncpy(slot.name, info.strAdapterName, AMDCOVC_SHM_NAME_SIZE-1);
+            slot.name[AMDCOVC_SHM_NAME_SIZE-1] = 0;
+        }
+        const ADLPMActivity& activity = snapshot.activity;
+        AMDCOVCShmSample& sample = slot.ring[slot.samplesNum%AMDCOVC_SHM_RING_SIZE];
+        sample.timeMs = timeMs;
+        sample.engineClock = activity.iEngineClock;
+        sample.memoryClock = activity.iMemoryClock;
+        sample.vddc = activity.iVddc;
+        sample.activityPercent = activity.iActivityPercent;
+        sample.currentPerformanceLevel = activity.iCurrentPerformanceLevel;
+        sample.currentBusSpeed = activity.iCurrentBusSpeed;
+        sample.currentBusLanes = activity.iCurrentBusLanes;
+        sample.temperature = snapshot.temperature;
+        sample.fanSpeed = snapshot.fanSpeed;
+        sample.powerControl = snapshot.powerControlSupported ? snapshot.powerControl : 0;
+        sample.powerControlSupported = snapshot.powerControlSupported;
+        sample.reserved = 0;
+        __atomic_store_n(&slot.samplesNum, slot.samplesNum+1, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot.sequence, seq+2, __ATOMIC_RELEASE);
+    }
+    described = true;
+}
+
+/* print latest samples from shared memory. Does not use ADL */
+static void printShmSamples(const char* shmName, const std::vector<int>& choosenAdapters,
+            bool useChoosen)
+{
+    const std::string name = getShmName(shmName);
+    AMDCOVCShm shm;
+    const int ret = amdcovcShmOpen(&shm, name.c_str());
+    if (ret==-ENOENT)
+        throw Error("No sampler publishes to shared memory");
+    if (ret<0)
+        throw Error(-ret, "Can't open shared memory");
+    const long nowMs = getReportTime();
+    for (uint32_t k = 0; k < shm.header->adaptersNum; k++)
+    {
+        // description and sample are read by seqlock (first publish can be running)
+        AMDCOVCShmAdapter adapter;
+        if (amdcovcShmReadAdapter(&shm, k, &adapter)!=0)
+            continue;
+        if (useChoosen && std::find(choosenAdapters.begin(), choosenAdapters.end(),
+                    adapter.index)==choosenAdapters.end())
+            continue;
+        AMDCOVCShmSample sample;
+        if (amdcovcShmReadLatest(&shm, k, &sample)!=0)
+            continue;
+        std::cout << "Adapter " << adapter.index << ": " << adapter.name <<
+                " (sampled " << (nowMs-sample.timeMs)/1000.0 << " s ago)\n"
+                "  Core: " << sample.engineClock/100.0 << " MHz, "
+                "Mem: " << sample.memoryClock/100.0 << " MHz, "
+                "Vddc: " << sample.vddc/1000.0 << " V, "
+                "Load: " << sample.activityPercent << "%, "
+                "Temp: " << sample.temperature/1000.0 << " C, "
+                "Fan: " << sample.fanSpeed << "%, ";
+        if (sample.powerControlSupported)
+            std::cout << "PwrCtrl: " << std::showpos << sample.powerControl << "%" <<
+                    std::noshowpos;
+        else
+            std::cout << "PwrCtrl: N/A";
+        std::cout << ", PerfLevel: " << sample.currentPerformanceLevel << std::endl;
+    }
+    amdcovcShmClose(&shm);
+}
+
+/*
+ * History of samples
+ */
+
+/* history file: memory-mapped round-robin database with columnar layout.
+ * For every adapter three rings are kept: raw samples, 1-minute and 1-hour
+ * averages. Every metric of ring is contiguous array. Downsampled rings are updated
+ * incrementally by accumulators kept in file. File has constant size, it is not
+ * synced explicitly (kernel writes back pages) */
+
+enum HistoryRing
+{
+    HISTORY_RAW = 0,
+    HISTORY_MINUTE,
+    HISTORY_HOUR,
+    HISTORY_RINGS_NUM
+};
+
+enum HistoryColumn
+{
+    HCOL_ENGINE_CLOCK = 0,  // in 10 kHz
+    HCOL_MEMORY_CLOCK,      // in 10 kHz
+    HCOL_VDDC,              // in mV
+    HCOL_ACTIVITY,          // in percents
+    HCOL_TEMPERATURE,       // in millidegrees
+    HCOL_FAN_SPEED,         // in percents
+    HCOL_POWER_CONTROL,     // in percents (0 if not supported)
+    HCOL_PERF_LEVEL,        // current (raw) or most frequent (downsampled) level
+    HCOL_METRICS_NUM,
+    // only in downsampled rings
+    HCOL_SAMPLES = HCOL_METRICS_NUM,    // number of averaged samples
+    HCOL_LEVEL_SAMPLES,     // number of samples at level 0, next columns for next levels
+};
+
+static const int historyLevelsNum = 8; // higher levels are counted as last level
+static const uint32_t historyRingSizes[HISTORY_RINGS_NUM] =
+{
+    86400,  // raw: 1 day for 1 second interval
+    131040, // 1-minute: 91 days
+    17544   // 1-hour: 2 years
+};
+static const int64_t historyRingSteps[HISTORY_RINGS_NUM] = { 0, 60000, 3600000 };
+
+static inline int historyColumnsNum(int ring)
+{ return (ring==HISTORY_RAW) ? HCOL_METRICS_NUM :
+            HCOL_LEVEL_SAMPLES+historyLevelsNum; }
+
+struct HistoryAccumulator
+{
+    int64_t bucketStart;    // in milliseconds, -1 if empty
+    int64_t sums[HCOL_METRICS_NUM];
+    uint32_t samplesNum;
+    uint32_t levelSamples[historyLevelsNum];
+    uint32_t reserved;
+};
+
+struct HistoryAdapter
+{
+    int32_t index;
+    int32_t busNumber;
+    int32_t deviceNumber;
+    int32_t functionNumber;
+    char name[128];
+    uint64_t written[HISTORY_RINGS_NUM];    // written entries of rings
+    HistoryAccumulator accumulators[HISTORY_RINGS_NUM-1];
+};
+
+struct HistoryFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t adaptersNum;
+    uint32_t ringSizes[HISTORY_RINGS_NUM];
+    uint32_t levelsNum;
+    uint64_t dataOffset;
+    uint64_t adapterStride;
+};
+
+class HistoryFile
+{
+private:
+    int fd;
+    char* mem;
+    size_t size;
+    HistoryFileHeader* header;
+    HistoryAdapter* adapters;
+    uint64_t ringOffsets[HISTORY_RINGS_NUM];
+    
+    void mapFile(bool writable);
+    void computeLayout();
+    static size_t computeSize(uint32_t adaptersNum, uint64_t& dataOffset,
+                uint64_t& adapterStride);
+    void appendEntry(uint32_t adapter, int ring, int64_t timeMs, const int32_t* values,
+                const HistoryAccumulator* acc);
+public:
+    // open history file for reading
+    explicit HistoryFile(const char* filename);
+    /* open or create history file for writing. Adapters of existing file must
+     * match snapshots */
+    HistoryFile(const char* filename, const std::vector<AdapterSnapshot>& snapshots);
+    ~HistoryFile();
+    
+    uint32_t getAdaptersNum() const
+    { return header->adaptersNum; }
+    const HistoryAdapter& getAdapter(uint32_t adapter) const
+    { return adapters[adapter]; }
+    uint32_t getRingSize(int ring) const
+    { return header->ringSizes[ring]; }
+    // number of valid entries of ring
+    uint32_t getEntriesNum(uint32_t adapter, int ring) const;
+    // index of oldest entry of ring
+    uint32_t getFirstEntry(uint32_t adapter, int ring) const;
+    const int64_t* getTimes(uint32_t adapter, int ring) const
+    { return (const int64_t*)(mem + header->dataOffset +
+                adapter*header->adapterStride + ringOffsets[ring]); }
+    const int32_t* getColumn(uint32_t adapter, int ring, int column) const
+    { return (const int32_t*)(mem + header->dataOffset +
+                adapter*header->adapterStride + ringOffsets[ring] +
+                8*uint64_t(header->ringSizes[ring]) +
+                4*uint64_t(header->ringSizes[ring])*column); }
+    
+    // append samples of adapters, O(1) per adapter
+    void append(const std::vector<AdapterSnapshot>& snapshots, int64_t timeMs);
+};
+
+static const char historyMagic[8] = { 'A', 'M', 'D', 'C', 'O', 'V', 'C', 'H' };
+static const uint32_t historyVersion = 1;
+
+size_t HistoryFile::computeSize(uint32_t adaptersNum, uint64_t& dataOffset,
+            uint64_t& adapterStride)
+{
+    dataOffset = (sizeof(HistoryFileHeader) + sizeof(HistoryAdapter)*adaptersNum +
+                4095) & ~uint64_t(4095);
+    adapterStride = 0;
+    for (int r = 0; r < HISTORY_RINGS_NUM; r++)
+        adapterStride += uint64_t(historyRingSizes[r])*(8 + 4*historyColumnsNum(r));
+    adapterStride = (adapterStride + 4095) & ~uint64_t(4095);
+    return dataOffset + adapterStride*adaptersNum;
+}
+
+void HistoryFile::computeLayout()
+{
+    uint64_t offset = 0;
+    for (int r = 0; r < HISTORY_RINGS_NUM; r++)
+    {
+        ringOffsets[r] = offset;
+        offset += uint64_t(header->ringSizes[r])*(8 + 4*historyColumnsNum(r));
+    }
+}
+
+void HistoryFile::mapFile(bool writable)
+{
+    struct stat st;
+    if (fstat(fd, &st)!=0)
+        throw Error(errno, "Can't stat history file");
+    size = st.st_size;
+    if (size < sizeof(HistoryFileHeader))
+        throw Error("History file is too small");
+    void* addr = mmap(nullptr, size, writable ? PROT_READ|PROT_WRITE : PROT_READ,
+                MAP_SHARED, fd, 0);
+    if (addr==MAP_FAILED)
+        throw Error(errno, "Can't map history file");
+    mem = (char*)addr;
+    header = (HistoryFileHeader*)mem;
+    adapters = (HistoryAdapter*)(header+1);
+    uint64_t dataOffset, adapterStride;
+    if (::memcmp(header->magic, historyMagic, 8)!=0 || header->version!=historyVersion ||
+        header->levelsNum!=historyLevelsNum ||
+        computeSize(header->adaptersNum, dataOffset, adapterStride) > size ||
+        header->dataOffset!=dataOffset || header->adapterStride!=adapterStride ||
+        !std::equal(header->ringSizes, header->ringSizes+HISTORY_RINGS_NUM,
+                    historyRingSizes))
+        throw Error("Wrong history file format");
+    computeLayout();
+}
+
+HistoryFile::HistoryFile(const char* filename)
+try : fd(-1), mem(nullptr), size(0), header(nullptr), adapters(nullptr)
+{
+    fd = open(filename, O_RDONLY|O_CLOEXEC);
+    if (fd==-1)
+        throw Error(errno, "Can't open history file");
+    mapFile(false);
+}
+catch(...)
+{
+    if (mem!=nullptr)
+        munmap(mem, size);
+    if (fd!=-1)
+        close(fd);
+    throw;
+}
+
+HistoryFile::HistoryFile(const char* filename,
+            const std::vector<AdapterSnapshot>& snapshots)
+try : fd(-1), mem(nullptr), size(0), header(nullptr), adapters(nullptr)
+{
+    fd = open(filename, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+    if (fd==-1)
+        throw Error(errno, "Can't open history file");
+    if (flock(fd, LOCK_EX|LOCK_NB)!=0)
+        throw Error("History file is used by other sampler");
+    struct stat st;
+    if (fstat(fd, &st)!=0)
+        throw Error(errno, "Can't stat history file");
+    if (st.st_size==0)
+    {
+        // new file: sparse file, rings are empty
+        uint64_t dataOffset, adapterStride;
+        const size_t newSize = computeSize(snapshots.size(), dataOffset, adapterStride);
+        if (ftruncate(fd, newSize)!=0)
+            throw Error(errno, "Can't resize history file");
+        HistoryFileHeader newHeader;
+        ::memset(&newHeader, 0, sizeof(newHeader));
+        ::memcpy(newHeader.magic, historyMagic, 8);
+        newHeader.version = historyVersion;
+        newHeader.adaptersNum = snapshots.size();
+        std::copy(historyRingSizes, historyRingSizes+HISTORY_RINGS_NUM,
+                  newHeader.ringSizes);
+        newHeader.levelsNum = historyLevelsNum;
+        newHeader.dataOffset = dataOffset;
+        newHeader.adapterStride = adapterStride;
+        std::vector<HistoryAdapter> newAdapters(snapshots.size());
+        for (size_t k = 0; k < snapshots.size(); k++)
+        {
+            HistoryAdapter& adapter = newAdapters[k];
+            ::memset(&adapter, 0, sizeof(HistoryAdapter));
+            const AdapterInfo& info = *snapshots[k].info;
+            adapter.index = snapshots[k].userIndex;
+            adapter.busNumber = info.iBusNumber;
+            adapter.deviceNumber = info.iDeviceNumber;
+            adapter.functionNumber = info.iFunctionNumber;
+            ::memcpy(adapter.name, info.strAdapterName, std::min(sizeof(adapter.name)-1,
+                        ::strlen(info.strAdapterName)));
+            for (int r = 0; r < HISTORY_RINGS_NUM-1; r++)
+                adapter.accumulators[r].bucketStart = -1;
+        }
+        if (pwrite(fd, &newHeader, sizeof(newHeader), 0)!=ssize_t(sizeof(newHeader)) ||
+            pwrite(fd, newAdapters.data(), sizeof(HistoryAdapter)*snapshots.size(),
+                   sizeof(newHeader))!=ssize_t(sizeof(HistoryAdapter)*snapshots.size()))
+            throw Error(errno, "Can't write history file");
+    }
+    mapFile(true);
+    // history must describe same adapters
+    bool matched = header->adaptersNum==snapshots.size();
+    for (size_t k = 0; matched && k < snapshots.size(); k++)
+    {
+        const AdapterInfo& info = *snapshots[k].info;
+        matched = adapters[k].index==snapshots[k].userIndex &&
+                adapters[k].busNumber==info.iBusNumber &&
+                adapters[k].deviceNumber==info.iDeviceNumber &&
+                adapters[k].functionNumber==info.iFunctionNumber;
+    }
+    if (!matched)
+        throw Error("History file has been recorded for other adapters");
+}
+catch(...)
+{
+    if (mem!=nullptr)
+        munmap(mem, size);
+    if (fd!=-1)
+        close(fd);
+    throw;
+}
+
+HistoryFile::~HistoryFile()
+{
+    munmap(mem, size);
+    close(fd);
+}
+
+uint32_t HistoryFile::getEntriesNum(uint32_t adapter, int ring) const
+{
+    const uint64_t written = __atomic_load_n(&adapters[adapter].written[ring],
+                __ATOMIC_ACQUIRE);
+    return std::min(written, uint64_t(header->ringSizes[ring]));
+}
+
+uint32_t HistoryFile::getFirstEntry(uint32_t adapter, int ring) const
+{
+    const uint64_t written = __atomic_load_n(&adapters[adapter].written[ring],
+                __ATOMIC_ACQUIRE);
+    return (written <= header->ringSizes[ring]) ? 0 : written%header->ringSizes[ring];
+}
+
+void HistoryFile::appendEntry(uint32_t adapter, int ring, int64_t timeMs,
+            const int32_t* values, const HistoryAccumulator* acc)
+{
+    HistoryAdapter& hadapter = adapters[adapter];
+    const uint64_t written = hadapter.written[ring];
+    const uint32_t pos = written%header->ringSizes[ring];
+    ((int64_t*)getTimes(adapter, ring))[pos] = timeMs;
+    for (int c = 0; c < HCOL_METRICS_NUM; c++)
+        ((int32_t*)getColumn(adapter, ring, c))[pos] = values[c];
+    if (acc!=nullptr)
+    {
+        ((int32_t*)getColumn(adapter, ring, HCOL_SAMPLES))[pos] = acc->samplesNum;
+        for (int l = 0; l < historyLevelsNum; l++)
+            ((int32_t*)getColumn(adapter, ring, HCOL_LEVEL_SAMPLES+l))[pos] =
+                    acc->levelSamples[l];
+    }
+    // readers see entry after it has been written
+    __atomic_store_n(&hadapter.written[ring], written+1, __ATOMIC_RELEASE);
+}
+
+void HistoryFile::append(const std::vector<AdapterSnapshot>& snapshots, int64_t timeMs)
+{
+    const uint32_t adaptersNum = std::min(uint32_t(snapshots.size()),
+                header->adaptersNum);
+    for (uint32_t k = 0; k < adaptersNum; k++)
+    {
+        const AdapterSnapshot& snapshot = snapshots[k];
+        const ADLPMActivity& activity = snapshot.activity;
+        int32_t values[HCOL_METRICS_NUM];
+        values[HCOL_ENGINE_CLOCK] = activity.iEngineClock;
+        values[HCOL_MEMORY_CLOCK] = activity.iMemoryClock;
+        values[HCOL_VDDC] = activity.iVddc;
+        values[HCOL_ACTIVITY] = activity.iActivityPercent;
+        values[HCOL_TEMPERATURE] = snapshot.temperature;
+        values[HCOL_FAN_SPEED] = snapshot.fanSpeed;
+        values[HCOL_POWER_CONTROL] = snapshot.powerControlSupported ?
+                    snapshot.powerControl : 0;
+        values[HCOL_PERF_LEVEL] = activity.iCurrentPerformanceLevel;
+        appendEntry(k, HISTORY_RAW, timeMs, values, nullptr);
+        const int level = std::max(0, std::min(historyLevelsNum-1,
+                    activity.iCurrentPerformanceLevel));
+        
+        for (int r = HISTORY_MINUTE; r < HISTORY_RINGS_NUM; r++)
+        {
+            HistoryAccumulator& acc = adapters[k].accumulators[r-1];
+            const int64_t bucketStart = timeMs - timeMs%historyRingSteps[r];
+            if (acc.bucketStart!=bucketStart)
+            {
+                if (acc.bucketStart>=0 && acc.samplesNum!=0)
+                {
+                    // flush finished bucket
+                    int32_t means[HCOL_METRICS_NUM];
+                    for (int c = 0; c < HCOL_METRICS_NUM; c++)
+                        means[c] = int32_t((acc.sums[c] + (acc.sums[c]>=0 ?
+                                int64_t(acc.samplesNum/2) : -int64_t(acc.samplesNum/2))) /
+                                int64_t(acc.samplesNum));
+                    means[HCOL_PERF_LEVEL] = std::max_element(acc.levelSamples,
+                            acc.levelSamples+historyLevelsNum) - acc.levelSamples;
+                    appendEntry(k, r, acc.bucketStart, means, &acc);
+                }
+                ::memset(&acc, 0, sizeof(HistoryAccumulator));
+                acc.bucketStart = bucketStart;
+            }
+            for (int c = 0; c < HCOL_METRICS_NUM; c++)
+                acc.sums[c] += values[c];
+            acc.samplesNum++;
+            acc.levelSamples[level]++;
+        }
+    }
+}
+
+/* opens history file at first sample (adapters are known after collecting) */
+class HistoryRecorder
+{
+private:
+    std::string filename;
+    std::unique_ptr<HistoryFile> file;
+public:
+    explicit HistoryRecorder(const char* _filename) : filename(_filename)
+    { }
+    void record(const std::vector<AdapterSnapshot>& snapshots, int64_t timeMs)
+    {
+        if (!file)
+            file.reset(new HistoryFile(filename.c_str(), snapshots));
+        file->append(snapshots, timeMs);
+    }
+};
+
+/* consumers of samples collected in watch and sampler modes */
+struct SampleSinks
+{
+    ShmPublisher* shmPublisher;
+    HistoryRecorder* history;
+    
+    void publish(const std::vector<AdapterSnapshot>& snapshots, long timeMs) const
+    {
+        if (shmPublisher!=nullptr)
+            shmPublisher->publish(snapshots, timeMs);
+        if (history!=nullptr)
+            history->record(snapshots, timeMs);
+    }
+};
+
+/*
+ * History queries
+ */
+
+struct HistoryMetricInfo
+{
+    const char* name;       // name in JSON
+    const char* textName;   // name in text output
+    const char* unit;
+    long scale;             // divisor to unit
+};
+
+// statistics are computed for all metrics except performance level
+static const int historyStatsMetricsNum = HCOL_PERF_LEVEL;
+
+static const HistoryMetricInfo historyMetrics[historyStatsMetricsNum] =
+{
+    { "core_clock", "Core", " MHz", 100 },
+    { "memory_clock", "Mem", " MHz", 100 },
+    { "vddc", "Vddc", " V", 1000 },
+    { "load", "Load", "%", 1 },
+    { "temperature", "Temp", " C", 1000 },
+    { "fan_speed", "Fan", "%", 1 },
+    { "power_control", "PwrCtrl", "%", 1 }
+};
+
+static const char* historyRingNames[HISTORY_RINGS_NUM] = { "raw", "1m", "1h" };
+
+struct HistoryQuery
+{
+    int64_t fromMs;
+    int64_t toMs;
+    std::vector<double> percentiles;
+    std::vector<std::string> percentileNames;
+    int32_t temperatureThreshold;   // in millidegrees
+};
+
+/* entries of ring in time range: logical range is at most two contiguous
+ * parts of columns */
+struct HistorySpan
+{
+    int ring;
+    uint32_t partsNum;
+    uint32_t parts[2][2];   // physical [begin, end)
+    size_t entriesNum;
+};
+
+struct HistoryMetricStats
+{
+    int32_t min;
+    int32_t max;
+    double mean;
+    std::vector<int32_t> percentiles;
+};
+
+struct HistoryAdapterStats
+{
+    uint32_t adapter;
+    HistorySpan span;
+    int64_t firstMs;
+    int64_t lastMs;
+    HistoryMetricStats metrics[historyStatsMetricsNum];
+    int64_t coveredMs;
+    int64_t aboveThresholdMs;
+    int64_t levelTimesMs[historyLevelsNum];
+};
+
+/* choose finest ring that covers range start (or that has never been wrapped)
+ * and find entries in range by binary search */
+static void findHistorySpan(const HistoryFile& file, uint32_t adapter,
+            int64_t fromMs, int64_t toMs, HistorySpan& span)
+{
+    int ring = HISTORY_HOUR;
+    for (int r = HISTORY_RAW; r < HISTORY_HOUR; r++)
+    {
+        const uint32_t entriesNum = file.getEntriesNum(adapter, r);
+        if (entriesNum==0)
+            continue;
+        if (entriesNum < file.getRingSize(r) ||
+            file.getTimes(adapter, r)[file.getFirstEntry(adapter, r)] <= fromMs)
+        {
+            ring = r;
+            break;
+        }
+    }
+    const uint32_t ringSize = file.getRingSize(ring);
+    const uint32_t entriesNum = file.getEntriesNum(adapter, ring);
+    const uint32_t first = file.getFirstEntry(adapter, ring);
+    const int64_t* times = file.getTimes(adapter, ring);
+    auto timeAt = [=](uint32_t i)
+    { return times[(first+i)%ringSize]; };
+    // find first entry not before fromMs and first entry after toMs
+    uint32_t lo = 0, hi = entriesNum;
+    while (lo < hi)
+    {
+        const uint32_t mid = (lo+hi)>>1;
+        if (timeAt(mid) < fromMs)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    const uint32_t begin = lo;
+    hi = entriesNum;
+    while (lo < hi)
+    {
+        const uint32_t mid = (lo+hi)>>1;
+        if (timeAt(mid) <= toMs)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    const uint32_t end = lo;
+    span.ring = ring;
+    span.entriesNum = end-begin;
+    span.partsNum = 0;
+    if (begin==end)
+        return;
+    const uint32_t pbegin = (first+begin)%ringSize;
+    const uint32_t pend = (first+end-1)%ringSize + 1;
+    if (pbegin < pend)
+    {
+        span.parts[0][0] = pbegin;
+        span.parts[0][1] = pend;
+        span.partsNum = 1;
+    }
+    else
+    {
+        span.parts[0][0] = pbegin;
+        span.parts[0][1] = ringSize;
+        span.parts[1][0] = 0;
+        span.parts[1][1] = pend;
+        span.partsNum = 2;
+    }
+}
+
+/* aggregation kernels over contiguous columns: simple loops without
+ * dependencies between iterations, compiler can vectorize them */
+static void historyMinMax(const int32_t* values, size_t n, int32_t& minValue,
+            int32_t& maxValue)
+{
+    int32_t minV = minValue, maxV = maxValue;
+    for (size_t i = 0; i < n; i++)
+    {
+        minV = std::min(minV, values[i]);
+        maxV = std::max(maxV, values[i]);
+    }
+    minValue = minV;
+    maxValue = maxV;
+}
+
+static int64_t historySum(const int32_t* values, size_t n)
+{
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; i++)
+        sum += values[i];
+    return sum;
+}
+
+static int64_t historyWeightedSum(const int32_t* values, const int32_t* weights, size_t n)
+{
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; i++)
+        sum += int64_t(values[i])*weights[i];
+    return sum;
+}
+
+static void computeHistoryMetricStats(const HistoryFile& file, const HistoryQuery& query,
+            HistoryAdapterStats& stats, int metric)
+{
+    const HistorySpan& span = stats.span;
+    HistoryMetricStats& mstats = stats.metrics[metric];
+    const int32_t* column = file.getColumn(stats.adapter, span.ring, metric);
+    const int32_t* weights = (span.ring!=HISTORY_RAW) ?
+            file.getColumn(stats.adapter, span.ring, HCOL_SAMPLES) : nullptr;
+    mstats.min = INT32_MAX;
+    mstats.max = INT32_MIN;
+    int64_t sum = 0, weightsSum = 0;
+    for (uint32_t p = 0; p < span.partsNum; p++)
+    {
+        const uint32_t begin = span.parts[p][0];
+        const size_t n = span.parts[p][1]-begin;
+        historyMinMax(column+begin, n, mstats.min, mstats.max);
+        if (weights!=nullptr)
+        {
+            sum += historyWeightedSum(column+begin, weights+begin, n);
+            weightsSum += historySum(weights+begin, n);
+        }
+        else
+        {
+            sum += historySum(column+begin, n);
+            weightsSum += n;
+        }
+    }
+    mstats.mean = (weightsSum!=0) ? double(sum)/weightsSum : 0.0;
+    
+    mstats.percentiles.resize(query.percentiles.size());
+    if (query.percentiles.empty())
+        return;
+    /* percentiles of downsampled ring are computed from averages
+     * (every average is single value) */
+    std::vector<int32_t> values;
+    values.reserve(span.entriesNum);
+    for (uint32_t p = 0; p < span.partsNum; p++)
+        values.insert(values.end(), column+span.parts[p][0], column+span.parts[p][1]);
+    // percentiles are sorted, next selections work on rest of values
+    auto start = values.begin();
+    for (size_t k = 0; k < query.percentiles.size(); k++)
+    {
+        const size_t pos = std::min(values.size()-1,
+                size_t(query.percentiles[k]/100.0*(values.size()-1) + 0.5));
+        std::nth_element(start, values.begin()+pos, values.end());
+        mstats.percentiles[k] = values[pos];
+        start = values.begin()+pos;
+    }
+}
+
+/* time above temperature threshold and time at performance levels. Raw sample
+ * lasts until next sample (at most one minute), downsampled entry lasts one step */
+static void computeHistoryTimes(const HistoryFile& file, const HistoryQuery& query,
+            HistoryAdapterStats& stats)
+{
+    const HistorySpan& span = stats.span;
+    const int32_t* temps = file.getColumn(stats.adapter, span.ring, HCOL_TEMPERATURE);
+    const int64_t* times = file.getTimes(stats.adapter, span.ring);
+    stats.coveredMs = 0;
+    stats.aboveThresholdMs = 0;
+    std::fill(stats.levelTimesMs, stats.levelTimesMs+historyLevelsNum, 0);
+    if (span.ring==HISTORY_RAW)
+    {
+        const int32_t* levels = file.getColumn(stats.adapter, span.ring, HCOL_PERF_LEVEL);
+        const int64_t maxDuration = historyRingSteps[HISTORY_MINUTE];
+        int64_t lastDuration = 0;
+        uint32_t prev = 0;
+        bool havePrev = false;
+        // duration of previous sample is known at next sample
+        auto addSample = [&](uint32_t i, int64_t duration)
+        {
+            stats.coveredMs += duration;
+            if (temps[i] > query.temperatureThreshold)
+                stats.aboveThresholdMs += duration;
+            stats.levelTimesMs[std::max(0, std::min(historyLevelsNum-1, levels[i]))] +=
+                    duration;
+        };
+        for (uint32_t p = 0; p < span.partsNum; p++)
+            for (uint32_t i = span.parts[p][0]; i < span.parts[p][1]; i++)
+            {
+                if (havePrev)
+                {
+                    lastDuration = std::min(maxDuration, times[i]-times[prev]);
+                    addSample(prev, lastDuration);
+                }
+                prev = i;
+                havePrev = true;
+            }
+        if (havePrev)
+            addSample(prev, lastDuration);
+        return;
+    }
+    const int64_t step = historyRingSteps[span.ring];
+    const int32_t* samples = file.getColumn(stats.adapter, span.ring, HCOL_SAMPLES);
+    for (uint32_t p = 0; p < span.partsNum; p++)
+        for (uint32_t i = span.parts[p][0]; i < span.parts[p][1]; i++)
+        {
+            stats.coveredMs += step;
+            if (temps[i] > query.temperatureThreshold)
+                stats.aboveThresholdMs += step;
+            if (samples[i]!=0)
+                for (int l = 0; l < historyLevelsNum; l++)
+                    stats.levelTimesMs[l] += step*file.getColumn(stats.adapter,
+                            span.ring, HCOL_LEVEL_SAMPLES+l)[i]/samples[i];
+        }
+}
+
+/* compute statistics of adapters. Every metric of every adapter is separate task,
+ * tasks are distributed between threads */
+static void queryHistory(const HistoryFile& file, const HistoryQuery& query,
+            const std::vector<uint32_t>& adapters, std::vector<HistoryAdapterStats>& stats)
+{
+    stats.resize(adapters.size());
+    for (size_t k = 0; k < adapters.size(); k++)
+    {
+        HistoryAdapterStats& astats = stats[k];
+        astats.adapter = adapters[k];
+        findHistorySpan(file, adapters[k], query.fromMs, query.toMs, astats.span);
+        astats.firstMs = astats.lastMs = 0;
+        if (astats.span.entriesNum!=0)
+        {
+            const HistorySpan& span = astats.span;
+            const int64_t* times = file.getTimes(adapters[k], span.ring);
+            astats.firstMs = times[span.parts[0][0]];
+            astats.lastMs = times[span.parts[span.partsNum-1][1]-1];
+        }
+    }
+    const size_t tasksPerAdapter = historyStatsMetricsNum+1;
+    const size_t tasksNum = adapters.size()*tasksPerAdapter;
+    std::atomic<size_t> nextTask(0);
+    std::vector<std::exception_ptr> errors(tasksNum);
+    auto worker = [&]()
+    {
+        for (size_t task; (task = nextTask.fetch_add(1)) < tasksNum; )
+        {
+            HistoryAdapterStats& astats = stats[task/tasksPerAdapter];
+            const int metric = task%tasksPerAdapter;
+            try
+            {
+                if (metric==historyStatsMetricsNum)
+                    computeHistoryTimes(file, query, astats);
+                else if (astats.span.entriesNum!=0)
+                    computeHistoryMetricStats(file, query, astats, metric);
+            }
+            catch(...)
+            { errors[task] = std::current_exception(); }
+        }
+    };
+    const size_t threadsNum = std::min(tasksNum,
+                size_t(std::max(1U, std::thread::hardware_concurrency())));
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < threadsNum; t++)
+        workers.push_back(std::thread(worker));
+    worker();
+    for (std::thread& thread: workers)
+        thread.join();
+    for (const std::exception_ptr& error: errors)
+        if (error)
+            std::rethrow_exception(error);
+}
+
+static void appendHistoryTime(ReportBuffer& out, int64_t timeMs)
+{
+    const time_t t = timeMs/1000;
+    struct tm tm;
+    char buf[32];
+    strftime(buf, 32, "%Y-%m-%d %H:%M:%S", localtime_r(&t, &tm));
+    out.append(buf);
+}
+
+static void formatHistoryStatsText(ReportBuffer& out, const HistoryFile& file,
+            const HistoryQuery& query, const std::vector<HistoryAdapterStats>& stats)
+{
+    for (const HistoryAdapterStats& astats: stats)
+    {
+        const HistoryAdapter& adapter = file.getAdapter(astats.adapter);
+        out.append("Adapter ");
+        out.appendInt(adapter.index);
+        out.append(": ");
+        out.append(adapter.name);
+        out.append('\n');
+        if (astats.span.entriesNum==0)
+        {
+            out.append("  No samples in range\n");
+            continue;
+        }
+        out.append("  Range: ");
+        appendHistoryTime(out, astats.firstMs);
+        out.append(" - ");
+        appendHistoryTime(out, astats.lastMs);
+        out.append(", ");
+        out.appendInt(astats.span.entriesNum);
+        out.append((astats.span.ring==HISTORY_RAW) ? " samples\n" :
+                (astats.span.ring==HISTORY_MINUTE) ? " 1-minute averages\n" :
+                " 1-hour averages\n");
+        for (int m = 0; m < historyStatsMetricsNum; m++)
+        {
+            const HistoryMetricInfo& info = historyMetrics[m];
+            const HistoryMetricStats& mstats = astats.metrics[m];
+            // mean with 2 or 3 decimal digits
+            const long meanScale = std::max(100L, info.scale);
+            out.append("  ");
+            out.append(info.textName);
+            out.append(": min ");
+            out.appendScaled(mstats.min, info.scale);
+            out.append(info.unit);
+            out.append(", max ");
+            out.appendScaled(mstats.max, info.scale);
+            out.append(info.unit);
+            out.append(", mean ");
+            out.appendScaled(lround(mstats.mean*meanScale/info.scale), meanScale);
+            out.append(info.unit);
+            for (size_t k = 0; k < query.percentiles.size(); k++)
+            {
+                out.append(", p");
+                out.append(query.percentileNames[k].c_str());
+                out.append(' ');
+                out.appendScaled(mstats.percentiles[k], info.scale);
+                out.append(info.unit);
+            }
+            out.append('\n');
+        }
+        out.append("  Temp above ");
+        out.appendScaled(query.temperatureThreshold, 1000);
+        out.append(" C: ");
+        out.appendScaled(astats.aboveThresholdMs, 1000);
+        out.append(" s (");
+        out.appendScaled((astats.coveredMs!=0) ?
+                astats.aboveThresholdMs*1000/astats.coveredMs : 0, 10);
+        out.append("%)\n  PerfLevels:");
+        bool first = true;
+        for (int l = 0; l < historyLevelsNum; l++)
+            if (astats.levelTimesMs[l]!=0)
+            {
+                out.append(first ? " " : ", ");
+                out.appendInt(l);
+                out.append(": ");
+                out.appendScaled(astats.levelTimesMs[l], 1000);
+                out.append(" s");
+                first = false;
+            }
+        out.append('\n');
+    }
+}
+
+static void formatHistoryStatsJSON(ReportBuffer& out, const HistoryFile& file,
+            const HistoryQuery& query, const std::vector<HistoryAdapterStats>& stats)
+{
+    out.append("{\"from\":");
+    out.appendScaled(query.fromMs, 1000);
+    out.append(",\"to\":");
+    out.appendScaled(query.toMs, 1000);
+    out.append(",\"temperature_threshold\":");
+    out.appendScaled(query.temperatureThreshold, 1000);
+    out.append(",\"adapters\":[");
+    for (size_t k = 0; k < stats.size(); k++)
+    {
+        const HistoryAdapterStats& astats = stats[k];
+        const HistoryAdapter& adapter = file.getAdapter(astats.adapter);
+        if (k!=0)
+            out.append(',');
+        out.append("{\"index\":");
+        out.appendInt(adapter.index);
+        out.append(",\"name\":");
+        out.appendJSONString(adapter.name);
+        out.append(",\"resolution\":\"");
+        out.append(historyRingNames[astats.span.ring]);
+        out.append("\",\"entries\":");
+        out.appendInt(astats.span.entriesNum);
+        if (astats.span.entriesNum==0)
+        {
+            out.append('}');
+            continue;
+        }
+        out.append(",\"first\":");
+        out.appendScaled(astats.firstMs, 1000);
+        out.append(",\"last\":");
+        out.appendScaled(astats.lastMs, 1000);
+        for (int m = 0; m < historyStatsMetricsNum; m++)
+        {
+            const HistoryMetricInfo& info = historyMetrics[m];
+            const HistoryMetricStats& mstats = astats.metrics[m];
+            // mean with 2 or 3 decimal digits
+            const long meanScale = std::max(100L, info.scale);
+            out.append(",\"");
+            out.append(info.name);
+            out.append("\":{\"min\":");
+            out.appendScaled(mstats.min, info.scale);
+            out.append(",\"max\":");
+            out.appendScaled(mstats.max, info.scale);
+            out.append(",\"mean\":");
+            out.appendScaled(lround(mstats.mean*meanScale/info.scale), meanScale);
+            for (size_t p = 0; p < query.percentiles.size(); p++)
+            {
+                out.append(",\"p");
+                out.append(query.percentileNames[p].c_str());
+                out.append("\":");
+                out.appendScaled(mstats.percentiles[p], info.scale);
+            }
+            out.append('}');
+        }
+        out.append(",\"covered_time\":");
+        out.appendScaled(astats.coveredMs, 1000);
+        out.append(",\"time_above_threshold\":");
+        out.appendScaled(astats.aboveThresholdMs, 1000);
+        out.append(",\"perf_level_time\":[");
+        for (int l = 0; l < historyLevelsNum; l++)
+        {
+            if (l!=0)
+                out.append(',');
+            out.appendScaled(astats.levelTimesMs[l], 1000);
+        }
+        out.append("]}");
+    }
+    out.append("]}\n");
+}
+
+/* time: 'now', seconds since epoch or time relative to now: -NUMBER[s|m|h|d] */
+static int64_t parseHistoryTime(const char* string, int64_t nowMs)
+{
+    if (::strcmp(string, "now")==0)
+        return nowMs;
+    char* endptr;
+    errno = 0;
+    double value = strtod(string, &endptr);
+    if (errno!=0 || endptr==string)
+        throw Error("Can't parse time");
+    if (*string!='-')
+    {
+        if (*endptr!=0)
+            throw Error("Garbages at time");
+        return int64_t(value*1000.0);
+    }
+    double unit = 1000.0;
+    if (*endptr=='m')
+        unit = 60000.0;
+    else if (*endptr=='h')
+        unit = 3600000.0;
+    else if (*endptr=='d')
+        unit = 86400000.0;
+    else if (*endptr!='s' && *endptr!=0)
+        throw Error("Unknown time unit");
+    if (*endptr!=0 && endptr[1]!=0)
+        throw Error("Garbages at time");
+    return nowMs + int64_t(value*unit);
+}
+
+static void parsePercentiles(const char* string, HistoryQuery& query)
+{
+    query.percentiles.clear();
+    query.percentileNames.clear();
+    if (*string==0)
+        return;
+    while (true)
+    {
+        char* endptr;
+        errno = 0;
+        double value = strtod(string, &endptr);
+        if (errno!=0 || endptr==string)
+            throw Error("Can't parse percentile");
+        if (value < 0.0 || value > 100.0)
+            throw Error("Percentile out of range");
+        query.percentiles.push_back(value);
+        query.percentileNames.push_back(std::string(string, (const char*)endptr));
+        string = endptr;
+        if (*string==0)
+            break;
+        if (*string==',')
+            string++;
+        else
+            throw Error("Garbages at percentile list");
+    }
+    // keep order of names while sorting
+    std::vector<size_t> order(query.percentiles.size());
+    for (size_t k = 0; k < order.size(); k++)
+        order[k] = k;
+    std::sort(order.begin(), order.end(), [&query](size_t a, size_t b)
+            { return query.percentiles[a] < query.percentiles[b]; });
+    std::vector<double> percentiles(order.size());
+    std::vector<std::string> names(order.size());
+    for (size_t k = 0; k < order.size(); k++)
+    {
+        percentiles[k] = query.percentiles[order[k]];
+        names[k] = query.percentileNames[order[k]];
+    }
+    query.percentiles.swap(percentiles);
+    query.percentileNames.swap(names);
+}
+
+static const char* queryHelpString =
+"Usage: amdcovc query --history=FILE [-a LIST|--adapters=LIST] [--from=TIME]\n"
+"               [--to=TIME] [--threshold=TEMP] [--percentiles=LIST] [--format=FORMAT]\n"
+"Print statistics of samples recorded in history FILE.\n"
+"\n"
+"List of options:\n"
+"  -a, --adapters=LIST       adapters (default is all)\n"
+"      --from=TIME           range start (default is oldest sample)\n"
+"      --to=TIME             range end (default is now)\n"
+"      --threshold=TEMP      temperature threshold in Celsius (default 80)\n"
+"      --percentiles=LIST    comma-separated percentiles (default 50,90,99)\n"
+"      --format=FORMAT       output format: text (default) or json\n"
+"TIME is 'now', seconds since epoch or time relative to now: -NUMBER[s|m|h|d].\n";
+
+/* 'amdcovc query' subcommand */
+static int runHistoryQuery(int argc, const char** argv)
+{
+    const char* historyFile = nullptr;
+    AdaptersOption adaptersOption;
+    OutputFormat outputFormat = OutputFormat::TEXT;
+    const int64_t nowMs = getReportTime();
+    HistoryQuery query;
+    query.fromMs = 0;
+    query.toMs = nowMs;
+    query.temperatureThreshold = 80000;
+    parsePercentiles("50,90,99", query);
+    for (int i = 1; i < argc; i++)
+    {
+        if (::strcmp(argv[i], "--help")==0 || ::strcmp(argv[i], "-?")==0)
+        {
+            std::cout << queryHelpString;
+            std::cout.flush();
+            return 0;
+        }
+        else if (::strncmp(argv[i], "--history=", 10)==0)
+            historyFile = argv[i]+10;
+        else if (adaptersOption.parse(argc, argv, i))
+            continue;
+        else if (::strncmp(argv[i], "--from=", 7)==0)
+            query.fromMs = parseHistoryTime(argv[i]+7, nowMs);
+        else if (::strncmp(argv[i], "--to=", 5)==0)
+            query.toMs = parseHistoryTime(argv[i]+5, nowMs);
+        else if (::strncmp(argv[i], "--threshold=", 12)==0)
+        {
+            char* endptr;
+            errno = 0;
+            double value = strtod(argv[i]+12, &endptr);
+            if (errno!=0 || endptr==argv[i]+12 || *endptr!=0)
+                throw Error("Can't parse temperature threshold");
+            query.temperatureThreshold = int32_t(lround(value*1000.0));
+        }
+        else if (::strncmp(argv[i], "--percentiles=", 14)==0)
+            parsePercentiles(argv[i]+14, query);
+        else if (::strncmp(argv[i], "--format=", 9)==0)
+            outputFormat = parseOutputFormat(argv[i]+9);
+        else
+            throw Error((std::string("Unknown query option: '") + argv[i] + "'").c_str());
+    }
+    if (historyFile==nullptr)
+        throw Error("History file not supplied");
+    if (outputFormat!=OutputFormat::TEXT && outputFormat!=OutputFormat::JSON)
+        throw Error("Only text and json formats are supported by query");
+    if (query.fromMs > query.toMs)
+        throw Error("Wrong time range");
+    
+    HistoryFile file(historyFile);
+    std::vector<uint32_t> adapters;
+    for (uint32_t k = 0; k < file.getAdaptersNum(); k++)
+        if (adaptersOption.isChoosen(file.getAdapter(k).index))
+            adapters.push_back(k);
+    if (adaptersOption.useChoosen() &&
+        adapters.size()!=adaptersOption.choosenAdapters.size())
+        throw Error("Some adapters are not in history file");
+    
+    std::vector<HistoryAdapterStats> stats;
+    queryHistory(file, query, adapters, stats);
+    ReportBuffer report;
+    if (outputFormat==OutputFormat::JSON)
+        formatHistoryStatsJSON(report, file, query, stats);
+    else
+        formatHistoryStatsText(report, file, query, stats);
+    std::cout.flush();
+    report.writeTo(1);
+    return 0;
+}
+
+/*
+ * Prometheus exporter
+ */
+
+static void appendPrometheusLabel(ReportBuffer& out, const char* string)
+{
+    out.append('"');
+    for (; *string!=0; string++)
+        if (*string=='\\')
+            out.append("\\\\");
+        else if (*string=='"')
+            out.append("\\\"");
+        else if (*string=='\n')
+            out.append("\\n");
+        else
+            out.append(*string);
+    out.append('"');
+}
+
+enum class PromMetric
+{
+    CORE_CLOCK = 0,
+    MEMORY_CLOCK,
+    VDDC,
+    LOAD,
+    TEMPERATURE,
+    FAN_SPEED,
+    POWER_CONTROL,
+    PERF_LEVEL,
+    BUS_SPEED,
+    BUS_LANES,
+    MAX
+};
+
+static const struct PromMetricDesc
+{
+    const char* name;
+    const char* help;
+} promMetrics[int(PromMetric::MAX)] =
+{
+    { "amdcovc_core_clock_mhz", "Current core clock in MHz." },
+    { "amdcovc_memory_clock_mhz", "Current memory clock in MHz." },
+    { "amdcovc_vddc_volts", "Current Vddc voltage in volts." },
+    { "amdcovc_load_percent", "GPU load in percents." },
+    { "amdcovc_temperature_celsius", "GPU temperature in Celsius degrees." },
+    { "amdcovc_fan_speed_percent", "Fan speed in percents." },
+    { "amdcovc_power_control_percent", "PowerControl in percents." },
+    { "amdcovc_perf_level", "Current performance level." },
+    { "amdcovc_bus_speed", "Current bus speed." },
+    { "amdcovc_bus_lanes", "Current bus lanes." }
+};
+
+/* metrics in Prometheus text format (version 0.0.4). Samples of every metric
+ * are grouped together as required by format */
+static void formatPrometheusMetrics(ReportBuffer& out,
+            const std::vector<AdapterSnapshot>& snapshots, long lastSampleMs,
+            unsigned long sampleErrorsNum)
+{
+    for (int m = 0; m < int(PromMetric::MAX); m++)
+    {
+        out.append("# HELP ");
+        out.append(promMetrics[m].name);
+        out.append(' ');
+        out.append(promMetrics[m].help);
+        out.append("\n# TYPE ");
+        out.append(promMetrics[m].name);
+        out.append(" gauge\n");
+        for (const AdapterSnapshot& snapshot: snapshots)
+        {
+            if (PromMetric(m)==PromMetric::POWER_CONTROL && !snapshot.powerControlSupported)
+                continue;
+            out.append(promMetrics[m].name);
+            out.append("{adapter=\"");
+            out.appendInt(snapshot.userIndex);
+            out.append("\",name=");
+            appendPrometheusLabel(out, snapshot.info->strAdapterName);
+            out.append("} ");
+            const ADLPMActivity& activity = snapshot.activity;
+            switch (PromMetric(m))
+            {
+                case PromMetric::CORE_CLOCK:
+                    out.appendScaled(activity.iEngineClock, 100);
+                    break;
+                case PromMetric::MEMORY_CLOCK:
+                    out.appendScaled(activity.iMemoryClock, 100);
+                    break;
+                case PromMetric::VDDC:
+                    out.appendScaled(activity.iVddc, 1000);
+                    break;
+                case PromMetric::LOAD:
+                    out.appendInt(activity.iActivityPercent);
+                    break;
+                case PromMetric::TEMPERATURE:
+                    out.appendScaled(snapshot.temperature, 1000);
+                    break;
+                case PromMetric::FAN_SPEED:
+                    out.appendInt(snapshot.fanSpeed);
+                    break;
+                case PromMetric::POWER_CONTROL:
+                    out.appendInt(snapshot.powerControl);
+                    break;
+                case PromMetric::PERF_LEVEL:
+                    out.appendInt(activity.iCurrentPerformanceLevel);
+                    break;
+                case PromMetric::BUS_SPEED:
+                    out.appendInt(activity.iCurrentBusSpeed);
+                    break;
+                case PromMetric::BUS_LANES:
+                    out.appendInt(activity.iCurrentBusLanes);
+                    break;
+                default:
+                    break;
+            }
+            out.append('\n');
+        }
+    }
+    out.append("# HELP amdcovc_last_sample_timestamp_seconds "
+            "Time of last successful sampling.\n"
+            "# TYPE amdcovc_last_sample_timestamp_seconds gauge\n"
+            "amdcovc_last_sample_timestamp_seconds ");
+    out.appendScaled(lastSampleMs, 1000);
+    out.append("\n# HELP amdcovc_sample_errors_total Number of failed samplings.\n"
+            "# TYPE amdcovc_sample_errors_total counter\n"
+            "amdcovc_sample_errors_total ");
+    out.appendInt(sampleErrorsNum);
+    out.append('\n');
+}
+
+/* minimal HTTP server. Serves last published metrics, never calls ADL.
+ * All connections are handled by single thread with poll */
+class MetricsServer
+{
+private:
+    struct Connection
+    {
+        int fd;
+        time_t startTime;
+        std::string request;
+        std::string header;
+        std::shared_ptr<const std::string> body;
+        size_t sent;    // sent bytes of header and body
+    };
+    
+    int listenFd;
+    std::mutex metricsMutex;
+    std::shared_ptr<const std::string> metrics;
+    std::vector<Connection> connections;
+    
+    void acceptConnections();
+    bool readRequest(Connection& conn);
+    bool writeResponse(Connection& conn);
+public:
+    // address in form HOST:PORT (IPv4)
+    explicit MetricsServer(const char* address);
+    ~MetricsServer();
+    
+    // replace served metrics (called by sampler)
+    void publish(const std::string& content);
+    // serve requests until stop has been requested
+    void serve();
+};
+
+static const size_t maxMetricsConnections = 64;
+static const size_t maxMetricsRequestSize = 4096;
+static const int metricsConnectionTimeout = 10; // in seconds
+
+MetricsServer::MetricsServer(const char* address) : listenFd(-1),
+        metrics(std::make_shared<std::string>())
+{
+    const char* colon = ::strrchr(address, ':');
+    if (colon==nullptr)
+        throw Error("Exporter address must be in form HOST:PORT");
+    std::string host(address, colon);
+    if (host.empty())
+        host = "127.0.0.1";
+    char* endptr;
+    errno = 0;
+    const long port = strtol(colon+1, &endptr, 10);
+    if (errno!=0 || endptr==colon+1 || *endptr!=0 || port<=0 || port>65535)
+        throw Error("Can't parse exporter port");
+    sockaddr_in sockAddr;
+    ::memset(&sockAddr, 0, sizeof(sockAddr));
+    sockAddr.sin_family = AF_INET;
+    sockAddr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &sockAddr.sin_addr)!=1)
+        throw Error("Can't parse exporter host address");
+    
+    listenFd = socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if (listenFd==-1)
+        throw Error(errno, "Can't create socket");
+    const int reuse = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(listenFd, (const sockaddr*)&sockAddr, sizeof(sockAddr))!=0 ||
+        listen(listenFd, 16)!=0)
+    {
+        const int error = errno;
+        close(listenFd);
+        throw Error(error, "Can't listen on exporter address");
+    }
+}
+
+MetricsServer::~MetricsServer()
+{
+    for (const Connection& conn: connections)
+        close(conn.fd);
+    if (listenFd!=-1)
+        close(listenFd);
+}
+
+void MetricsServer::publish(const std::string& content)
+{
+    std::shared_ptr<const std::string> newMetrics = std::make_shared<std::string>(content);
+    std::lock_guard<std::mutex> lock(metricsMutex);
+    metrics.swap(newMetrics);
+}
+
+void MetricsServer::acceptConnections()
+{
+    while (true)
+    {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK|SOCK_CLOEXEC);
+        if (fd==-1)
+            return; // no more pending connections (or error)
+        if (connections.size() >= maxMetricsConnections)
+        {
+            close(fd);
+            continue;
+        }
+        connections.push_back(Connection{ fd, time(nullptr), std::string(),
+                    std::string(), nullptr, 0 });
+    }
+}
+
+// returns false if connection must be closed
+bool MetricsServer::readRequest(Connection& conn)
+{
+    char buf[1024];
+    const ssize_t readSize = read(conn.fd, buf, 1024);
+    if (readSize==0 || (readSize<0 && errno!=EAGAIN && errno!=EINTR))
+        return false;
+    if (readSize<0)
+        return true;
+    conn.request.append(buf, readSize);
+    if (conn.request.find("\r\n\r\n")==std::string::npos &&
+        conn.request.find("\n\n")==std::string::npos)
+        return conn.request.size() < maxMetricsRequestSize;
+    
+    const char* status = "200 OK";
+    if (conn.request.compare(0, 13, "GET /metrics ")==0 ||
+        conn.request.compare(0, 14, "GET /metrics?")==0)
+    {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        conn.body = metrics; // only reference to buffer is copied
+    }
+    else if (conn.request.compare(0, 4, "GET ")==0)
+    {
+        status = "404 Not Found";
+        conn.body = std::make_shared<std::string>("Metrics are at /metrics\n");
+    }
+    else
+    {
+        status = "405 Method Not Allowed";
+        conn.body = std::make_shared<std::string>();
+    }
+    char headerBuf[256];
+    snprintf(headerBuf, 256, "HTTP/1.0 %s\r\n"
+            "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+            "Content-Length: %zu\r\nConnection: close\r\n\r\n", status,
+            conn.body->size());
+    conn.header = headerBuf;
+    return writeResponse(conn);
+}
+
+// returns false if connection must be closed (also if response has been sent)
+bool MetricsServer::writeResponse(Connection& conn)
+{
+    const size_t totalSize = conn.header.size() + conn.body->size();
+    while (conn.sent < totalSize)
+    {
+        iovec iov[2];
+        int iovNum = 0;
+        if (conn.sent < conn.header.size())
+        {
+            iov[iovNum].iov_base = (void*)(conn.header.data() + conn.sent);
+            iov[iovNum++].iov_len = conn.header.size() - conn.sent;
+            iov[iovNum].iov_base = (void*)conn.body->data();
+            iov[iovNum++].iov_len = conn.body->size();
+        }
+        else
+        {
+            const size_t bodySent = conn.sent - conn.header.size();
+            iov[iovNum].iov_base = (void*)(conn.body->data() + bodySent);
+            iov[iovNum++].iov_len = conn.body->size() - bodySent;
+        }
+        msghdr msg;
+        ::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovNum;
+        // MSG_NOSIGNAL: closed connection must not kill program by SIGPIPE
+        const ssize_t written = sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+        if (written<0)
+            return errno==EAGAIN || errno==EINTR;
+        conn.sent += written;
+    }
+    return false;
+}
+
+void MetricsServer::serve()
+{
+    std::vector<pollfd> pollFds;
+    while (!stopRequested)
+    {
+        pollFds.clear();
+        pollFds.push_back(pollfd{ listenFd, POLLIN, 0 });
+        for (const Connection& conn: connections)
+            pollFds.push_back(pollfd{ conn.fd, short(conn.body ? POLLOUT : POLLIN), 0 });
+        pollFds.push_back(pollfd{ stopEventFd, POLLIN, 0 });
+        // timeout: check connection timeouts
+        const int ret = poll(pollFds.data(), pollFds.size(), 500);
+        if (ret<0)
+        {
+            if (errno==EINTR)
+                continue;
+            throw Error(errno, "poll error");
+        }
+        const time_t now = time(nullptr);
+        size_t kept = 0;
+        for (size_t i = 0; i < connections.size(); i++)
+        {
+            Connection& conn = connections[i];
+            bool keep = now - conn.startTime < metricsConnectionTimeout;
+            const short revents = pollFds[i+1].revents;
+            // hang up (both directions closed): response can not be sent
+            if (keep && (revents & (POLLERR|POLLHUP|POLLNVAL)))
+                keep = false;
+            else if (keep && (revents & POLLIN) && !conn.body)
+                keep = readRequest(conn);
+            else if (keep && (revents & POLLOUT) && conn.body)
+                keep = writeResponse(conn);
+            if (keep)
+                connections[kept++] = std::move(conn);
+            else
+                close(conn.fd);
+        }
+        connections.resize(kept);
+        if (pollFds[0].revents & POLLIN)
+            acceptConnections();
+    }
+}
+
+/* exporter: sampler thread queries adapters with single main control
+ * and publishes formatted metrics, main thread serves them.
+ * Samples are also passed to shared memory and history if they are given */
+static void runExporter(const ATIADLHandle& handle, const ADLMainControl& mainControl,
+            AdapterInfo* adapterInfos, const std::vector<int>& activeAdapters,
+            const std::vector<int>& choosenAdapters, bool useChoosen,
+            double interval, const char* address, const SampleSinks& sinks)
+{
+    MetricsServer server(address);
+    installStopHandlers();
+    std::exception_ptr samplerError;
+    std::thread sampler([&]()
+    {
+        try
+        {
+            std::vector<AdapterSnapshot> snapshots, newSnapshots;
+            ReportBuffer report;
+            long lastSampleMs = 0;
+            unsigned long sampleErrorsNum = 0;
+            PeriodicTimer timer(interval);
+            do {
+                try
+                {
+                    collectAdapterSnapshots(handle, mainControl, adapterInfos,
+                            activeAdapters, choosenAdapters, useChoosen, false, nullptr,
+                            newSnapshots);
+                    snapshots.swap(newSnapshots);
+                    lastSampleMs = getReportTime();
+                    sinks.publish(snapshots, lastSampleMs);
+                }
+                catch(const Error& error)
+                {
+                    // keep last successful snapshot
+                    std::cerr << "Sampling failed: " << error.what() << std::endl;
+                    sampleErrorsNum++;
+                }
+                report.clear();
+                if (lastSampleMs!=0)
+                    formatPrometheusMetrics(report, snapshots, lastSampleMs,
+                                sampleErrorsNum);
+                else
+                    formatPrometheusMetrics(report, std::vector<AdapterSnapshot>(),
+                                lastSampleMs, sampleErrorsNum);
+                server.publish(report.getContent());
+            } while (timer.wait());
+        }
+        catch(...)
+        {
+            samplerError = std::current_exception();
+            requestStop(); // stops server
+        }
+    });
+    try
+    { server.serve(); }
+    catch(...)
+    {
+        requestStop(); // wakes up sampler
+        sampler.join();
+        throw;
+    }
+    sampler.join(); // sampler has been woken up by stop event
+    if (samplerError)
+        std::rethrow_exception(samplerError);
+}
+
+/*
+ * Controllers (fan control and governors)
+ */
+
+struct ControlledAdapter
+{
+    int userIndex;
+    int adapterIndex;   // ADL adapter index
+};
+
+/* sample of controlled adapter, taken once per tick */
+struct ControlSample
+{
+    int temperature;    // in millidegrees
+    ADLPMActivity activity;
+    bool valid;         // false if adapter can not be sampled
+};
+
+/* controller changes settings of adapters from samples.
+ * restore() is called at exit, also after error */
+class AdapterController
+{
+public:
+    virtual ~AdapterController()
+    { }
+    // interval - time from previous update in seconds
+    virtual void update(const std::vector<ControlSample>& samples, double interval) = 0;
+    virtual void restore() = 0;
+};
+
+struct PIDParameters
+{
+    double kp;
+    double ki;
+    double kd;
+};
+
+/* PID controller of fan speed, one per adapter. Derivative is computed from
+ * temperature (not error) to avoid kicks. Anti-windup: integral is not
+ * accumulated while output is saturated in same direction and is kept in
+ * fan speed limits. Slew limit restricts change of fan speed per second */
+class FanController: public AdapterController
+{
+private:
+    struct State
+    {
+        int userIndex;
+        int adapterIndex;
+        int minFanSpeed;
+        int maxFanSpeed;
+        double integral;
+        double lastTemperature;
+        double output;
+        int fanSpeed;       // last written fan speed
+        bool manual;        // fan speed has been written (fan is in manual mode)
+        bool started;
+    };
+    const ADLMainControl& mainControl;
+    double targetTemperature;
+    PIDParameters pid;
+    double slewRate;        // in percents per second
+    bool verbose;
+    std::vector<State> states;
+    
+    void setFanSpeed(State& state, int fanSpeed);
+public:
+    FanController(const ADLMainControl& mainControl,
+            const std::vector<ControlledAdapter>& adapters, double targetTemperature,
+            const PIDParameters& pid, double slewRate, bool verbose);
+    void update(const std::vector<ControlSample>& samples, double interval);
+    void restore();
+};
+
+FanController::FanController(const ADLMainControl& _mainControl,
+            const std::vector<ControlledAdapter>& adapters, double _targetTemperature,
+            const PIDParameters& _pid, double _slewRate, bool _verbose)
+        : mainControl(_mainControl), targetTemperature(_targetTemperature), pid(_pid),
+          slewRate(_slewRate), verbose(_verbose), states(adapters.size())
+{
+    for (size_t k = 0; k < adapters.size(); k++)
+    {
+        State& state = states[k];
+        state.userIndex = adapters[k].userIndex;
+        state.adapterIndex = adapters[k].adapterIndex;
+        ADLFanSpeedInfo info;
+        mainControl.getFanSpeedInfo(state.adapterIndex, 0, info);
+        state.minFanSpeed = std::max(0, info.iMinPercent);
+        state.maxFanSpeed = (info.iMaxPercent > 0) ?
+                std::min(100, info.iMaxPercent) : 100;
+        // minimal RPM converted to percents
+        if ((info.iFlags & ADL_DL_FANCTRL_SUPPORTS_RPM_READ)!=0 && info.iMaxRPM > 0 &&
+            info.iMinRPM > 0)
+            state.minFanSpeed = std::max(state.minFanSpeed,
+                    (info.iMinRPM*100 + info.iMaxRPM-1) / info.iMaxRPM);
+        state.minFanSpeed = std::min(state.minFanSpeed, state.maxFanSpeed);
+        // start from current fan speed
+        state.fanSpeed = mainControl.getFanSpeed(state.adapterIndex, 0);
+        state.output = state.fanSpeed;
+        state.integral = std::max(double(state.minFanSpeed),
+                    std::min(double(state.maxFanSpeed), state.output));
+        state.lastTemperature = 0.0;
+        state.manual = false;
+        state.started = false;
+    }
+}
+
+void FanController::setFanSpeed(State& state, int fanSpeed)
+{
+    // first write switches fan to manual mode, also if speed is not changed
+    if (state.manual && fanSpeed==state.fanSpeed)
+        return;
+    mainControl.setFanSpeed(state.adapterIndex, 0, fanSpeed);
+    state.fanSpeed = fanSpeed;
+    state.manual = true;
+}
+
+void FanController::update(const std::vector<ControlSample>& samples, double interval)
+{
+    for (size_t k = 0; k < states.size(); k++)
+    {
+        State& state = states[k];
+        if (!samples[k].valid)
+        {
+            // temperature is unknown: fail safe
+            state.output = state.integral = state.maxFanSpeed;
+            setFanSpeed(state, state.maxFanSpeed);
+            continue;
+        }
+        const double temperature = samples[k].temperature/1000.0;
+        const double error = temperature - targetTemperature;
+        const double derivative = (state.started && interval > 0.0) ?
+                (temperature - state.lastTemperature) / interval : 0.0;
+        double integral = state.integral + pid.ki*error*interval;
+        double output = pid.kp*error + integral + pid.kd*derivative;
+        if (output > state.maxFanSpeed)
+        {
+            output = state.maxFanSpeed;
+            if (error > 0.0)
+                integral = state.integral;
+        }
+        else if (output < state.minFanSpeed)
+        {
+            output = state.minFanSpeed;
+            if (error < 0.0)
+                integral = state.integral;
+        }
+        state.integral = std::max(double(state.minFanSpeed),
+                    std::min(double(state.maxFanSpeed), integral));
+        // slew limit
+        const double maxStep = slewRate*interval;
+        output = std::max(state.output - maxStep, std::min(state.output + maxStep, output));
+        state.output = output;
+        state.lastTemperature = temperature;
+        state.started = true;
+        setFanSpeed(state, int(round(output)));
+        if (verbose)
+            std::cout << "Adapter " << state.userIndex << ": Temp: " << temperature <<
+                    " C, Fan: " << state.fanSpeed << "%" << std::endl;
+    }
+}
+
+void FanController::restore()
+{
+    for (const State& state: states)
+        mainControl.setFanSpeedToDefault(state.adapterIndex, 0);
+}
+
+/* performance levels of controlled adapters shared by governors. Governors
+ * change levels and mark them, changed levels are written once per tick
+ * (this controller must be last). Original levels are restored at exit */
+class PerfLevelsControl: public AdapterController
+{
+private:
+    struct State
     {
-        allAdapters = true;
+        int adapterIndex;
+        ADLODParameters odParams;
+        std::vector<ADLODPerformanceLevel> originalLevels;
+        std::vector<ADLODPerformanceLevel> levels;
+        bool changed;
+    };
+    const ADLMainControl& mainControl;
+    std::vector<State> states;
+public:
+    PerfLevelsControl(const ADLMainControl& mainControl,
+            const std::vector<ControlledAdapter>& adapters);
+    
+    const ADLODParameters& getODParameters(size_t k) const
+    { return states[k].odParams; }
+    const std::vector<ADLODPerformanceLevel>& getOriginalLevels(size_t k) const
+    { return states[k].originalLevels; }
+    const ADLODPerformanceLevel& getTopLevel(size_t k) const
+    { return states[k].levels.back(); }
+    // change top level, it will be written at end of tick
+    ADLODPerformanceLevel& changeTopLevel(size_t k)
+    {
+        states[k].changed = true;
+        return states[k].levels.back();
+    }
+    
+    void update(const std::vector<ControlSample>& samples, double interval);
+    void restore();
+};
+
+PerfLevelsControl::PerfLevelsControl(const ADLMainControl& _mainControl,
+            const std::vector<ControlledAdapter>& adapters)
+        : mainControl(_mainControl), states(adapters.size())
+{
+    for (size_t k = 0; k < adapters.size(); k++)
+    {
+        State& state = states[k];
+        state.adapterIndex = adapters[k].adapterIndex;
+        mainControl.getODParameters(state.adapterIndex, state.odParams);
+        const int levelsNum = state.odParams.iNumberOfPerformanceLevels;
+        state.originalLevels.resize(levelsNum);
+        mainControl.getODPerformanceLevels(state.adapterIndex, false, levelsNum,
+                    state.originalLevels.data());
+        state.levels = state.originalLevels;
+        state.changed = false;
+    }
+}
+
+void PerfLevelsControl::update(const std::vector<ControlSample>& samples,
+            double interval)
+{
+    for (State& state: states)
+        if (state.changed)
+        {
+            mainControl.setODPerformanceLevels(state.adapterIndex, state.levels.size(),
+                        state.levels.data());
+            state.changed = false;
+        }
+}
+
+void PerfLevelsControl::restore()
+{
+    for (State& state: states)
+    {
+        const ADLODPerformanceLevel& top = state.levels.back();
+        const ADLODPerformanceLevel& origTop = state.originalLevels.back();
+        if (top.iEngineClock!=origTop.iEngineClock ||
+            top.iMemoryClock!=origTop.iMemoryClock || top.iVddc!=origTop.iVddc)
+        {
+            state.levels = state.originalLevels;
+            mainControl.setODPerformanceLevels(state.adapterIndex, state.levels.size(),
+                        state.levels.data());
+        }
+    }
+}
+
+/* thermal governor: lowers engine clock of top performance level by steps if
+ * temperature is above limit while adapter is working at top level, and raises
+ * it back if temperature falls below limit minus hysteresis. Writes are limited
+ * by minimal interval between writes */
+class ThermalGovernor: public AdapterController
+{
+private:
+    struct State
+    {
+        int userIndex;
+        int minClock;
+        int clockStep;
+        double sinceWrite;  // time from last write in seconds
+    };
+    PerfLevelsControl& perfLevels;
+    int limitTemperature;       // in millidegrees
+    int hysteresis;             // in millidegrees
+    double writeInterval;
+    bool verbose;
+    std::vector<State> states;
+public:
+    /* stepClock - step in 10 kHz (0 - 1% of clock), maxTrim - maximal trim
+     * of top level clock in percents */
+    ThermalGovernor(PerfLevelsControl& perfLevels,
+            const std::vector<ControlledAdapter>& adapters, double limitTemperature,
+            double hysteresis, int stepClock, double maxTrim, double writeInterval,
+            bool verbose);
+    void update(const std::vector<ControlSample>& samples, double interval);
+    // levels are restored by PerfLevelsControl
+    void restore()
+    { }
+};
+
+ThermalGovernor::ThermalGovernor(PerfLevelsControl& _perfLevels,
+            const std::vector<ControlledAdapter>& adapters, double _limitTemperature,
+            double _hysteresis, int stepClock, double maxTrim, double _writeInterval,
+            bool _verbose)
+        : perfLevels(_perfLevels), limitTemperature(lround(_limitTemperature*1000.0)),
+          hysteresis(lround(_hysteresis*1000.0)), writeInterval(_writeInterval),
+          verbose(_verbose), states(adapters.size())
+{
+    for (size_t k = 0; k < adapters.size(); k++)
+    {
+        State& state = states[k];
+        state.userIndex = adapters[k].userIndex;
+        const ADLODParameterRange& range = perfLevels.getODParameters(k).sEngineClock;
+        const int clockStep = std::max(1, range.iStep);
+        const int topClock = perfLevels.getOriginalLevels(k).back().iEngineClock;
+        // steps are aligned to OD clock step
+        state.clockStep = (stepClock!=0) ? stepClock : topClock/100;
+        state.clockStep = std::max(clockStep, state.clockStep/clockStep*clockStep);
+        state.minClock = std::max(range.iMin, int(topClock*(1.0-maxTrim/100.0)));
+        state.minClock = std::min(topClock, state.minClock);
+        state.sinceWrite = writeInterval;
+    }
+}
+
+void ThermalGovernor::update(const std::vector<ControlSample>& samples, double interval)
+{
+    for (size_t k = 0; k < states.size(); k++)
+    {
+        State& state = states[k];
+        state.sinceWrite += interval;
+        if (!samples[k].valid || state.sinceWrite < writeInterval)
+            continue;
+        const ControlSample& sample = samples[k];
+        const int levelsNum = perfLevels.getOriginalLevels(k).size();
+        const int clock = perfLevels.getTopLevel(k).iEngineClock;
+        const int topClock = perfLevels.getOriginalLevels(k).back().iEngineClock;
+        int newClock = clock;
+        // trim only if adapter works at top level (heat is from this clock)
+        if (sample.temperature > limitTemperature &&
+            sample.activity.iCurrentPerformanceLevel==levelsNum-1)
+            newClock = std::max(state.minClock, clock - state.clockStep);
+        else if (sample.temperature < limitTemperature - hysteresis)
+            newClock = std::min(topClock, clock + state.clockStep);
+        if (newClock==clock)
+            continue;
+        perfLevels.changeTopLevel(k).iEngineClock = newClock;
+        state.sinceWrite = 0.0;
+        if (verbose)
+            std::cout << "Adapter " << state.userIndex << ": Temp: " <<
+                    sample.temperature/1000.0 << " C, CoreClock: " << newClock/100.0 <<
+                    " MHz" << std::endl;
+    }
+}
+
+/* memory clock governor: lowers memory clock of top performance level to idle
+ * clock if load is low for some time, and restores it at first sample with higher
+ * load. Every transition is single change of performance levels */
+class MemoryClockGovernor: public AdapterController
+{
+private:
+    struct State
+    {
+        int userIndex;
+        int idleClock;
+        double lowLoadTime;
+        bool idle;
+    };
+    PerfLevelsControl& perfLevels;
+    int idleLoad;
+    double idleTime;
+    bool verbose;
+    std::vector<State> states;
+public:
+    // idleClock in 10 kHz
+    MemoryClockGovernor(PerfLevelsControl& perfLevels,
+            const std::vector<ControlledAdapter>& adapters, int idleClock, int idleLoad,
+            double idleTime, bool verbose);
+    void update(const std::vector<ControlSample>& samples, double interval);
+    // levels are restored by PerfLevelsControl
+    void restore()
+    { }
+};
+
+MemoryClockGovernor::MemoryClockGovernor(PerfLevelsControl& _perfLevels,
+            const std::vector<ControlledAdapter>& adapters, int idleClock,
+            int _idleLoad, double _idleTime, bool _verbose)
+        : perfLevels(_perfLevels), idleLoad(_idleLoad), idleTime(_idleTime),
+          verbose(_verbose), states(adapters.size())
+{
+    for (size_t k = 0; k < adapters.size(); k++)
+    {
+        State& state = states[k];
+        state.userIndex = adapters[k].userIndex;
+        const ADLODParameterRange& range = perfLevels.getODParameters(k).sMemoryClock;
+        // idle clock is in OD range and not higher than original clock
+        state.idleClock = std::min(perfLevels.getOriginalLevels(k).back().iMemoryClock,
+                    std::max(range.iMin, idleClock));
+        state.lowLoadTime = 0.0;
+        state.idle = false;
+    }
+}
+
+void MemoryClockGovernor::update(const std::vector<ControlSample>& samples,
+            double interval)
+{
+    for (size_t k = 0; k < states.size(); k++)
+    {
+        State& state = states[k];
+        const ControlSample& sample = samples[k];
+        if (!sample.valid)
+            continue;
+        if (sample.activity.iActivityPercent < idleLoad)
+        {
+            state.lowLoadTime += interval;
+            if (state.idle || state.lowLoadTime < idleTime)
+                continue;
+            perfLevels.changeTopLevel(k).iMemoryClock = state.idleClock;
+            state.idle = true;
+        }
+        else
+        {
+            state.lowLoadTime = 0.0;
+            if (!state.idle)
+                continue;
+            perfLevels.changeTopLevel(k).iMemoryClock =
+                    perfLevels.getOriginalLevels(k).back().iMemoryClock;
+            state.idle = false;
+        }
+        if (verbose)
+            std::cout << "Adapter " << state.userIndex << ": Load: " <<
+                    sample.activity.iActivityPercent << "%, MemClock: " <<
+                    perfLevels.getTopLevel(k).iMemoryClock/100.0 << " MHz" << std::endl;
+    }
+}
+
+/* estimated power of adapter: idle power plus dynamic power proportional to
+ * Vddc^2, clock and load */
+struct PowerModel
+{
+    double idlePower;       // in Watts
+    double coefficient;     // in Watts per V^2*GHz
+    
+    // vddc in mV, clock in 10 kHz, load in percents
+    double dynamicPower(int vddc, int clock, double load) const
+    { return coefficient*(vddc*1e-3)*(vddc*1e-3)*(clock*1e-5)*(load/100.0); }
+};
+
+/* power budget scheduler: every tick estimates power needed by adapters at their
+ * original clocks (with their current load) and if sum exceeds budget, divides
+ * budget: every adapter gets power of minimal clock, rest is given to adapters
+ * with best throughput per Watt (lowest Vddc) first. Top level core clocks and
+ * PowerControl values are set from divided budget */
+class PowerBudgetScheduler: public AdapterController
+{
+private:
+    struct State
+    {
+        int userIndex;
+        int adapterIndex;
+        int minClock;
+        int clockStep;
+        bool powerControlSupported;
+        int originalPowerControl;
+        int powerControl;
+        ADLPowerControlInfo powerControlInfo;
+    };
+    const ADLMainControl& mainControl;
+    PerfLevelsControl& perfLevels;
+    double budget;
+    PowerModel model;
+    double tick;
+    double sinceTick;
+    bool verbose;
+    std::vector<State> states;
+    
+    void setPowerControl(State& state, int value);
+public:
+    PowerBudgetScheduler(const ADLMainControl& mainControl, PerfLevelsControl& perfLevels,
+            const std::vector<ControlledAdapter>& adapters, double budget,
+            const PowerModel& model, double tick, bool verbose);
+    void update(const std::vector<ControlSample>& samples, double interval);
+    void restore();
+};
+
+PowerBudgetScheduler::PowerBudgetScheduler(const ADLMainControl& _mainControl,
+            PerfLevelsControl& _perfLevels, const std::vector<ControlledAdapter>& adapters,
+            double _budget, const PowerModel& _model, double _tick, bool _verbose)
+        : mainControl(_mainControl), perfLevels(_perfLevels), budget(_budget),
+          model(_model), tick(_tick), sinceTick(_tick), verbose(_verbose),
+          states(adapters.size())
+{
+    const bool powerControlSupported = mainControl.isPowerControlSupported();
+    for (size_t k = 0; k < adapters.size(); k++)
+    {
+        State& state = states[k];
+        state.userIndex = adapters[k].userIndex;
+        state.adapterIndex = adapters[k].adapterIndex;
+        const ADLODParameterRange& range = perfLevels.getODParameters(k).sEngineClock;
+        state.clockStep = std::max(1, range.iStep);
+        state.minClock = std::min(range.iMin,
+                    perfLevels.getOriginalLevels(k).back().iEngineClock);
+        state.powerControlSupported = false;
+        state.originalPowerControl = state.powerControl = 0;
+        if (powerControlSupported)
+        {
+            try
+            {
+                int defaultValue;
+                mainControl.getPowerControlInfo(state.adapterIndex,
+                            state.powerControlInfo);
+                mainControl.getPowerControl(state.adapterIndex,
+                            state.originalPowerControl, defaultValue);
+                state.powerControl = state.originalPowerControl;
+                state.powerControlSupported = true;
+            }
+            catch(const Error& error)
+            {
+                if (error.getCode()!=ADL_ERR_NOT_SUPPORTED)
+                    throw;
+            }
+        }
+    }
+}
+
+void PowerBudgetScheduler::setPowerControl(State& state, int value)
+{
+    if (!state.powerControlSupported || value==state.powerControl)
+        return;
+    mainControl.setPowerControl(state.adapterIndex, value);
+    state.powerControl = value;
+}
+
+void PowerBudgetScheduler::update(const std::vector<ControlSample>& samples,
+            double interval)
+{
+    sinceTick += interval;
+    if (sinceTick < tick)
         return;
+    sinceTick = 0.0;
+    const size_t adaptersNum = states.size();
+    std::vector<double> minPowers(adaptersNum), needPowers(adaptersNum);
+    std::vector<double> loads(adaptersNum);
+    double available = budget;
+    double neededSum = 0.0;
+    for (size_t k = 0; k < adaptersNum; k++)
+    {
+        const ADLODPerformanceLevel& top = perfLevels.getOriginalLevels(k).back();
+        // unknown load is treated as full load
+        loads[k] = samples[k].valid ?
+                std::max(1, samples[k].activity.iActivityPercent) : 100.0;
+        minPowers[k] = model.dynamicPower(top.iVddc, states[k].minClock, loads[k]);
+        needPowers[k] = model.dynamicPower(top.iVddc, top.iEngineClock, loads[k]);
+        available -= model.idlePower + minPowers[k];
+        neededSum += needPowers[k] - minPowers[k];
+    }
+    std::vector<double> powers(minPowers);
+    if (available >= neededSum)
+        powers = needPowers;
+    else if (available > 0.0)
+    {
+        // most efficient adapters (lowest Vddc) first
+        std::vector<size_t> order(adaptersNum);
+        for (size_t k = 0; k < adaptersNum; k++)
+            order[k] = k;
+        std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b)
+                { return perfLevels.getOriginalLevels(a).back().iVddc <
+                        perfLevels.getOriginalLevels(b).back().iVddc; });
+        for (size_t k: order)
+        {
+            const double extra = std::min(available, needPowers[k]-minPowers[k]);
+            powers[k] += extra;
+            available -= extra;
+        }
+    }
+    else if (verbose)
+        std::cout << "Power budget is too low for minimal clocks" << std::endl;
+    
+    for (size_t k = 0; k < adaptersNum; k++)
+    {
+        State& state = states[k];
+        const ADLODPerformanceLevel& top = perfLevels.getOriginalLevels(k).back();
+        // clock from power (dynamic power is linear in clock), aligned to step
+        int clock = top.iEngineClock;
+        if (powers[k] < needPowers[k])
+        {
+            clock = int(top.iEngineClock*(powers[k]/needPowers[k]));
+            clock = std::max(state.minClock, clock/state.clockStep*state.clockStep);
+        }
+        if (clock!=perfLevels.getTopLevel(k).iEngineClock)
+            perfLevels.changeTopLevel(k).iEngineClock = clock;
+        /* PowerControl: original value if adapter gets all needed power, otherwise
+         * lowered by ratio of divided power to power at full load */
+        int powerControl = state.originalPowerControl;
+        if (state.powerControlSupported && powers[k] < needPowers[k])
+        {
+            const double fullPower = model.idlePower +
+                    model.dynamicPower(top.iVddc, top.iEngineClock, 100.0);
+            const ADLPowerControlInfo& info = state.powerControlInfo;
+            const int step = std::max(1, info.iStepValue);
+            powerControl = int(floor(100.0*(model.idlePower + powers[k]) / fullPower -
+                        100.0));
+            powerControl = std::min(state.originalPowerControl, powerControl);
+            powerControl = std::max(info.iMinValue, std::min(info.iMaxValue,
+                        powerControl/step*step));
+        }
+        setPowerControl(state, powerControl);
+        if (!verbose)
+            continue;
+        std::cout << "Adapter " << state.userIndex << ": Load: " << loads[k] <<
+                "%, Power: " << round(model.idlePower + powers[k]) << " W, "
+                "CoreClock: " << clock/100.0 << " MHz, ";
+        if (state.powerControlSupported)
+            std::cout << "PowerControl: " << state.powerControl << "%" << std::endl;
+        else
+            std::cout << "PowerControl: N/A" << std::endl;
+    }
+}
+
+void PowerBudgetScheduler::restore()
+{
+    // performance levels are restored by PerfLevelsControl
+    for (State& state: states)
+        setPowerControl(state, state.originalPowerControl);
+}
+
+/* run controllers every interval until stop has been requested. Settings
+ * are restored by controllers also if error occurred */
+static void runControllers(const ADLMainControl& mainControl,
+            const std::vector<ControlledAdapter>& adapters, double interval,
+            std::vector<std::unique_ptr<AdapterController> >& controllers)
+{
+    installStopHandlers();
+    std::exception_ptr error;
+    try
+    {
+        std::vector<ControlSample> samples(adapters.size());
+        PeriodicTimer timer(interval);
+        timespec last;
+        clock_gettime(CLOCK_MONOTONIC, &last);
+        double elapsed = 0.0;
+        do {
+            for (size_t k = 0; k < adapters.size(); k++)
+            {
+                ControlSample& sample = samples[k];
+                try
+                {
+                    sample.temperature = mainControl.getTemperature(
+                                adapters[k].adapterIndex, 0);
+                    mainControl.getCurrentActivity(adapters[k].adapterIndex,
+                                sample.activity);
+                    sample.valid = true;
+                }
+                catch(const Error& error)
+                {
+                    std::cerr << "Can't sample adapter " << adapters[k].userIndex <<
+                            ": " << error.what() << std::endl;
+                    sample.valid = false;
+                }
+            }
+            for (std::unique_ptr<AdapterController>& controller: controllers)
+                controller->update(samples, elapsed);
+            const bool next = timer.wait();
+            timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            elapsed = (timespecToNs(now) - timespecToNs(last))*1e-9;
+            last = now;
+            if (!next)
+                break;
+        } while (true);
     }
+    catch(...)
+    { error = std::current_exception(); }
+    // restore in reverse order
+    for (auto it = controllers.rbegin(); it != controllers.rend(); ++it)
+        try
+        { (*it)->restore(); }
+        catch(const Error& restoreError)
+        { std::cerr << "Can't restore settings: " << restoreError.what() << std::endl; }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+/* parse number of option in range [minValue, maxValue] */
+static double parseOptionNumber(const char* string, double minValue, double maxValue,
+            const char* what)
+{
+    char* endptr;
+    errno = 0;
+    double value = strtod(string, &endptr);
+    if (errno!=0 || endptr==string || *endptr!=0)
+        throw Error((std::string("Can't parse ") + what).c_str());
+    if (value < minValue || value > maxValue)
+        throw Error((std::string("Value of ") + what + " out of range").c_str());
+    return value;
+}
+
+/* parse comma-separated list of numbers */
+static void parseNumberList(const char* string, std::vector<double>& values)
+{
+    values.clear();
     while (true)
     {
         char* endptr;
         errno = 0;
-        int adapterIndex = strtol(string, &endptr, 10);
+        double value = strtod(string, &endptr);
         if (errno!=0 || endptr==string)
-            throw Error("Can't parse adapter index");
-        
+            throw Error("Can't parse number");
+        values.push_back(value);
         string = endptr;
-        if (*string == '-')
-        {   // if range
+        if (*string==0)
+            break;
+        if (*string==',')
             string++;
+        else
+            throw Error("Garbages at number list");
+    }
+}
+
+/*
+ * Tuning
+ */
+
+enum TuneDimension
+{
+    TUNE_CORE_CLOCK = 0,
+    TUNE_MEMORY_CLOCK,
+    TUNE_VDDC,
+    TUNE_DIMENSIONS_NUM
+};
+
+static const char* tuneDimensionNames[TUNE_DIMENSIONS_NUM] =
+{ "coreclk", "memclk", "vcore" };
+
+struct TuneOptions
+{
+    std::string evalCommand;
+    bool dimensions[TUNE_DIMENSIONS_NUM];
+    int maxEvals;
+    PowerModel powerModel;
+};
+
+/* run evaluation command for adapter, returns throughput (last number printed by
+ * command) or negative value if command failed. Adapter index is passed in
+ * command line (not by setenv), so command can be run from many threads */
+static double runEvaluationCommand(const std::string& command, int userIndex)
+{
+    char buf[64];
+    snprintf(buf, 64, "AMDCOVC_ADAPTER=%d; export AMDCOVC_ADAPTER; ", userIndex);
+    const std::string shellCommand = buf + command;
+    std::cout.flush();
+    FILE* pipe = popen(shellCommand.c_str(), "r");
+    if (pipe==nullptr)
+        throw Error(errno, "Can't run evaluation command");
+    std::string output;
+    char readBuf[256];
+    size_t readSize;
+    while ((readSize = fread(readBuf, 1, 256, pipe)) != 0)
+        output.append(readBuf, readSize);
+    const int status = pclose(pipe);
+    if (status==-1 || !WIFEXITED(status) || WEXITSTATUS(status)!=0)
+        return -1.0;
+    // find last finite number in output ('inf' or 'nan' in words are skipped)
+    double throughput = -1.0;
+    const char* p = output.c_str();
+    while (*p!=0)
+    {
+        if (!::isdigit((unsigned char)*p) && *p!='-' && *p!='+' && *p!='.')
+        {
+            p++;
+            continue;
+        }
+        char* endptr;
+        const double value = strtod(p, &endptr);
+        if (endptr!=p)
+        {
+            if (std::isfinite(value))
+                throughput = value;
+            p = endptr;
+        }
+        else
+            p++;
+    }
+    return throughput;
+}
+
+typedef int TunePoint[TUNE_DIMENSIONS_NUM];
+
+/* hill-climbing search for adapter: in every pass tries one step up and down
+ * in every dimension and moves to better point. If no better point is found,
+ * steps are halved (until OD step). Score is throughput per estimated Watt.
+ * After failed evaluation default performance levels are set. Original levels
+ * are restored after tuning */
+static bool tuneAdapter(const ADLMainControl& mainControl, int userIndex,
+            int adapterIndex, const TuneOptions& options, TunePoint& bestPoint,
+            double& bestScore)
+{
+    ADLODParameters odParams;
+    mainControl.getODParameters(adapterIndex, odParams);
+    const int levelsNum = odParams.iNumberOfPerformanceLevels;
+    std::vector<ADLODPerformanceLevel> originalLevels(levelsNum);
+    std::vector<ADLODPerformanceLevel> defaultLevels(levelsNum);
+    mainControl.getODPerformanceLevels(adapterIndex, false, levelsNum,
+                originalLevels.data());
+    mainControl.getODPerformanceLevels(adapterIndex, true, levelsNum,
+                defaultLevels.data());
+    const ADLODParameterRange ranges[TUNE_DIMENSIONS_NUM] =
+    { odParams.sEngineClock, odParams.sMemoryClock, odParams.sVddc };
+    
+    int steps[TUNE_DIMENSIONS_NUM];
+    int minSteps[TUNE_DIMENSIONS_NUM];
+    for (int d = 0; d < TUNE_DIMENSIONS_NUM; d++)
+    {
+        minSteps[d] = std::max(1, ranges[d].iStep);
+        // initial step: 1/16 of range
+        steps[d] = std::max(minSteps[d],
+                    (ranges[d].iMax-ranges[d].iMin)/16/minSteps[d]*minSteps[d]);
+    }
+    
+    int evalsNum = 0;
+    auto evaluate = [&](const TunePoint& point) -> double
+    {
+        std::vector<ADLODPerformanceLevel> levels(originalLevels);
+        levels.back().iEngineClock = point[TUNE_CORE_CLOCK];
+        levels.back().iMemoryClock = point[TUNE_MEMORY_CLOCK];
+        levels.back().iVddc = point[TUNE_VDDC];
+        evalsNum++;
+        double throughput = -1.0;
+        try
+        {
+            mainControl.setODPerformanceLevels(adapterIndex, levelsNum, levels.data());
+            throughput = runEvaluationCommand(options.evalCommand, userIndex);
+        }
+        catch(const Error& error)
+        { std::cerr << "Can't set performance levels: " << error.what() << std::endl; }
+        std::cerr << "Adapter " << userIndex << ": Core: " <<
+                point[TUNE_CORE_CLOCK]/100.0 << " MHz, Mem: " <<
+                point[TUNE_MEMORY_CLOCK]/100.0 << " MHz, Vddc: " <<
+                point[TUNE_VDDC]/1000.0 << " V: ";
+        if (throughput <= 0.0)
+        {
+            std::cerr << "failed" << std::endl;
+            // roll back to safe settings
+            mainControl.setODPerformanceLevels(adapterIndex, levelsNum,
+                        defaultLevels.data());
+            return -1.0;
+        }
+        const double power = options.powerModel.idlePower +
+                options.powerModel.dynamicPower(point[TUNE_VDDC],
+                        point[TUNE_CORE_CLOCK], 100.0);
+        std::cerr << "throughput " << throughput << ", power " << round(power) <<
+                " W, score " << throughput/power << std::endl;
+        return throughput/power;
+    };
+    
+    try
+    {
+        const ADLODPerformanceLevel& top = originalLevels.back();
+        bestPoint[TUNE_CORE_CLOCK] = top.iEngineClock;
+        bestPoint[TUNE_MEMORY_CLOCK] = top.iMemoryClock;
+        bestPoint[TUNE_VDDC] = top.iVddc;
+        bestScore = evaluate(bestPoint);
+        while (bestScore > 0.0 && evalsNum < options.maxEvals && !stopRequested)
+        {
+            // single pass through all dimensions
+            bool improved = false;
+            for (int d = 0; d < TUNE_DIMENSIONS_NUM; d++)
+            {
+                if (!options.dimensions[d])
+                    continue;
+                bool dimImproved = false;
+                for (int dir = 1; !dimImproved && dir >= -1; dir -= 2)
+                {
+                    if (evalsNum >= options.maxEvals || stopRequested)
+                        break;
+                    TunePoint point;
+                    std::copy(bestPoint, bestPoint+TUNE_DIMENSIONS_NUM, point);
+                    point[d] = std::max(ranges[d].iMin, std::min(ranges[d].iMax,
+                                point[d] + dir*steps[d]));
+                    if (point[d]==bestPoint[d])
+                        continue;
+                    const double score = evaluate(point);
+                    if (score > bestScore)
+                    {
+                        std::copy(point, point+TUNE_DIMENSIONS_NUM, bestPoint);
+                        bestScore = score;
+                        dimImproved = improved = true;
+                    }
+                }
+            }
+            if (improved)
+                continue;
+            // halve steps
+            bool stepsChanged = false;
+            for (int d = 0; d < TUNE_DIMENSIONS_NUM; d++)
+                if (options.dimensions[d] && steps[d] > minSteps[d])
+                {
+                    steps[d] = std::max(minSteps[d], steps[d]/2/minSteps[d]*minSteps[d]);
+                    stepsChanged = true;
+                }
+            if (!stepsChanged)
+                break;
+        }
+    }
+    catch(...)
+    {
+        mainControl.setODPerformanceLevels(adapterIndex, levelsNum,
+                    originalLevels.data());
+        throw;
+    }
+    mainControl.setODPerformanceLevels(adapterIndex, levelsNum, originalLevels.data());
+    return bestScore > 0.0;
+}
+
+static const char* tuneHelpString =
+"Usage: amdcovc tune --eval=COMMAND [-a LIST|--adapters=LIST] [--tune=LIST]\n"
+"               [--max-evals=N] [--power-model=IDLE,COEFF]\n"
+"Search best core clock, memory clock and Vddc of top performance level.\n"
+"COMMAND is run by shell for every tried setting and it must print throughput\n"
+"(last number of output). Adapter index is in AMDCOVC_ADAPTER variable.\n"
+"Score is throughput per estimated Watt. Best settings are printed as parameters.\n"
+"\n"
+"List of options:\n"
+"  -a, --adapters=LIST       adapters (default is all)\n"
+"      --eval=COMMAND        evaluation command\n"
+"      --tune=LIST           tuned parameters: coreclk, memclk, vcore\n"
+"                            (default is all)\n"
+"      --max-evals=N         maximal number of evaluations per adapter (default 40)\n"
+"      --power-model=IDLE,COEFF  estimated power: IDLE + COEFF*Vddc^2*clock\n"
+"                            in Watts, Volts and GHz (default 20,110)\n";
+
+/* 'amdcovc tune' subcommand */
+static int runTune(int argc, const char** argv)
+{
+    AdaptersOption adaptersOption;
+    TuneOptions options;
+    std::fill(options.dimensions, options.dimensions+TUNE_DIMENSIONS_NUM, true);
+    options.maxEvals = 40;
+    options.powerModel = PowerModel{ 20.0, 110.0 };
+    bool evalSet = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (::strcmp(argv[i], "--help")==0 || ::strcmp(argv[i], "-?")==0)
+        {
+            std::cout << tuneHelpString;
+            std::cout.flush();
+            return 0;
+        }
+        else if (adaptersOption.parse(argc, argv, i))
+            continue;
+        else if (::strncmp(argv[i], "--eval=", 7)==0)
+        {
+            options.evalCommand = argv[i]+7;
+            evalSet = true;
+        }
+        else if (::strncmp(argv[i], "--tune=", 7)==0)
+        {
+            std::fill(options.dimensions, options.dimensions+TUNE_DIMENSIONS_NUM, false);
+            const char* string = argv[i]+7;
+            while (true)
+            {
+                const char* end = ::strchr(string, ',');
+                const std::string name = (end!=nullptr) ? std::string(string, end) :
+                        std::string(string);
+                int d = 0;
+                while (d < TUNE_DIMENSIONS_NUM && name!=tuneDimensionNames[d])
+                    d++;
+                if (d==TUNE_DIMENSIONS_NUM)
+                    throw Error(("Unknown tuned parameter: '" + name + "'").c_str());
+                options.dimensions[d] = true;
+                if (end==nullptr)
+                    break;
+                string = end+1;
+            }
+        }
+        else if (::strncmp(argv[i], "--max-evals=", 12)==0)
+            options.maxEvals = lround(parseOptionNumber(argv[i]+12, 1.0, 10000.0,
+                        "maximal number of evaluations"));
+        else if (::strncmp(argv[i], "--power-model=", 14)==0)
+        {
+            std::vector<double> values;
+            parseNumberList(argv[i]+14, values);
+            if (values.size()!=2)
+                throw Error("Power model must be IDLE,COEFF");
+            if (values[0] < 0.0 || values[1] <= 0.0)
+                throw Error("Wrong power model parameters");
+            options.powerModel = PowerModel{ values[0], values[1] };
+        }
+        else
+            throw Error((std::string("Unknown tune option: '") + argv[i] + "'").c_str());
+    }
+    if (!evalSet)
+        throw Error("Evaluation command not supplied");
+    
+    ADLAdapters adl;
+    const std::vector<int>& activeAdapters = adl.activeAdapters;
+    adaptersOption.checkRange(activeAdapters.size());
+    
+    // settings are restored on SIGINT, SIGTERM, SIGHUP and SIGQUIT
+    installStopHandlers();
+    for (int k = 0; k < int(activeAdapters.size()) && !stopRequested; k++)
+    {
+        if (!adaptersOption.isChoosen(k))
+            continue;
+        TunePoint bestPoint;
+        double bestScore;
+        if (!tuneAdapter(adl.mainControl, k, activeAdapters[k], options, bestPoint,
+                    bestScore))
+        {
+            std::cerr << "Adapter " << k << ": evaluation failed at current settings" <<
+                    std::endl;
+            continue;
+        }
+        // ready to apply parameters
+        std::cout << "coreclk:" << k << "=" << bestPoint[TUNE_CORE_CLOCK]/100.0 <<
+                " memclk:" << k << "=" << bestPoint[TUNE_MEMORY_CLOCK]/100.0 <<
+                " vcore:" << k << "=" << bestPoint[TUNE_VDDC]/1000.0 << std::endl;
+    }
+    return stopRequested ? 1 : 0;
+}
+
+/*
+ * Sweeping
+ */
+
+enum SweepDimension
+{
+    SWEEP_CORE_CLOCK = 0,
+    SWEEP_MEMORY_CLOCK,
+    SWEEP_VDDC,
+    SWEEP_POWER_CONTROL,
+    SWEEP_DIMENSIONS_NUM
+};
+
+static const char* sweepDimensionNames[SWEEP_DIMENSIONS_NUM] =
+{ "coreclk", "memclk", "vcore", "powercontrol" };
+
+// scales between units of sweep file (MHz, V, %) and ADL units
+static const int sweepDimensionScales[SWEEP_DIMENSIONS_NUM] = { 100, 100, 1000, 1 };
+
+// value of dimension which is not swept (current setting is kept)
+static const int sweepUnset = INT_MIN;
+
+typedef std::array<int, SWEEP_DIMENSIONS_NUM> SweepPoint;
+
+struct SweepOptions
+{
+    std::vector<int> grid[SWEEP_DIMENSIONS_NUM]; // values in ADL units
+    double settleTime;
+    double sampleTime;
+    double interval;
+    std::string workload;
+};
+
+struct SweepAdapter
+{
+    int userIndex;
+    int adapterIndex;
+    const AdapterInfo* info;
+    std::vector<SweepPoint> points; // points to do
+};
+
+/* parse grid of dimension: list of values or ranges FIRST:LAST:STEP */
+static void parseSweepGrid(const char* string, int scale, std::vector<int>& values)
+{
+    values.clear();
+    while (true)
+    {
+        double range[3];
+        int rangeNum = 0;
+        while (true)
+        {
+            char* endptr;
             errno = 0;
-            int adapterIndexEnd = strtol(string, &endptr, 10);
+            range[rangeNum++] = strtod(string, &endptr);
             if (errno!=0 || endptr==string)
-                throw Error("Can't parse adapter index");
+                throw Error("Can't parse sweep grid");
             string = endptr;
-            if (adapterIndex>adapterIndexEnd)
-                throw Error("Wrong range of adapter indices in adapter list");
-            for (int i = adapterIndex; i <= adapterIndexEnd; i++)
-                adapters.push_back(i);
+            if (*string!=':')
+                break;
+            if (rangeNum==3)
+                throw Error("Garbages at sweep grid range");
+            string++;
+        }
+        if (rangeNum==1)
+            values.push_back(lround(range[0]*scale));
+        else if (rangeNum==3)
+        {
+            const int first = lround(range[0]*scale);
+            const int last = lround(range[1]*scale);
+            const int step = lround(range[2]*scale);
+            if (step <= 0)
+                throw Error("Sweep grid step must be positive");
+            if (last < first)
+                throw Error("Last value of sweep grid range is lower than first");
+            if ((last-first)/step >= 10000)
+                throw Error("Sweep grid range is too long");
+            for (int value = first; value <= last; value += step)
+                values.push_back(value);
         }
         else
-            adapters.push_back(adapterIndex);
+            throw Error("Sweep grid range must be FIRST:LAST:STEP");
         if (*string==0)
             break;
         if (*string==',')
             string++;
         else
-            throw Error("Garbages at adapter list");
+            throw Error("Garbages at sweep grid");
     }
-    std::sort(adapters.begin(), adapters.end());
-    adapters.resize(std::unique(adapters.begin(), adapters.end()) - adapters.begin());
 }
 
-enum class OVCParamType
+// append first columns of row: adapter and point (also key of row)
+static void appendSweepRowKey(ReportBuffer& out, const SweepAdapter& adapter,
+            const SweepPoint& point)
 {
-    CORE_CLOCK,
-    MEMORY_CLOCK,
-    VDDC_VOLTAGE,
-    FAN_SPEED,
-    POWER_CONTROL
-};
+    const AdapterInfo& info = *adapter.info;
+    char busBuf[32];
+    snprintf(busBuf, 32, "%02x:%02x.%x", info.iBusNumber, info.iDeviceNumber,
+                info.iFunctionNumber);
+    out.appendInt(adapter.userIndex);
+    out.append(',');
+    out.append(busBuf);
+    out.append(',');
+    out.appendDSVString(info.strAdapterName, ',');
+    for (int d = 0; d < SWEEP_DIMENSIONS_NUM; d++)
+    {
+        out.append(',');
+        if (point[d]!=sweepUnset)
+            out.appendScaled(point[d], sweepDimensionScales[d]);
+    }
+}
 
-enum: int {
-    LAST_PERFLEVEL = -1
+static const char* sweepFileHeader = "adapter,bus,name,coreclk,memclk,vcore,"
+        "powercontrol,status,samples,core_clock,memory_clock,vddc,load,temperature,"
+        "temperature_max,throughput\n";
+
+// returns length of first fieldsNum fields of CSV line (with quoted fields)
+static size_t getCSVPrefixLength(const std::string& line, int fieldsNum)
+{
+    bool quoted = false;
+    for (size_t i = 0; i < line.size(); i++)
+        if (line[i]=='"')
+            quoted = !quoted;
+        else if (!quoted && line[i]==',' && --fieldsNum==0)
+            return i;
+    return line.size();
+}
+
+/* sweep file: rows are appended by single write under mutex. Keys of rows
+ * already written (by interrupted sweep) are loaded for resuming */
+class SweepFile
+{
+private:
+    int fd;
+    std::mutex mutex;
+    std::unordered_set<std::string> doneKeys;
+public:
+    explicit SweepFile(const char* filename);
+    ~SweepFile();
+    
+    bool isDone(const std::string& key) const
+    { return doneKeys.find(key)!=doneKeys.end(); }
+    void writeRow(ReportBuffer& row);
 };
 
-struct OVCParameter
+SweepFile::SweepFile(const char* filename) : fd(-1)
+{
+    fd = open(filename, O_RDWR|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+    if (fd==-1)
+        throw Error(errno, "Can't open sweep file");
+    try
+    {
+        if (flock(fd, LOCK_EX|LOCK_NB)!=0)
+            throw Error("Sweep file is used by other sweep");
+        std::string content;
+        char buf[4096];
+        ssize_t readSize;
+        while ((readSize = read(fd, buf, 4096)) > 0)
+            content.append(buf, readSize);
+        if (readSize < 0)
+            throw Error(errno, "Can't read sweep file");
+        const size_t headerSize = ::strlen(sweepFileHeader);
+        if (content.empty())
+        {
+            ReportBuffer header;
+            header.append(sweepFileHeader);
+            header.writeTo(fd);
+            return;
+        }
+        if (content.compare(0, headerSize, sweepFileHeader)!=0)
+            throw Error("Sweep file has different columns");
+        // only complete rows are done (row of killed sweep can be partial)
+        size_t pos = headerSize;
+        while (true)
+        {
+            const size_t end = content.find('\n', pos);
+            if (end==std::string::npos)
+                break;
+            const std::string line = content.substr(pos, end-pos);
+            doneKeys.insert(line.substr(0, getCSVPrefixLength(line,
+                        3+SWEEP_DIMENSIONS_NUM)));
+            pos = end+1;
+        }
+        if (pos!=content.size() && ftruncate(fd, pos)!=0)
+            throw Error(errno, "Can't truncate sweep file");
+    }
+    catch(...)
+    {
+        close(fd);
+        throw;
+    }
+}
+
+SweepFile::~SweepFile()
+{
+    close(fd);
+}
+
+void SweepFile::writeRow(ReportBuffer& row)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    row.writeTo(fd);
+}
+
+/* sweep single adapter: for every point sets top performance level and
+ * PowerControl, waits settle time, then samples activity and temperature
+ * while workload is running. Failed points are written with 'failed' status
+ * and default levels are set. Original settings are restored after sweep */
+static void sweepAdapter(const ADLMainControl& mainControl, const SweepAdapter& adapter,
+            const SweepOptions& options, SweepFile& sweepFile)
+{
+    const int adapterIndex = adapter.adapterIndex;
+    ADLODParameters odParams;
+    mainControl.getODParameters(adapterIndex, odParams);
+    const int levelsNum = odParams.iNumberOfPerformanceLevels;
+    std::vector<ADLODPerformanceLevel> originalLevels(levelsNum);
+    std::vector<ADLODPerformanceLevel> defaultLevels(levelsNum);
+    mainControl.getODPerformanceLevels(adapterIndex, false, levelsNum,
+                originalLevels.data());
+    mainControl.getODPerformanceLevels(adapterIndex, true, levelsNum,
+                defaultLevels.data());
+    const bool usePowerControl = !options.grid[SWEEP_POWER_CONTROL].empty();
+    int originalPowerControl = 0;
+    ADLPowerControlInfo powerControlInfo = { };
+    if (usePowerControl)
+    {
+        if (!mainControl.isPowerControlSupported())
+            throw Error("PowerControl is not supported");
+        int defaultValue;
+        mainControl.getPowerControlInfo(adapterIndex, powerControlInfo);
+        mainControl.getPowerControl(adapterIndex, originalPowerControl, defaultValue);
+    }
+    const ADLODParameterRange ranges[SWEEP_DIMENSIONS_NUM] =
+    { odParams.sEngineClock, odParams.sMemoryClock, odParams.sVddc,
+      { powerControlInfo.iMinValue, powerControlInfo.iMaxValue,
+        powerControlInfo.iStepValue } };
+    
+    auto restore = [&]()
+    {
+        mainControl.setODPerformanceLevels(adapterIndex, levelsNum,
+                    originalLevels.data());
+        if (usePowerControl)
+            mainControl.setPowerControl(adapterIndex, originalPowerControl);
+    };
+    
+    ReportBuffer row;
+    try
+    {
+        for (const SweepPoint& point: adapter.points)
+        {
+            if (stopRequested)
+                break;
+            const char* status = "ok";
+            bool inRange = true;
+            for (int d = 0; d < SWEEP_DIMENSIONS_NUM; d++)
+                if (point[d]!=sweepUnset && (point[d] < ranges[d].iMin ||
+                            point[d] > ranges[d].iMax))
+                    inRange = false;
+            int samplesNum = 0;
+            double sums[5] = { 0.0, 0.0, 0.0, 0.0, 0.0 }; // clocks, vddc, load, temp.
+            int maxTemperature = INT_MIN;
+            double throughput = -1.0;
+            if (!inRange)
+                status = "out-of-range";
+            else
+            {
+                std::vector<ADLODPerformanceLevel> levels(originalLevels);
+                if (point[SWEEP_CORE_CLOCK]!=sweepUnset)
+                    levels.back().iEngineClock = point[SWEEP_CORE_CLOCK];
+                if (point[SWEEP_MEMORY_CLOCK]!=sweepUnset)
+                    levels.back().iMemoryClock = point[SWEEP_MEMORY_CLOCK];
+                if (point[SWEEP_VDDC]!=sweepUnset)
+                    levels.back().iVddc = point[SWEEP_VDDC];
+                bool isSet = false;
+                try
+                {
+                    mainControl.setODPerformanceLevels(adapterIndex, levelsNum,
+                                levels.data());
+                    if (usePowerControl)
+                        mainControl.setPowerControl(adapterIndex,
+                                    point[SWEEP_POWER_CONTROL]);
+                    isSet = true;
+                }
+                catch(const Error& error)
+                {
+                    std::cerr << "Adapter " << adapter.userIndex <<
+                            ": Can't set point: " << error.what() << std::endl;
+                }
+                if (isSet)
+                {
+                    if (options.settleTime > 0.0 &&
+                        !PeriodicTimer(options.settleTime).wait())
+                        break;
+                    // workload is running while samples are taken
+                    std::exception_ptr workloadError;
+                    std::thread workloadThread;
+                    if (!options.workload.empty())
+                        workloadThread = std::thread([&]()
+                        {
+                            try
+                            { throughput = runEvaluationCommand(options.workload,
+                                            adapter.userIndex); }
+                            catch(...)
+                            { workloadError = std::current_exception(); }
+                        });
+                    const int maxSamplesNum = std::max(1L,
+                                lround(options.sampleTime/options.interval));
+                    PeriodicTimer timer(options.interval);
+                    try
+                    {
+                        for (samplesNum = 0; samplesNum < maxSamplesNum; )
+                        {
+                            ADLPMActivity activity;
+                            mainControl.getCurrentActivity(adapterIndex, activity);
+                            const int temperature = mainControl.getTemperature(
+                                        adapterIndex, 0);
+                            sums[0] += activity.iEngineClock;
+                            sums[1] += activity.iMemoryClock;
+                            sums[2] += activity.iVddc;
+                            sums[3] += activity.iActivityPercent;
+                            sums[4] += temperature;
+                            maxTemperature = std::max(maxTemperature, temperature);
+                            samplesNum++;
+                            if (samplesNum < maxSamplesNum && !timer.wait())
+                                break;
+                        }
+                    }
+                    catch(...)
+                    {
+                        if (workloadThread.joinable())
+                            workloadThread.join();
+                        throw;
+                    }
+                    if (workloadThread.joinable())
+                        workloadThread.join();
+                    if (workloadError)
+                        std::rethrow_exception(workloadError);
+                    if (stopRequested)
+                        break; // point is not complete, it will be resumed
+                    if (!options.workload.empty() && throughput < 0.0)
+                        isSet = false;
+                }
+                if (!isSet)
+                {
+                    status = "failed";
+                    // roll back to safe settings
+                    mainControl.setODPerformanceLevels(adapterIndex, levelsNum,
+                                defaultLevels.data());
+                }
+            }
+        
+            row.clear();
+            appendSweepRowKey(row, adapter, point);
+            row.append(',');
+            row.append(status);
+            row.append(',');
+            row.appendInt(samplesNum);
+            if (samplesNum!=0)
+            {
+                const int scales[5] = { 100, 100, 1000, 1, 1000 };
+                for (int i = 0; i < 5; i++)
+                {
+                    row.append(',');
+                    // means with three digits after point
+                    row.appendScaled(lround(sums[i]*1000.0/scales[i]/samplesNum), 1000);
+                }
+                row.append(',');
+                row.appendScaled(maxTemperature, 1000);
+            }
+            else
+                row.append(",,,,,,");
+            row.append(',');
+            if (throughput >= 0.0)
+            {
+                char buf[32];
+                snprintf(buf, 32, "%.6g", throughput);
+                row.append(buf);
+            }
+            row.append('\n');
+            sweepFile.writeRow(row);
+        
+            char lineBuf[160];
+            if (samplesNum!=0)
+                snprintf(lineBuf, 160, "Adapter %d: point %s: load %.1f%%, "
+                        "temperature %.1f C\n", adapter.userIndex, status,
+                        sums[3]/samplesNum, sums[4]*1e-3/samplesNum);
+            else
+                snprintf(lineBuf, 160, "Adapter %d: point %s\n", adapter.userIndex,
+                        status);
+            std::cerr << lineBuf;
+        }
+    }
+    catch(...)
+    {
+        restore();
+        throw;
+    }
+    restore();
+}
+
+/* sweep adapters in parallel by adapter workers. Adapters whose context can not
+ * be created are swept later serially */
+static void sweepAdaptersParallel(AdapterWorkers& workers,
+            const std::vector<SweepAdapter>& adapters, const SweepOptions& options,
+            SweepFile& sweepFile)
+{
+    std::vector<std::exception_ptr> errors;
+    workers.run(adapters.size(), [&adapters, &options, &sweepFile](size_t k,
+                const ADLMainControl& control)
+    {
+        if (!stopRequested)
+            sweepAdapter(control, adapters[k], options, sweepFile);
+    }, errors);
+    // report first error in adapter order
+    for (const std::exception_ptr& error: errors)
+        if (error)
+            std::rethrow_exception(error);
+}
+
+static const char* sweepHelpString =
+"Usage: amdcovc sweep --output=FILE [-a LIST|--adapters=LIST] [--coreclk=GRID]\n"
+"               [--memclk=GRID] [--vcore=GRID] [--powercontrol=GRID]\n"
+"               [--settle=SECONDS] [--sample=SECONDS] [--interval=SECONDS]\n"
+"               [--workload=COMMAND] [--parallel]\n"
+"Walk grid of top performance level settings and PowerControl values.\n"
+"At every point settings are applied, then after settle time activity and\n"
+"temperature are sampled. Means and maximal temperature are appended as\n"
+"row to CSV file. If file has rows of interrupted sweep, then done points\n"
+"are skipped. Original settings are restored after sweep.\n"
+"GRID is list of values or ranges FIRST:LAST:STEP, for example\n"
+"'1000:1200:50,1250'. Clocks in MHz, Vddc in Volts, PowerControl in percents.\n"
+"Not given dimension keeps current setting.\n"
+"\n"
+"List of options:\n"
+"  -a, --adapters=LIST       adapters (default is all)\n"
+"      --output=FILE         CSV file to append rows\n"
+"      --coreclk=GRID        core clocks of top level\n"
+"      --memclk=GRID         memory clocks of top level\n"
+"      --vcore=GRID          Vddc voltages of top level\n"
+"      --powercontrol=GRID   PowerControl values\n"
+"      --settle=SECONDS      time after setting point (default 5)\n"
+"      --sample=SECONDS      sampling time (default 10)\n"
+"      --interval=SECONDS    sampling interval (default 0.5)\n"
+"      --workload=COMMAND    run COMMAND by shell while sampling, sweep waits\n"
+"                            for its end. Last number of output is throughput.\n"
+"                            Adapter index is in AMDCOVC_ADAPTER variable\n"
+"      --parallel            sweep adapters in parallel (requires ADL2)\n";
+
+/* 'amdcovc sweep' subcommand */
+static int runSweep(int argc, const char** argv)
+{
+    AdaptersOption adaptersOption;
+    SweepOptions options;
+    options.settleTime = 5.0;
+    options.sampleTime = 10.0;
+    options.interval = 0.5;
+    const char* outputFile = nullptr;
+    bool parallel = false;
+    for (int i = 1; i < argc; i++)
+    {
+        int d = 0;
+        for (; d < SWEEP_DIMENSIONS_NUM; d++)
+        {
+            const size_t nameLen = ::strlen(sweepDimensionNames[d]);
+            if (::strncmp(argv[i], "--", 2)==0 &&
+                ::strncmp(argv[i]+2, sweepDimensionNames[d], nameLen)==0 &&
+                argv[i][nameLen+2]=='=')
+                break;
+        }
+        if (d < SWEEP_DIMENSIONS_NUM)
+        {
+            parseSweepGrid(argv[i]+::strlen(sweepDimensionNames[d])+3,
+                        sweepDimensionScales[d], options.grid[d]);
+            continue;
+        }
+        if (::strcmp(argv[i], "--help")==0 || ::strcmp(argv[i], "-?")==0)
+        {
+            std::cout << sweepHelpString;
+            std::cout.flush();
+            return 0;
+        }
+        else if (adaptersOption.parse(argc, argv, i))
+            continue;
+        else if (::strncmp(argv[i], "--output=", 9)==0)
+            outputFile = argv[i]+9;
+        else if (::strncmp(argv[i], "--settle=", 9)==0)
+            options.settleTime = parseOptionNumber(argv[i]+9, 0.0, 3600.0, "settle time");
+        else if (::strncmp(argv[i], "--sample=", 9)==0)
+            options.sampleTime = parseOptionNumber(argv[i]+9, 0.0, 86400.0,
+                        "sampling time");
+        else if (::strncmp(argv[i], "--interval=", 11)==0)
+            options.interval = parseInterval(argv[i]+11);
+        else if (::strncmp(argv[i], "--workload=", 11)==0)
+            options.workload = argv[i]+11;
+        else if (::strcmp(argv[i], "--parallel")==0)
+            parallel = true;
+        else
+            throw Error((std::string("Unknown sweep option: '") + argv[i] + "'").c_str());
+    }
+    if (outputFile==nullptr)
+        throw Error("Sweep output file not supplied");
+    
+    ADLAdapters adl;
+    const std::vector<int>& activeAdapters = adl.activeAdapters;
+    AdapterInfo* adapterInfos = adl.adapterInfos.get();
+    adaptersOption.checkRange(activeAdapters.size());
+    
+    SweepFile sweepFile(outputFile);
+    // make list of points (without done points) for every adapter
+    std::vector<SweepAdapter> adapters;
+    size_t pointsNum = 0, donePointsNum = 0;
+    ReportBuffer key;
+    for (int k = 0; k < int(activeAdapters.size()); k++)
+    {
+        if (!adaptersOption.isChoosen(k))
+            continue;
+        const int ai = activeAdapters[k];
+        if (adapterInfos[ai].strAdapterName[0]==0)
+            getFromPCI(adapterInfos[ai].iAdapterIndex, adapterInfos[ai]);
+        SweepAdapter adapter;
+        adapter.userIndex = k;
+        adapter.adapterIndex = ai;
+        adapter.info = adapterInfos + ai;
+        size_t counters[SWEEP_DIMENSIONS_NUM] = { 0, 0, 0, 0 };
+        while (true)
+        {
+            SweepPoint point;
+            for (int d = 0; d < SWEEP_DIMENSIONS_NUM; d++)
+                point[d] = options.grid[d].empty() ? sweepUnset :
+                        options.grid[d][counters[d]];
+            key.clear();
+            appendSweepRowKey(key, adapter, point);
+            pointsNum++;
+            if (!sweepFile.isDone(key.getContent()))
+                adapter.points.push_back(point);
+            else
+                donePointsNum++;
+            // next point: last dimension changes fastest
+            int d = SWEEP_DIMENSIONS_NUM-1;
+            for (; d >= 0; d--)
+            {
+                if (++counters[d] < options.grid[d].size())
+                    break;
+                counters[d] = 0;
+            }
+            if (d < 0)
+                break;
+        }
+        adapters.push_back(adapter);
+    }
+    cleanupPCIAccess();
+    if (donePointsNum!=0)
+        std::cerr << "Resuming sweep: " << donePointsNum << " of " << pointsNum <<
+                " points are done" << std::endl;
+    
+    // settings are restored on SIGINT, SIGTERM, SIGHUP and SIGQUIT
+    installStopHandlers();
+    std::unique_ptr<AdapterWorkers> workers;
+    // ADL1 set functions can not be called concurrently
+    if (parallel && adl.handle.hasCapability(ADLCAP_ADL2_SET) &&
+        (options.grid[SWEEP_POWER_CONTROL].empty() ||
+         adl.handle.hasCapability(ADLCAP_ADL2_POWER_CONTROL)))
+        workers = createAdapterWorkers(adl.handle, adl.mainControl, adapters.size());
+    if (workers)
+        sweepAdaptersParallel(*workers, adapters, options, sweepFile);
+    else
+        for (const SweepAdapter& adapter: adapters)
+        {
+            if (stopRequested)
+                break;
+            sweepAdapter(adl.mainControl, adapter, options, sweepFile);
+        }
+    return stopRequested ? 1 : 0;
+}
+
+/*
+ * Profiles
+ */
+
+struct ProfileEntry
 {
     OVCParamType type;
-    std::vector<int> adapters;
-    bool allAdapters;
-    int partId;
+    int partId;     // performance level or thermal controller index
     double value;
     bool useDefault;
-    std::string argText;
+    int lineNo;
 };
 
-static bool parseOVCParameter(const char* string, OVCParameter& param)
+// section of profile: adapter given by index, PCI bus address or all adapters
+struct ProfileSection
 {
-    const char* afterName = strchr(string, ':');
-    if (afterName==nullptr)
+    bool allAdapters;
+    int index;      // -1 if adapter is given by PCI address
+    int busNumber;
+    int deviceNumber;
+    int functionNumber;
+    int lineNo;
+    std::vector<ProfileEntry> entries;
+};
+
+static const struct ProfileEntryName
+{
+    const char* name;
+    OVCParamType type;
+    int partId;
+    bool partIdSet;
+} profileEntryNames[] =
+{
+    { "coreclk", OVCParamType::CORE_CLOCK, LAST_PERFLEVEL, false },
+    { "memclk", OVCParamType::MEMORY_CLOCK, LAST_PERFLEVEL, false },
+    { "vcore", OVCParamType::VDDC_VOLTAGE, LAST_PERFLEVEL, false },
+    { "icoreclk", OVCParamType::CORE_CLOCK, 0, true },
+    { "imemclk", OVCParamType::MEMORY_CLOCK, 0, true },
+    { "ivcore", OVCParamType::VDDC_VOLTAGE, 0, true },
+    { "fanspeed", OVCParamType::FAN_SPEED, 0, false },
+    { "powercontrol", OVCParamType::POWER_CONTROL, 0, false },
+    { "pwrctrl", OVCParamType::POWER_CONTROL, 0, false }
+};
+
+static std::string trimString(const std::string& string)
+{
+    const size_t first = string.find_first_not_of(" \t\r");
+    if (first==std::string::npos)
+        return std::string();
+    const size_t last = string.find_last_not_of(" \t\r");
+    return string.substr(first, last-first+1);
+}
+
+static void throwProfileError(int lineNo, const char* message)
+{
+    char buf[64];
+    snprintf(buf, 64, "Profile line %d: ", lineNo);
+    throw Error((buf + std::string(message)).c_str());
+}
+
+/* parse profile: sections '[all]', '[INDEX]' or '[BUS:DEV.FUNC]' (PCI address
+ * in hex, optionally with domain 0) with entries 'NAME[:PARTID]=VALUE|default'.
+ * Comments start with '#' */
+static void parseProfile(std::istream& is, std::vector<ProfileSection>& sections)
+{
+    sections.clear();
+    std::string line;
+    for (int lineNo = 1; std::getline(is, line); lineNo++)
     {
-        afterName = strchr(string, '=');
-        if (afterName==nullptr)
+        const size_t commentPos = line.find('#');
+        if (commentPos!=std::string::npos)
+            line.resize(commentPos);
+        line = trimString(line);
+        if (line.empty())
+            continue;
+        if (line[0]=='[')
+        {
+            if (line.back()!=']')
+                throwProfileError(lineNo, "Unterminated section name");
+            const std::string name = trimString(line.substr(1, line.size()-2));
+            ProfileSection section;
+            section.allAdapters = (name=="all");
+            section.index = -1;
+            section.busNumber = section.deviceNumber = section.functionNumber = 0;
+            section.lineNo = lineNo;
+            unsigned int domain, bus, device, function;
+            char c;
+            const bool withDomain = ::sscanf(name.c_str(), "%x:%x:%x.%x%c", &domain,
+                        &bus, &device, &function, &c)==4;
+            if (section.allAdapters)
+                ;
+            else if (withDomain || ::sscanf(name.c_str(), "%x:%x.%x%c", &bus, &device,
+                        &function, &c)==3)
+            {
+                // ADL doesn't give PCI domain, adapters are matched by bus address
+                if (withDomain && domain!=0)
+                    throwProfileError(lineNo, "Only PCI domain 0 is supported");
+                section.busNumber = bus;
+                section.deviceNumber = device;
+                section.functionNumber = function;
+            }
+            else
+            {
+                char* endptr;
+                errno = 0;
+                section.index = strtol(name.c_str(), &endptr, 10);
+                if (errno!=0 || endptr==name.c_str() || *endptr!=0 || section.index < 0)
+                    throwProfileError(lineNo, "Wrong adapter in section name");
+            }
+            sections.push_back(section);
+            continue;
+        }
+        if (sections.empty())
+            throwProfileError(lineNo, "Entry outside of section");
+        const size_t eqPos = line.find('=');
+        if (eqPos==std::string::npos)
+            throwProfileError(lineNo, "This is not entry");
+        std::string name = trimString(line.substr(0, eqPos));
+        const std::string valueString = trimString(line.substr(eqPos+1));
+        ProfileEntry entry;
+        entry.lineNo = lineNo;
+        entry.useDefault = false;
+        entry.value = 0.0;
+        std::string partIdString;
+        const size_t colonPos = name.find(':');
+        if (colonPos!=std::string::npos)
+        {
+            partIdString = trimString(name.substr(colonPos+1));
+            name = trimString(name.substr(0, colonPos));
+        }
+        const ProfileEntryName* entryName = nullptr;
+        for (const ProfileEntryName& en: profileEntryNames)
+            if (name==en.name)
+                entryName = &en;
+        if (entryName==nullptr)
+            throwProfileError(lineNo, ("Wrong entry name '" + name + "'").c_str());
+        entry.type = entryName->type;
+        entry.partId = entryName->partId;
+        if (!partIdString.empty())
+        {
+            char* endptr;
+            errno = 0;
+            if (entryName->partIdSet)
+                throwProfileError(lineNo, "Performance level can not be given");
+            entry.partId = strtol(partIdString.c_str(), &endptr, 10);
+            if (errno!=0 || *endptr!=0)
+                throwProfileError(lineNo, "Can't parse partId");
+        }
+        if (valueString=="default")
+            entry.useDefault = true;
+        else
+        {
+            char* endptr;
+            errno = 0;
+            entry.value = strtod(valueString.c_str(), &endptr);
+            if (errno!=0 || endptr==valueString.c_str() || *endptr!=0)
+                throwProfileError(lineNo, "Can't parse value");
+        }
+        sections.back().entries.push_back(entry);
+    }
+}
+
+/* state of adapter read once before apply, and settings wanted by profile */
+struct ProfileAdapterState
+{
+    int userIndex;
+    int adapterIndex;
+    bool levelsUsed;
+    ADLODParameters odParams;
+    std::vector<ADLODPerformanceLevel> levels;
+    std::vector<ADLODPerformanceLevel> defaultLevels;
+    std::vector<ADLODPerformanceLevel> newLevels;
+    bool fanUsed;
+    int fanSpeed;
+    bool fanUserDefined;
+    int newFanSpeed;
+    bool newFanDefault;
+    bool powerControlUsed;
+    int powerControl;
+    int defaultPowerControl;
+    int newPowerControl;
+};
+
+// check entry for adapter, returns false if entry is wrong
+static bool applyProfileEntry(const ProfileEntry& entry, ProfileAdapterState& state)
+{
+    const int i = state.userIndex;
+    if (entry.type==OVCParamType::FAN_SPEED)
+    {
+        if (entry.partId!=0)
+        {
+            std::cerr << "Thermal Control Index is not 0 in profile line " <<
+                    entry.lineNo << "!" << std::endl;
+            return false;
+        }
+        if (!entry.useDefault && (entry.value<0.0 || entry.value>100.0))
+        {
+            std::cerr << "FanSpeed value out of range in profile line " <<
+                    entry.lineNo << "!" << std::endl;
+            return false;
+        }
+        state.newFanDefault = entry.useDefault;
+        state.newFanSpeed = int(round(entry.value));
+        return true;
+    }
+    if (entry.type==OVCParamType::POWER_CONTROL)
+    {
+        if (entry.partId!=0)
+        {
+            std::cerr << "Thermal Control Index is not 0 in profile line " <<
+                    entry.lineNo << "!" << std::endl;
+            return false;
+        }
+        // restrict to +20%
+        if (!entry.useDefault && (entry.value<-50.0 || entry.value>20.0))
+        {
+            std::cerr << "PowerControl value out of range in profile line " <<
+                    entry.lineNo << "!" << std::endl;
+            return false;
+        }
+        state.newPowerControl = entry.useDefault ? state.defaultPowerControl :
+                int(round(entry.value));
+        return true;
+    }
+    const ADLODParameters& odParams = state.odParams;
+    const int partId = (entry.partId!=LAST_PERFLEVEL) ? entry.partId :
+            odParams.iNumberOfPerformanceLevels-1;
+    if (partId >= odParams.iNumberOfPerformanceLevels || partId < 0)
+    {
+        std::cerr << "Performance level out of range in profile line " <<
+                entry.lineNo << " for adapter " << i << "!" << std::endl;
+        return false;
+    }
+    ADLODPerformanceLevel& level = state.newLevels[partId];
+    const ADLODPerformanceLevel& defaultLevel = state.defaultLevels[partId];
+    switch(entry.type)
+    {
+        case OVCParamType::CORE_CLOCK:
+            if (!entry.useDefault && (entry.value < odParams.sEngineClock.iMin/100.0 ||
+                        entry.value > odParams.sEngineClock.iMax/100.0))
+            {
+                std::cerr << "Core clock out of range in profile line " <<
+                        entry.lineNo << " for adapter " << i << "!" << std::endl;
+                return false;
+            }
+            level.iEngineClock = entry.useDefault ? defaultLevel.iEngineClock :
+                    int(round(entry.value*100.0));
+            break;
+        case OVCParamType::MEMORY_CLOCK:
+            if (!entry.useDefault && (entry.value < odParams.sMemoryClock.iMin/100.0 ||
+                        entry.value > odParams.sMemoryClock.iMax/100.0))
+            {
+                std::cerr << "Memory clock out of range in profile line " <<
+                        entry.lineNo << " for adapter " << i << "!" << std::endl;
+                return false;
+            }
+            level.iMemoryClock = entry.useDefault ? defaultLevel.iMemoryClock :
+                    int(round(entry.value*100.0));
+            break;
+        case OVCParamType::VDDC_VOLTAGE:
+            if (!entry.useDefault && (entry.value < odParams.sVddc.iMin/1000.0 ||
+                        entry.value > odParams.sVddc.iMax/1000.0))
+            {
+                std::cerr << "Voltage out of range in profile line " <<
+                        entry.lineNo << " for adapter " << i << "!" << std::endl;
+                return false;
+            }
+            if (entry.useDefault)
+                level.iVddc = defaultLevel.iVddc;
+            else if (level.iVddc==0)
+                std::cout << "Voltage for adapter " << i << " is not set!" << std::endl;
+            else
+                level.iVddc = int(round(entry.value*1000.0));
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+/* apply profile: reads state of adapters once, computes differences between
+ * current and wanted settings and calls only ADL set functions which change
+ * something. Returns number of needed set calls */
+static int applyProfile(const ATIADLHandle& handle, const ADLMainControl& mainControl,
+            const std::vector<int>& activeAdapters, const AdapterInfo* adapterInfos,
+            const std::vector<ProfileSection>& sections, bool dryRun)
+{
+    const int realAdaptersNum = activeAdapters.size();
+    // resolve adapters of sections
+    std::vector<std::vector<int> > sectionAdapters(sections.size());
+    for (size_t s = 0; s < sections.size(); s++)
+    {
+        const ProfileSection& section = sections[s];
+        for (int i = 0; i < realAdaptersNum; i++)
+        {
+            const AdapterInfo& info = adapterInfos[activeAdapters[i]];
+            if (section.allAdapters || i==section.index ||
+                (section.index < 0 && info.iBusNumber==section.busNumber &&
+                 info.iDeviceNumber==section.deviceNumber &&
+                 info.iFunctionNumber==section.functionNumber))
+                sectionAdapters[s].push_back(i);
+        }
+        if (sectionAdapters[s].empty())
+            throwProfileError(section.lineNo, "No such adapter");
+    }
+    
+    // read current state of used adapters
+    std::vector<ProfileAdapterState> states(realAdaptersNum);
+    std::vector<bool> used(realAdaptersNum, false);
+    for (int i = 0; i < realAdaptersNum; i++)
+    {
+        ProfileAdapterState& state = states[i];
+        state.userIndex = i;
+        state.adapterIndex = activeAdapters[i];
+        state.levelsUsed = state.fanUsed = state.powerControlUsed = false;
+    }
+    for (size_t s = 0; s < sections.size(); s++)
+        for (int i: sectionAdapters[s])
+            for (const ProfileEntry& entry: sections[s].entries)
+            {
+                used[i] = true;
+                if (entry.type==OVCParamType::FAN_SPEED)
+                    states[i].fanUsed = true;
+                else if (entry.type==OVCParamType::POWER_CONTROL)
+                    states[i].powerControlUsed = true;
+                else
+                    states[i].levelsUsed = true;
+            }
+    for (int i = 0; i < realAdaptersNum; i++)
+    {
+        ProfileAdapterState& state = states[i];
+        const int ai = state.adapterIndex;
+        if (state.levelsUsed)
+        {
+            mainControl.getODParameters(ai, state.odParams);
+            const int levelsNum = state.odParams.iNumberOfPerformanceLevels;
+            state.levels.resize(levelsNum);
+            state.defaultLevels.resize(levelsNum);
+            mainControl.getODPerformanceLevels(ai, false, levelsNum, state.levels.data());
+            mainControl.getODPerformanceLevels(ai, true, levelsNum,
+                        state.defaultLevels.data());
+            state.newLevels = state.levels;
+        }
+        if (state.fanUsed)
+        {
+            state.fanSpeed = mainControl.getFanSpeed(ai, 0, &state.fanUserDefined);
+            state.newFanSpeed = state.fanSpeed;
+            state.newFanDefault = !state.fanUserDefined;
+        }
+        if (state.powerControlUsed)
+        {
+            if (!mainControl.isPowerControlSupported())
+                throw Error("PowerControl is not supported");
+            mainControl.getPowerControl(ai, state.powerControl,
+                        state.defaultPowerControl);
+            state.newPowerControl = state.powerControl;
+        }
+    }
+    
+    // apply entries to wanted settings (last entry wins)
+    bool failed = false;
+    for (size_t s = 0; s < sections.size(); s++)
+        for (int i: sectionAdapters[s])
+            for (const ProfileEntry& entry: sections[s].entries)
+                if (!applyProfileEntry(entry, states[i]))
+                    failed = true;
+    if (failed)
+    {
+        std::cerr << "NO ANY settings applied. Error in profile!" << std::endl;
+        throw Error("Wrong profile!");
+    }
+    
+    // print differences
+    int changesNum = 0;
+    std::vector<bool> changedLevels(realAdaptersNum, false);
+    std::vector<bool> changedFans(realAdaptersNum, false);
+    std::vector<bool> changedPowerControls(realAdaptersNum, false);
+    for (int i = 0; i < realAdaptersNum; i++)
+    {
+        if (!used[i])
+            continue;
+        const ProfileAdapterState& state = states[i];
+        if (state.fanUsed && (state.newFanDefault ? state.fanUserDefined :
+                    (!state.fanUserDefined || state.newFanSpeed!=state.fanSpeed)))
         {
-            std::cerr << "This is not parameter: '" << string << "'!" << std::endl;
-            return false;
+            std::cout << "Setting fanspeed to ";
+            if (state.newFanDefault)
+                std::cout << "default";
+            else
+                std::cout << state.newFanSpeed << "%";
+            std::cout << " for adapter " << i << " at thermal controller 0" << std::endl;
+            changedFans[i] = true;
+            changesNum++;
+        }
+        if (state.powerControlUsed && state.newPowerControl!=state.powerControl)
+        {
+            std::cout << "Setting powercontrol to " << std::showpos <<
+                    state.newPowerControl << "%" << std::noshowpos << " for adapter " <<
+                    i << " at thermal controller 0" << std::endl;
+            changedPowerControls[i] = true;
+            changesNum++;
+        }
+        for (size_t j = 0; j < state.newLevels.size(); j++)
+        {
+            const ADLODPerformanceLevel& level = state.levels[j];
+            const ADLODPerformanceLevel& newLevel = state.newLevels[j];
+            if (newLevel.iEngineClock!=level.iEngineClock)
+                std::cout << "Setting core clock to " << newLevel.iEngineClock/100.0 <<
+                        " MHz for adapter " << i << " at performance level " << j <<
+                        std::endl;
+            if (newLevel.iMemoryClock!=level.iMemoryClock)
+                std::cout << "Setting memory clock to " << newLevel.iMemoryClock/100.0 <<
+                        " MHz for adapter " << i << " at performance level " << j <<
+                        std::endl;
+            if (newLevel.iVddc!=level.iVddc)
+                std::cout << "Setting Vddc voltage to " << newLevel.iVddc/1000.0 <<
+                        " V for adapter " << i << " at performance level " << j <<
+                        std::endl;
+            if (newLevel.iEngineClock!=level.iEngineClock ||
+                newLevel.iMemoryClock!=level.iMemoryClock || newLevel.iVddc!=level.iVddc)
+                changedLevels[i] = true;
         }
+        if (changedLevels[i])
+            changesNum++;
     }
-    std::string name(string, afterName);
-    param.argText = string;
-    param.adapters.clear();
-    param.adapters.push_back(0); // default is 0
-    param.allAdapters = false;
-    param.partId = 0;
-    param.useDefault = false;
-    bool partIdSet = false;
-    if (name=="coreclk")
+    if (dryRun || changesNum==0)
+        return changesNum;
+    
+    std::vector<AdapterSetup> setups;
+    std::vector<AdapterSetup> snapshots;
+    for (int i = 0; i < realAdaptersNum; i++)
     {
-        param.type = OVCParamType::CORE_CLOCK;
-        param.partId = LAST_PERFLEVEL;
+        if (!changedFans[i] && !changedPowerControls[i] && !changedLevels[i])
+            continue;
+        const ProfileAdapterState& state = states[i];
+        AdapterSetup setup;
+        setup.userIndex = i;
+        setup.adapterIndex = state.adapterIndex;
+        setup.fanSpeedSet = changedFans[i];
+        setup.powerControlSet = changedPowerControls[i];
+        setup.perfLevelsSet = changedLevels[i];
+        AdapterSetup snapshot = setup;
+        setup.fanSpeedDefault = state.newFanDefault;
+        setup.fanSpeed = state.newFanSpeed;
+        snapshot.fanSpeedDefault = !state.fanUserDefined;
+        snapshot.fanSpeed = state.fanSpeed;
+        setup.powerControl = state.newPowerControl;
+        snapshot.powerControl = state.powerControl;
+        if (changedLevels[i])
+        {
+            setup.perfLevels = state.newLevels;
+            snapshot.perfLevels = state.levels;
+        }
+        setups.push_back(setup);
+        snapshots.push_back(snapshot);
     }
-    else if (name=="memclk")
+    setAdapterSetups(handle, mainControl, setups, snapshots);
+    return changesNum;
+}
+
+static const char* applyHelpString =
+"Usage: amdcovc apply [--dry-run] PROFILE\n"
+"Apply profile file (or standard input if PROFILE is '-'). Current settings are\n"
+"read once and only changed settings are set.\n"
+"Profile has sections '[all]', '[INDEX]' or '[BUS:DEV.FUNC]' (PCI address in hex,\n"
+"optionally with domain 0 as '[0000:BUS:DEV.FUNC]')\n"
+"with entries in form 'NAME[:PARTID]=VALUE|default'. Names are same as names\n"
+"of parameters: coreclk, memclk, vcore, icoreclk, imemclk, ivcore, fanspeed\n"
+"and powercontrol. PARTID is performance level (default is last level) or\n"
+"thermal controller index. Later entries override earlier entries.\n"
+"Comments start with '#'. Example:\n"
+"\n"
+"  [all]\n"
+"  fanspeed=60\n"
+"  [01:00.0]\n"
+"  coreclk=1100\n"
+"  vcore:0=0.9\n"
+"\n"
+"List of options:\n"
+"  -n, --dry-run             print changes, but do not set them\n";
+
+/* 'amdcovc apply' subcommand */
+static int runApply(int argc, const char** argv)
+{
+    bool dryRun = false;
+    const char* profileFile = nullptr;
+    for (int i = 1; i < argc; i++)
     {
-        param.type = OVCParamType::MEMORY_CLOCK;
-        param.partId = LAST_PERFLEVEL;
+        if (::strcmp(argv[i], "--help")==0 || ::strcmp(argv[i], "-?")==0)
+        {
+            std::cout << applyHelpString;
+            std::cout.flush();
+            return 0;
+        }
+        else if (::strcmp(argv[i], "--dry-run")==0 || ::strcmp(argv[i], "-n")==0)
+            dryRun = true;
+        else if (argv[i][0]=='-' && argv[i][1]!=0)
+            throw Error((std::string("Unknown apply option: '") + argv[i] + "'").c_str());
+        else if (profileFile==nullptr)
+            profileFile = argv[i];
+        else
+            throw Error("Only one profile can be applied");
     }
-    else if (name=="vcore")
+    if (profileFile==nullptr)
+        throw Error("Profile not supplied");
+    
+    std::vector<ProfileSection> sections;
+    if (::strcmp(profileFile, "-")==0)
+        parseProfile(std::cin, sections);
+    else
     {
-        param.type = OVCParamType::VDDC_VOLTAGE;
-        param.partId = LAST_PERFLEVEL;
+        std::ifstream ifs(profileFile);
+        if (!ifs)
+            throw Error(errno, "Can't open profile");
+        parseProfile(ifs, sections);
     }
-    else if (name=="fanspeed")
+    
+    ADLAdapters adl;
+    const int changesNum = applyProfile(adl.handle, adl.mainControl, adl.activeAdapters,
+                adl.adapterInfos.get(), sections, dryRun);
+    if (changesNum==0)
+        std::cout << "Profile is already applied" << std::endl;
+    else if (!dryRun)
+        std::cout << "Applied " << changesNum << " changes" << std::endl;
+    return 0;
+}
+
+/*
+ * Command session
+ */
+
+/* redirects standard output and error output to buffer while alive.
+ * Messages of parameters parsing and setting are returned in responses */
+class OutputCapture
+{
+private:
+    std::ostringstream buffer;
+    std::streambuf* oldCout;
+    std::streambuf* oldCerr;
+public:
+    OutputCapture() : oldCout(std::cout.rdbuf(buffer.rdbuf())),
+            oldCerr(std::cerr.rdbuf(buffer.rdbuf()))
+    { }
+    ~OutputCapture()
     {
-        param.type = OVCParamType::FAN_SPEED;
-        partIdSet = false;
+        std::cout.rdbuf(oldCout);
+        std::cerr.rdbuf(oldCerr);
     }
-    else if (name=="pwrctrl")
+    std::string getContent() const
+    { return buffer.str(); }
+};
+
+/* commands of session. ADL is initialized and adapter infos are fetched once,
+ * every command costs only ADL calls. Every response is single-line JSON object */
+class CommandSession
+{
+private:
+    const ATIADLHandle& handle;
+    const ADLMainControl& mainControl;
+    int adaptersNum;
+    const std::vector<int>& activeAdapters;
+    AdapterInfo* adapterInfos;
+    std::unique_ptr<AdapterWorkers> workers;
+    std::vector<AdapterSnapshot> snapshots;
+    std::vector<int> choosenAdapters;
+    std::vector<OVCParameter> ovcParams;
+    
+    void collect(const char* adaptersList, bool verbose);
+    void set(const char* params, ReportBuffer& out);
+public:
+    CommandSession(const ATIADLHandle& handle, const ADLMainControl& mainControl,
+            int adaptersNum, const std::vector<int>& activeAdapters,
+            AdapterInfo* adapterInfos, bool parallel)
+            : handle(handle), mainControl(mainControl), adaptersNum(adaptersNum),
+              activeAdapters(activeAdapters), adapterInfos(adapterInfos)
     {
-        param.type = OVCParamType::POWER_CONTROL;
-        partIdSet = false;
+        if (parallel)
+            workers = createAdapterWorkers(handle, mainControl, activeAdapters.size());
     }
-    else if (name=="icoreclk")
+    
+    // workers of parallel queries (null if queries are serial)
+    AdapterWorkers* getWorkers() const
+    { return workers.get(); }
+    
+    /* execute command line and append response to out (nothing for empty line).
+     * Returns false if session should be ended */
+    bool execute(const std::string& line, ReportBuffer& out);
+};
+
+// collect snapshots of adapters from list (all adapters if list is empty)
+void CommandSession::collect(const char* adaptersList, bool verbose)
+{
+    bool allAdapters = true;
+    if (*adaptersList!=0)
     {
-        param.type = OVCParamType::CORE_CLOCK;
-        partIdSet = true;
+        parseAdaptersList(adaptersList, choosenAdapters, allAdapters);
+        if (!allAdapters)
+            for (int adapterIndex: choosenAdapters)
+                if (adapterIndex>=int(activeAdapters.size()) || adapterIndex<0)
+                    throw Error("Some adapter indices out of range");
     }
-    else if (name=="imemclk")
+    collectAdapterSnapshots(handle, mainControl, adapterInfos, activeAdapters,
+                choosenAdapters, !allAdapters, verbose, workers.get(), snapshots);
+}
+
+static void appendJSONMessages(ReportBuffer& out, const std::string& messages)
+{
+    out.append(",\"messages\":[");
+    bool first = true;
+    size_t pos = 0;
+    while (pos < messages.size())
     {
-        param.type = OVCParamType::MEMORY_CLOCK;
-        partIdSet = true;
+        size_t end = messages.find('\n', pos);
+        if (end==std::string::npos)
+            end = messages.size();
+        if (end!=pos)
+        {
+            if (!first)
+                out.append(',');
+            out.appendJSONString(messages.substr(pos, end-pos).c_str());
+            first = false;
+        }
+        pos = end+1;
     }
-    else if (name=="ivcore")
+    out.append(']');
+}
+
+void CommandSession::set(const char* params, ReportBuffer& out)
+{
+    ovcParams.clear();
+    bool failed = false;
+    std::string errorMessage;
+    OutputCapture capture;
+    std::istringstream is(params);
+    std::string paramText;
+    while (is >> paramText)
     {
-        param.type = OVCParamType::VDDC_VOLTAGE;
-        partIdSet = true;
+        OVCParameter param;
+        if (parseOVCParameter(paramText.c_str(), param))
+            ovcParams.push_back(param);
+        else
+            failed = true;
     }
+    if (failed)
+        errorMessage = "Can't parse parameters";
+    else if (ovcParams.empty())
+        errorMessage = "No parameters given";
+    else
+        try
+        { setOVCParameters(handle, mainControl, adaptersNum, activeAdapters,
+                    ovcParams, false); }
+        catch(const std::exception& ex)
+        { errorMessage = ex.what(); }
+    
+    if (errorMessage.empty())
+        out.append("{\"ok\":true");
     else
     {
-        std::cout << "Wrong parameter name in '" << string << "'!" << std::endl;
-        return false;
+        out.append("{\"ok\":false,\"error\":");
+        out.appendJSONString(errorMessage.c_str());
     }
+    appendJSONMessages(out, capture.getContent());
+    out.append("}\n");
+}
+
+bool CommandSession::execute(const std::string& line, ReportBuffer& out)
+{
+    size_t start = line.find_first_not_of(" \t\r");
+    if (start==std::string::npos)
+        return true; // empty line
+    size_t end = line.find_first_of(" \t\r", start);
+    if (end==std::string::npos)
+        end = line.size();
+    const std::string command = line.substr(start, end-start);
+    size_t argsStart = line.find_first_not_of(" \t\r", end);
+    size_t argsEnd = line.find_last_not_of(" \t\r");
+    const std::string args = (argsStart!=std::string::npos) ?
+                line.substr(argsStart, argsEnd+1-argsStart) : std::string();
     
-    char* next;
-    if (*afterName==':')
-    {   // if is
-        afterName++;
-        try
+    if (command=="quit")
+        return false;
+    try
+    {
+        if (command=="get" || command=="snapshot")
         {
-            const char* afterList = ::strchr(afterName, ':');
-            if (afterList==nullptr)
-                afterList = ::strchr(afterName, '=');
-            if (afterList==nullptr)
-                afterList += strlen(afterName); // to end
-            if (afterList!=afterName)
-            {
-                std::string listString(afterName, afterList);
-                parseAdaptersList(listString.c_str(), param.adapters, param.allAdapters);
-                afterName = afterList;
-            }
+            collect(args.c_str(), command=="snapshot");
+            out.append("{\"ok\":true,");
+            formatAdaptersJSONFields(out, getReportTime(), snapshots);
+            out.append("}\n");
         }
-        catch(const Error& error)
+        else if (command=="set")
+            set(args.c_str(), out);
+        else
         {
-            std::cerr << "Can't parse adapter list for '" << string << "': " <<
-                        error.what() << std::endl;
-            return false;
+            out.append("{\"ok\":false,\"error\":");
+            out.appendJSONString(("Unknown command '" + command + "'").c_str());
+            out.append("}\n");
         }
     }
-    else if (*afterName==0)
+    catch(const std::exception& ex)
     {
-        std::cerr << "Unterminated parameter '" << string << "'!" << std::endl;
-        return false;
+        out.append("{\"ok\":false,\"error\":");
+        out.appendJSONString(ex.what());
+        out.append("}\n");
+    }
+    return true;
+}
+
+/* '--stdin' mode: read commands from standard input line by line
+ * and write responses to standard output */
+static void runStdinSession(CommandSession& session)
+{
+    std::cout.flush(); // responses are written directly to stdout
+    ReportBuffer response;
+    std::string line;
+    while (std::getline(std::cin, line))
+    {
+        response.clear();
+        if (!session.execute(line, response))
+            break;
+        response.writeTo(1);
     }
+}
+
+/*
+ * Daemon
+ */
+
+/* stream of samples of single adapter, sent to client every interval */
+struct DaemonSubscription
+{
+    int userIndex;
+    long long intervalMs;
+    long long nextMs;       // monotonic time of next sample
+};
+
+struct DaemonClient
+{
+    int fd;
+    uint32_t events;        // events registered in epoll
+    bool closing;           // close after output has been sent
+    bool closed;
+    std::string input;
+    std::string output;
+    size_t outputSent;
+    std::vector<DaemonSubscription> subscriptions;
+};
+
+/* daemon owning single command session, serves clients on Unix domain socket.
+ * Clients send same commands as in '--stdin' session and 'subscribe LIST INTERVAL',
+ * 'unsubscribe [LIST]'. Everything (also ADL calls) is done in single thread
+ * by epoll event loop, hence ADL access is serialized. Adapters due for streams
+ * are sampled once and sample is shared by all subscribed clients */
+class CommandDaemon
+{
+private:
+    CommandSession& session;
+    const ATIADLHandle& handle;
+    const ADLMainControl& mainControl;
+    const std::vector<int>& activeAdapters;
+    AdapterInfo* adapterInfos;
+    std::string socketPath;
+    int listenFd;
+    int epollFd;
+    std::unordered_map<int, DaemonClient> clients;
+    std::vector<int> dueAdapters;
+    std::vector<AdapterSnapshot> snapshots;
+    std::vector<AdapterSnapshot> streamSnapshot;
+    std::vector<std::string> streamLines;
     
-    if (*afterName==':' && !partIdSet)
+    void acceptClients();
+    void readClient(DaemonClient& client);
+    void writeClient(DaemonClient& client);
+    void processInput(DaemonClient& client);
+    bool executeCommand(DaemonClient& client, const std::string& line);
+    void subscribe(DaemonClient& client, const std::string& args, bool unsubscribe);
+    void updateEvents(DaemonClient& client);
+    long long sampleStreams(long long nowMs);
+public:
+    CommandDaemon(const char* socketPath, CommandSession& session,
+            const ATIADLHandle& handle, const ADLMainControl& mainControl,
+            const std::vector<int>& activeAdapters, AdapterInfo* adapterInfos);
+    ~CommandDaemon();
+    
+    // serve clients until stop has been requested
+    void serve();
+};
+
+static const size_t maxDaemonClients = 256;
+static const size_t maxDaemonLineSize = 65536;
+// client is not read and stream samples are dropped if more output is pending
+static const size_t maxDaemonOutputSize = 1<<20;
+static const double minStreamInterval = 0.01;
+
+static long long getMonotonicMs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000LL + ts.tv_nsec/1000000;
+}
+
+CommandDaemon::CommandDaemon(const char* socketPath, CommandSession& session,
+            const ATIADLHandle& handle, const ADLMainControl& mainControl,
+            const std::vector<int>& activeAdapters, AdapterInfo* adapterInfos)
+            : session(session), handle(handle), mainControl(mainControl),
+              activeAdapters(activeAdapters), adapterInfos(adapterInfos),
+              listenFd(-1), epollFd(-1), streamSnapshot(1)
+{
+    sockaddr_un sockAddr;
+    ::memset(&sockAddr, 0, sizeof(sockAddr));
+    sockAddr.sun_family = AF_UNIX;
+    if (::strlen(socketPath) >= sizeof(sockAddr.sun_path))
+        throw Error("Socket path is too long");
+    ::strcpy(sockAddr.sun_path, socketPath);
+    
+    listenFd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if (listenFd==-1)
+        throw Error(errno, "Can't create socket");
+    int ret = bind(listenFd, (const sockaddr*)&sockAddr, sizeof(sockAddr));
+    if (ret!=0 && errno==EADDRINUSE)
     {
-        afterName++;
-        errno = 0;
-        int value = strtol(afterName, &next, 10);
-        if (errno!=0)
+        // remove stale socket if no daemon listens on it
+        const int testFd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+        const bool running = testFd!=-1 &&
+                connect(testFd, (const sockaddr*)&sockAddr, sizeof(sockAddr))==0;
+        if (testFd!=-1)
+            close(testFd);
+        if (running)
         {
-            std::cerr << "Can't parse partId in '" << string << "'!" << std::endl;
-            return false;
+            close(listenFd);
+            throw Error("Other daemon listens on socket");
         }
-        if (afterName != next)
-            param.partId = value;
-        afterName = next;
+        ::unlink(socketPath);
+        ret = bind(listenFd, (const sockaddr*)&sockAddr, sizeof(sockAddr));
     }
-    else if (*afterName==0)
+    if (ret!=0 || chmod(socketPath, 0660)!=0 || listen(listenFd, 64)!=0)
     {
-        std::cerr << "Unterminated parameter '" << string << "'!" << std::endl;
-        return false;
+        const int error = errno;
+        close(listenFd);
+        throw Error(error, "Can't listen on socket");
     }
+    this->socketPath = socketPath;
     
-    if (*afterName=='=')
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd==-1)
     {
-        afterName++;
-        errno = 0;
-        if (::strcmp(afterName, "default")==0)
-        {
-            param.useDefault = true;
-            afterName += 7;
-        }
-        else
-        {
-            param.value = strtod(afterName, &next);
-            if (errno!=0 || afterName==next)
-            {
-                std::cerr << "Can't parse value in '" << string << "'!" << std::endl;
-                return false;
-            }
-            afterName = next;
-        }
-        if (*afterName!=0)
+        const int error = errno;
+        close(listenFd);
+        ::unlink(socketPath);
+        throw Error(error, "Can't create epoll");
+    }
+    epoll_event event;
+    ::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = listenFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+    if (stopEventFd!=-1)
+    {
+        event.data.fd = stopEventFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, stopEventFd, &event);
+    }
+}
+
+CommandDaemon::~CommandDaemon()
+{
+    for (const auto& entry: clients)
+        close(entry.first);
+    if (epollFd!=-1)
+        close(epollFd);
+    close(listenFd);
+    ::unlink(socketPath.c_str());
+}
+
+void CommandDaemon::acceptClients()
+{
+    while (true)
+    {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK|SOCK_CLOEXEC);
+        if (fd==-1)
+            return; // no more pending connections (or error)
+        epoll_event event;
+        ::memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (clients.size() >= maxDaemonClients ||
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event)!=0)
         {
-            std::cerr << "Garbages in '" << string << "'!" << std::endl;
-            return false;
+            close(fd);
+            continue;
         }
+        clients[fd] = DaemonClient{ fd, EPOLLIN, false, false, std::string(),
+                    std::string(), 0, { } };
     }
-    else
+}
+
+void CommandDaemon::updateEvents(DaemonClient& client)
+{
+    if (client.closed)
+        return;
+    const bool pending = client.outputSent < client.output.size();
+    if (client.closing && !pending)
     {
-        std::cerr << "Unterminated parameter '" << string << "'!" << std::endl;
-        return false;
+        client.closed = true; // everything has been sent
+        return;
     }
-    /*std::cout << "param: " << int(param.type) << ", dev: " << param.adapterIndex <<
-            ", pid: " << param.partId << ", value=" << param.value << std::endl;*/
-    return true;
+    const uint32_t events = ((client.closing || client.output.size() >=
+                maxDaemonOutputSize) ? 0 : EPOLLIN) | (pending ? EPOLLOUT : 0);
+    if (events==client.events)
+        return;
+    epoll_event event;
+    ::memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = client.fd;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, client.fd, &event);
+    client.events = events;
 }
 
-struct FanSpeedSetup
+void CommandDaemon::readClient(DaemonClient& client)
 {
-    double value;
-    bool useDefault;
-    bool isSet;
-};
+    char buf[4096];
+    const ssize_t readSize = read(client.fd, buf, 4096);
+    if (readSize<0)
+    {
+        if (errno!=EAGAIN && errno!=EINTR)
+            client.closed = true;
+        return;
+    }
+    if (readSize==0)
+        // end of requests, send pending responses before closing
+        client.closing = true;
+    else
+        client.input.append(buf, readSize);
+    processInput(client);
+}
 
-struct PowerControlSetup
+void CommandDaemon::processInput(DaemonClient& client)
 {
-    double value;
-    bool useDefault;
-    bool isSet;
-};
+    size_t pos = 0;
+    while (!client.closed && client.output.size() < maxDaemonOutputSize)
+    {
+        const size_t end = client.input.find('\n', pos);
+        if (end==std::string::npos)
+            break;
+        const bool quit = !executeCommand(client, client.input.substr(pos, end-pos));
+        pos = end+1;
+        if (quit)
+        {
+            // commands after 'quit' are ignored
+            client.closing = true;
+            pos = client.input.size();
+            break;
+        }
+    }
+    client.input.erase(0, pos);
+    if (client.input.size() > maxDaemonLineSize)
+        client.closed = true; // too long line
+}
 
-struct AdapterIterator
+void CommandDaemon::writeClient(DaemonClient& client)
 {
-    const std::vector<int>& adapters;
-    bool allAdapters;
-    int allAdaptersNum;
-    int position;
-    
-    AdapterIterator(const std::vector<int>& _adapters, bool _allAdapters,
-            int _allAdaptersNum) : adapters(_adapters), allAdapters(_allAdapters),
-            allAdaptersNum(_allAdaptersNum), position(0)
-    { }
-    
-    AdapterIterator& operator++()
+    while (client.outputSent < client.output.size())
     {
-        position++;
-        return *this;
+        // MSG_NOSIGNAL: closed connection must not kill program by SIGPIPE
+        const ssize_t written = send(client.fd, client.output.data() + client.outputSent,
+                    client.output.size() - client.outputSent, MSG_NOSIGNAL);
+        if (written<0)
+        {
+            if (errno!=EAGAIN && errno!=EINTR)
+                client.closed = true;
+            break;
+        }
+        client.outputSent += written;
     }
-    
-    operator bool() const
+    if (client.outputSent == client.output.size())
     {
-        return (!allAdapters && position < int(adapters.size())) ||
-                (allAdapters && position < allAdaptersNum);
+        client.output.clear();
+        client.outputSent = 0;
     }
-    bool operator!() const
+    else if (client.outputSent >= maxDaemonOutputSize)
     {
-        return !((!allAdapters && position < int(adapters.size())) ||
-                (allAdapters && position < allAdaptersNum));
+        client.output.erase(0, client.outputSent);
+        client.outputSent = 0;
     }
-    int operator*() const
-    { return allAdapters ? position : adapters[position]; }
-};
+    if (!client.input.empty() && client.output.size() < maxDaemonOutputSize)
+        processInput(client); // execute commands held back by full output
+}
 
-static void setOVCParameters(ADLMainControl& mainControl, int adaptersNum,
-            const std::vector<int>& activeAdapters,
-            const std::vector<OVCParameter>& ovcParams)
+static void appendJSONError(std::string& out, const char* message)
 {
-    std::cout << "WARNING: setting AMD Overdrive parameters!" << std::endl;
-    std::cout <<
-        "\nIMPORTANT NOTICE: Before any setting of AMD Overdrive parameters,\n"
-        "please STOP ANY GPU computations and GPU renderings.\n"
-        "Please use this utility CAREFULLY, because it can DAMAGE your hardware!\n" 
-        << std::endl;
-    
-    const int realAdaptersNum = activeAdapters.size();
-    std::vector<ADLODParameters> odParams(realAdaptersNum);
-    std::vector<std::vector<ADLODPerformanceLevel> > perfLevels(realAdaptersNum);
-    std::vector<std::vector<ADLODPerformanceLevel> > defaultPerfLevels(realAdaptersNum);
-    std::vector<bool> changedDevices(realAdaptersNum);
-    std::fill(changedDevices.begin(), changedDevices.end(), false);
+    ReportBuffer response;
+    response.append("{\"ok\":false,\"error\":");
+    response.appendJSONString(message);
+    response.append("}\n");
+    out += response.getContent();
+}
+
+void CommandDaemon::subscribe(DaemonClient& client, const std::string& args,
+            bool unsubscribe)
+{
+    std::istringstream is(args);
+    std::string listString, intervalString, garbage;
+    is >> listString >> intervalString >> garbage;
+    if (!garbage.empty() || (unsubscribe && !intervalString.empty()))
+        throw Error("Garbages after arguments");
+    std::vector<int> adapters;
+    bool allAdapters = true;
+    if (!listString.empty())
+        parseAdaptersList(listString.c_str(), adapters, allAdapters);
+    if (allAdapters)
+    {
+        adapters.clear();
+        for (int i = 0; i < int(activeAdapters.size()); i++)
+            adapters.push_back(i);
+    }
+    for (int adapterIndex: adapters)
+        if (adapterIndex>=int(activeAdapters.size()) || adapterIndex<0)
+            throw Error("Some adapter indices out of range");
     
-    bool failed = false;
-    for (OVCParameter param: ovcParams)
-        if (!param.allAdapters)
+    std::vector<DaemonSubscription>& subscriptions = client.subscriptions;
+    // remove previous subscriptions of adapters (replaced by new subscriptions)
+    size_t kept = 0;
+    for (size_t i = 0; i < subscriptions.size(); i++)
+        if (!std::binary_search(adapters.begin(), adapters.end(),
+                    subscriptions[i].userIndex))
+            subscriptions[kept++] = subscriptions[i];
+    subscriptions.resize(kept);
+    if (!unsubscribe)
+    {
+        if (intervalString.empty())
+            throw Error("Stream interval not supplied");
+        const double interval = parseInterval(intervalString.c_str());
+        if (interval < minStreamInterval)
+            throw Error("Stream interval out of range");
+        const long long nowMs = getMonotonicMs();
+        for (int adapterIndex: adapters)
+            subscriptions.push_back(DaemonSubscription{ adapterIndex,
+                    (long long)round(interval*1000.0), nowMs });
+    }
+    client.output += "{\"ok\":true}\n";
+}
+
+// returns false if client ends session
+bool CommandDaemon::executeCommand(DaemonClient& client, const std::string& line)
+{
+    const size_t start = line.find_first_not_of(" \t\r");
+    const size_t end = (start!=std::string::npos) ?
+                line.find_first_of(" \t\r", start) : std::string::npos;
+    const std::string command = (start!=std::string::npos) ?
+                line.substr(start, end-start) : std::string();
+    if (command=="subscribe" || command=="unsubscribe")
+    {
+        try
         {
-            bool listFailed = false;
-            for (int adapterIndex: param.adapters)
-                if (!listFailed && (adapterIndex>=realAdaptersNum || adapterIndex<0))
-                {
-                    std::cerr << "Some adapter indices out of range in '" <<
-                                    param.argText << "'!" << std::endl;
-                    listFailed = failed = true;
-                }
+            subscribe(client, (end!=std::string::npos) ? line.substr(end) : std::string(),
+                    command=="unsubscribe");
         }
-    
-    // check fanspeed
-    for (OVCParameter param: ovcParams)
-        if (param.type==OVCParamType::FAN_SPEED)
+        catch(const std::exception& ex)
+        { appendJSONError(client.output, ex.what()); }
+        return true;
+    }
+    ReportBuffer response;
+    const bool keep = session.execute(line, response);
+    client.output += response.getContent();
+    return keep;
+}
+
+/* sample adapters due for streams and append samples to clients.
+ * Returns monotonic time of next due stream (or -1 if no streams) */
+long long CommandDaemon::sampleStreams(long long nowMs)
+{
+    dueAdapters.clear();
+    for (const auto& entry: clients)
+        for (const DaemonSubscription& subscription: entry.second.subscriptions)
+            if (subscription.nextMs <= nowMs)
+                dueAdapters.push_back(subscription.userIndex);
+    if (!dueAdapters.empty())
+    {
+        std::sort(dueAdapters.begin(), dueAdapters.end());
+        dueAdapters.resize(std::unique(dueAdapters.begin(), dueAdapters.end()) -
+                    dueAdapters.begin());
+        // single sampling of every due adapter
+        streamLines.resize(dueAdapters.size());
+        ReportBuffer line;
+        try
         {
-            if(param.partId!=0)
-            {
-                std::cerr << "Thermal Control Index is not 0 in '" <<
-                        param.argText << "'!" << std::endl;
-                failed = true;
-            }
-            if(!param.useDefault && (param.value<0.0 || param.value>100.0))
+            collectAdapterSnapshots(handle, mainControl, adapterInfos, activeAdapters,
+                        dueAdapters, true, false, session.getWorkers(), snapshots);
+            const long timeMs = getReportTime();
+            for (size_t k = 0; k < dueAdapters.size(); k++)
             {
-                std::cerr << "FanSpeed value out of range in '" <<
-                        param.argText << "'!" << std::endl;
-                failed = true;
+                line.clear();
+                line.append("{\"stream\":");
+                line.appendInt(dueAdapters[k]);
+                line.append(',');
+                streamSnapshot[0] = snapshots[k];
+                formatAdaptersJSONFields(line, timeMs, streamSnapshot);
+                line.append("}\n");
+                streamLines[k] = line.getContent();
             }
         }
-
-    // check powercontrol
-    for (OVCParameter param: ovcParams)
-        if (param.type==OVCParamType::POWER_CONTROL)
+        catch(const std::exception& ex)
         {
-            if(param.partId!=0)
-            {
-                std::cerr << "Thermal Control Index is not 0 in '" <<
-                        param.argText << "'!" << std::endl;
-                failed = true;
-            }
-            // restrict to +20%
-            if(!param.useDefault && (param.value<-50.0 || param.value>20.0))
+            for (size_t k = 0; k < dueAdapters.size(); k++)
             {
-                std::cerr << "PowerControl value out of range in '" <<
-                        param.argText << "'!" << std::endl;
-                failed = true;
+                line.clear();
+                line.append("{\"stream\":");
+                line.appendInt(dueAdapters[k]);
+                line.append(",\"error\":");
+                line.appendJSONString(ex.what());
+                line.append("}\n");
+                streamLines[k] = line.getContent();
             }
         }
-
-    for (int ai = 0; ai < realAdaptersNum; ai++)
-    {
-        int i = activeAdapters[ai];
-        mainControl.getODParameters(i, odParams[ai]);
-        perfLevels[ai].resize(odParams[ai].iNumberOfPerformanceLevels);
-        defaultPerfLevels[ai].resize(odParams[ai].iNumberOfPerformanceLevels);
-        mainControl.getODPerformanceLevels(i, 0, odParams[ai].iNumberOfPerformanceLevels,
-                    perfLevels[ai].data());
-        mainControl.getODPerformanceLevels(i, 1, odParams[ai].iNumberOfPerformanceLevels,
-                    defaultPerfLevels[ai].data());
     }
     
-    // check other params
-    for (OVCParameter param: ovcParams)
-        if ((param.type!=OVCParamType::FAN_SPEED) && (param.type!=OVCParamType::POWER_CONTROL))
-            for (AdapterIterator ait(param.adapters, param.allAdapters, realAdaptersNum);
-                        ait; ++ait)
-            {
-                int i = *ait;
-                if (i>=realAdaptersNum)
-                    continue;
-                int partId = (param.partId!=LAST_PERFLEVEL)?param.partId:
-                        odParams[i].iNumberOfPerformanceLevels-1;
-                if (partId >= odParams[i].iNumberOfPerformanceLevels || partId < 0)
-                {
-                    std::cerr << "Performance level out of range in '" <<
-                            param.argText << "'!" << std::endl;
-                    failed = true;
-                    continue;
-                }
-                switch(param.type)
-                {
-                    case OVCParamType::CORE_CLOCK:
-                        if (!param.useDefault &&
-                            (param.value < odParams[i].sEngineClock.iMin/100.0 ||
-                            param.value > odParams[i].sEngineClock.iMax/100.0))
-                        {
-                            std::cerr << "Core clock out of range in '" <<
-                                    param.argText << "'!" << std::endl;
-                            failed = true;
-                        }
-                        break;
-                    case OVCParamType::MEMORY_CLOCK:
-                        if (!param.useDefault &&
-                            (param.value < odParams[i].sMemoryClock.iMin/100.0 ||
-                            param.value > odParams[i].sMemoryClock.iMax/100.0))
-                        {
-                            std::cerr << "Memory clock out of range in '" <<
-                                    param.argText << "'!" << std::endl;
-                            failed = true;
-                        }
-                        break;
-                    case OVCParamType::VDDC_VOLTAGE:
-                        if (!param.useDefault &&
-                            (param.value < odParams[i].sVddc.iMin/1000.0 ||
-                            param.value > odParams[i].sVddc.iMax/1000.0))
-                        {
-                            std::cerr << "Voltage out of range in '" <<
-                                    param.argText << "'!" << std::endl;
-                            failed = true;
-                        }
-                        break;
-                    default:
-                        break;
-                }
-            }
-    if (failed)
+    long long nextDueMs = -1;
+    for (auto& entry: clients)
     {
-        std::cerr << "NO ANY settings applied. Error in parameters!" << std::endl;
-        throw Error("Wrong parameters!");
-    }
-    // print what has been changed
-    for (OVCParameter param: ovcParams)
-        if (param.type==OVCParamType::FAN_SPEED)
-            for (AdapterIterator ait(param.adapters, param.allAdapters, realAdaptersNum);
-                        ait; ++ait)
-            {
-                std::cout << "Setting fanspeed to ";
-                if (param.useDefault)
-                    std::cout << "default";
-                else
-                    std::cout << param.value << "%";
-                std::cout << " for adapter " << *ait << " at thermal controller " <<
-                        param.partId << std::endl;
-            }
-    for (OVCParameter param: ovcParams)
-        if (param.type==OVCParamType::POWER_CONTROL)
-            for (AdapterIterator ait(param.adapters, param.allAdapters, realAdaptersNum);
-                        ait; ++ait)
-            {
-                std::cout << "Setting powercontrol to ";
-                if (param.useDefault)
-                    std::cout << "default";
-                else
-                    std::cout << std::showpos << param.value << "%" << std::noshowpos;
-                std::cout << " for adapter " << *ait << " at thermal controller " <<
-                        param.partId << std::endl;
-            }
-    for (OVCParameter param: ovcParams)
-        if ((param.type!=OVCParamType::FAN_SPEED) && (param.type!=OVCParamType::POWER_CONTROL))
-            for (AdapterIterator ait(param.adapters, param.allAdapters, realAdaptersNum);
-                        ait; ++ait)
+        DaemonClient& client = entry.second;
+        for (DaemonSubscription& subscription: client.subscriptions)
+        {
+            if (subscription.nextMs <= nowMs)
             {
-                int i = *ait;
-                int partId = (param.partId!=LAST_PERFLEVEL)?param.partId:
-                        odParams[i].iNumberOfPerformanceLevels-1;
-                switch(param.type)
+                // slow clients lose samples instead of growing output
+                if (client.output.size() < maxDaemonOutputSize && !client.closing)
                 {
-                    case OVCParamType::CORE_CLOCK:
-                        std::cout << "Setting core clock to ";
-                        if (param.useDefault)
-                            std::cout << "default";
-                        else
-                            std::cout << param.value << " MHz";
-                        std::cout << " for adapter " << i <<
-                                " at performance level " << partId << std::endl;
-                        break;
-                    case OVCParamType::MEMORY_CLOCK:
-                        std::cout << "Setting memory clock to ";
-                        if (param.useDefault)
-                            std::cout << "default";
-                        else
-                            std::cout << param.value << " MHz";
-                        std::cout << " for adapter " << i <<
-                                " at performance level " << partId << std::endl;
-                        break;
-                    case OVCParamType::VDDC_VOLTAGE:
-                        std::cout << "Setting Vddc voltage to ";
-                        if (param.useDefault)
-                            std::cout << "default";
-                        else
-                            std::cout << param.value << " V";
-                        std::cout << " for adapter " << i <<
-                                " at performance level " << partId << std::endl;
-                        break;
-                    default:
-                        break;
+                    const size_t k = std::lower_bound(dueAdapters.begin(),
+                            dueAdapters.end(), subscription.userIndex) -
+                            dueAdapters.begin();
+                    client.output += streamLines[k];
                 }
+                subscription.nextMs += subscription.intervalMs;
+                if (subscription.nextMs <= nowMs) // overrun, skip missed samples
+                    subscription.nextMs += ((nowMs-subscription.nextMs) /
+                            subscription.intervalMs + 1)*subscription.intervalMs;
             }
-    
-    std::vector<FanSpeedSetup> fanSpeedSetups(realAdaptersNum);
-    std::fill(fanSpeedSetups.begin(), fanSpeedSetups.end(),
-              FanSpeedSetup{ 0.0, false, false });
-    for (OVCParameter param: ovcParams)
-        if (param.type==OVCParamType::FAN_SPEED)
-            for (AdapterIterator ait(param.adapters, param.allAdapters, realAdaptersNum);
-                        ait; ++ait)
-            {
-                fanSpeedSetups[*ait].value = param.value;
-                fanSpeedSetups[*ait].useDefault = param.useDefault;
-                fanSpeedSetups[*ait].isSet = true;
-            }
+            if (nextDueMs==-1 || subscription.nextMs < nextDueMs)
+                nextDueMs = subscription.nextMs;
+        }
+    }
+    return nextDueMs;
+}
 
-    std::vector<PowerControlSetup> powerControlSetups(realAdaptersNum);
-    std::fill(powerControlSetups.begin(), powerControlSetups.end(),
-              PowerControlSetup{ 0.0, false, false });
-    for (OVCParameter param: ovcParams)
-        if (param.type==OVCParamType::POWER_CONTROL)
-            for (AdapterIterator ait(param.adapters, param.allAdapters, realAdaptersNum);
-                        ait; ++ait)
+void CommandDaemon::serve()
+{
+    std::vector<epoll_event> events(64);
+    long long nextDueMs = -1;
+    while (!stopRequested)
+    {
+        // timeout: check stop and due streams
+        int timeout = 500;
+        if (nextDueMs!=-1)
+            timeout = int(std::max(0LL, std::min(500LL, nextDueMs-getMonotonicMs())));
+        const int eventsNum = epoll_wait(epollFd, events.data(), events.size(), timeout);
+        if (eventsNum<0)
+        {
+            if (errno==EINTR)
+                continue;
+            throw Error(errno, "epoll error");
+        }
+        for (int i = 0; i < eventsNum; i++)
+        {
+            const epoll_event& event = events[i];
+            if (event.data.fd==listenFd)
             {
-                powerControlSetups[*ait].value = param.value;
-                powerControlSetups[*ait].useDefault = param.useDefault;
-                powerControlSetups[*ait].isSet = true;
+                acceptClients();
+                continue;
             }
-
-    for (OVCParameter param: ovcParams)
-        if ((param.type!=OVCParamType::FAN_SPEED) && (param.type!=OVCParamType::POWER_CONTROL))
-            for (AdapterIterator ait(param.adapters, param.allAdapters, realAdaptersNum);
-                        ait; ++ait)
+            if (event.data.fd==stopEventFd)
+                continue; // loop ends by stop request
+            auto it = clients.find(event.data.fd);
+            if (it==clients.end() || it->second.closed)
+                continue;
+            DaemonClient& client = it->second;
+            if (event.events & (EPOLLIN|EPOLLHUP|EPOLLERR))
+                readClient(client);
+            if (!client.closed && (event.events & EPOLLOUT))
+                writeClient(client);
+        }
+        nextDueMs = sampleStreams(getMonotonicMs());
+        // closed clients are removed after all events to avoid reusing their fds
+        for (auto it = clients.begin(); it != clients.end();)
+        {
+            DaemonClient& client = it->second;
+            if (!client.closed && client.outputSent < client.output.size() &&
+                !(client.events & EPOLLOUT))
+                writeClient(client); // try to send new output immediately
+            updateEvents(client);
+            if (client.closed)
             {
-                int i = *ait;
-                int partId = (param.partId!=LAST_PERFLEVEL)?param.partId:
-                        odParams[i].iNumberOfPerformanceLevels-1;
-                ADLODPerformanceLevel& perfLevel = perfLevels[i][partId];
-                const ADLODPerformanceLevel& defaultPerfLevel = defaultPerfLevels[i][partId];
-                switch(param.type)
-                {
-                    case OVCParamType::CORE_CLOCK:
-                        if (param.useDefault)
-                            perfLevel.iEngineClock = defaultPerfLevel.iEngineClock;
-                        else
-                            perfLevel.iEngineClock = int(round(param.value*100.0));
-                        break;
-                    case OVCParamType::MEMORY_CLOCK:
-                        if (param.useDefault)
-                            perfLevel.iMemoryClock = defaultPerfLevel.iMemoryClock;
-                        else
-                            perfLevel.iMemoryClock = int(round(param.value*100.0));
-                        break;
-                    case OVCParamType::VDDC_VOLTAGE:
-                        if (param.useDefault)
-                            perfLevel.iVddc = defaultPerfLevel.iVddc;
-                        else if (perfLevel.iVddc==0)
-                            std::cout << "Voltage for adapter " << i <<
-                                        " is not set!" << std::endl;
-                        else
-                            perfLevel.iVddc = int(round(param.value*1000.0));
-                        break;
-                    default:
-                        break;
-                }
-                changedDevices[i] = true;
+                close(client.fd);
+                it = clients.erase(it);
             }
-    /// set fan speeds
-    for (int i = 0; i < realAdaptersNum; i++)
-        if (fanSpeedSetups[i].isSet)
-        {
-            if (!fanSpeedSetups[i].useDefault)
-                mainControl.setFanSpeed(activeAdapters[i], 0 /* must be zero */,
-                                int(round(fanSpeedSetups[i].value)));
             else
-                mainControl.setFanSpeedToDefault(activeAdapters[i], 0);
+                ++it;
         }
+    }
+}
 
-    /// set power controls
-    for (int i = 0; i < realAdaptersNum; i++)
-        if (powerControlSetups[i].isSet)
+static const char* daemonHelpString =
+"Usage: amdcovc daemon [--socket=PATH] [--parallel]\n"
+"       amdcovcd [--socket=PATH] [--parallel]\n"
+"Own single ADL session and serve clients on Unix domain socket. Clients send\n"
+"commands, one per line, and get single-line JSON responses. Commands are same\n"
+"as in 'amdcovc --stdin' session ('get [LIST]', 'snapshot [LIST]',\n"
+"'set PARAM ...', 'quit') and:\n"
+"  subscribe LIST INTERVAL   send samples of adapters from LIST every INTERVAL\n"
+"                            seconds, as '{\"stream\":INDEX,\"time\":...,\n"
+"                            \"adapters\":[...]}' lines\n"
+"  unsubscribe [LIST]        stop streams of adapters from LIST (default all)\n"
+"Commands of all clients are executed one by one. Adapters are sampled once\n"
+"for all clients subscribed at same time.\n"
+"\n"
+"List of options:\n"
+"      --socket=PATH         path of socket (default /run/amdcovcd.sock)\n"
+"      --parallel            query adapters in parallel (requires ADL2 API)\n";
+
+/* 'amdcovc daemon' subcommand (also program invoked as 'amdcovcd') */
+static int runDaemon(int argc, const char** argv)
+{
+    const char* socketPath = "/run/amdcovcd.sock";
+    bool parallel = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (::strcmp(argv[i], "--help")==0 || ::strcmp(argv[i], "-?")==0)
         {
-            if (!powerControlSetups[i].useDefault)
-                mainControl.setPowerControl(activeAdapters[i],
-                                int(round(powerControlSetups[i].value)));
-            else
-            {
-                int pwrCtrlVal, pwrCtrlDef;
-                mainControl.getPowerControl(activeAdapters[i], pwrCtrlVal, pwrCtrlDef);
-                mainControl.setPowerControl(activeAdapters[i], pwrCtrlDef);
-            }
+            std::cout << daemonHelpString;
+            std::cout.flush();
+            return 0;
         }
-
-    // set od perflevels
-    for (int i = 0; i < realAdaptersNum; i++)
-        if (changedDevices[i])
-            mainControl.setODPerformanceLevels(activeAdapters[i],
-                    odParams[i].iNumberOfPerformanceLevels, perfLevels[i].data());
+        else if (::strncmp(argv[i], "--socket=", 9)==0)
+            socketPath = argv[i]+9;
+        else if (::strcmp(argv[i], "--parallel")==0)
+            parallel = true;
+        else
+            throw Error((std::string("Unknown daemon option: '") + argv[i] + "'").c_str());
+    }
+    
+    ADLAdapters adl;
+    CommandSession session(adl.handle, adl.mainControl, adl.adaptersNum,
+                adl.activeAdapters, adl.adapterInfos.get(), parallel);
+    installStopHandlers();
+    CommandDaemon daemon(socketPath, session, adl.handle, adl.mainControl,
+                adl.activeAdapters, adl.adapterInfos.get());
+    daemon.serve();
+    cleanupPCIAccess();
+    return 0;
 }
 
 static const char* helpAndUsageString =
@@ -1407,7 +7577,17 @@ static const char* helpAndUsageString =
 "Program is distributed under terms of the GPLv2.\n"
 "Program available at https://github.com/matszpk/amdcovc.\n"
 "\n"
-"Usage: amdcovc [--help|-?] [--verbose|-v] [-a LIST|--adapters=LIST] [PARAM ...]\n"
+"Usage: amdcovc [--help|-?] [--verbose|-v] [-a LIST|--adapters=LIST]\n"
+"               [--watch=INTERVAL] [--format=FORMAT] [--exporter=HOST:PORT]\n"
+"               [--shm[=NAME]] [--read-shm[=NAME]] [--history=FILE] [--parallel]\n"
+"               [--early-cl-init] [--fan-control=TEMP] [--thermal-governor=TEMP]\n"
+"               [--mem-governor=CLOCK] [--power-budget=WATTS]\n"
+"               [--params-from=FILE] [--stdin] [PARAM ...]\n"
+"       amdcovc query --history=FILE [QUERY OPTIONS]\n"
+"       amdcovc tune --eval=COMMAND [TUNE OPTIONS]\n"
+"       amdcovc sweep --output=FILE [SWEEP OPTIONS]\n"
+"       amdcovc apply [--dry-run] PROFILE\n"
+"       amdcovc daemon [--socket=PATH] [--parallel]\n"
 "Print AMD Overdrive informations if no parameter given.\n"
 "Set AMD Overdrive parameters (clocks, fanspeeds,...) if any parameter given.\n"
 "\n"
@@ -1430,9 +7610,63 @@ static const char* helpAndUsageString =
 "List of options:\n"
 "  -a, --adapters=LIST       print informations only for these adapters\n"
 "  -v, --verbose             print verbose informations\n"
+"  -w, --watch=INTERVAL      print informations periodically every INTERVAL seconds\n"
+"      --format=FORMAT       output format: text (default), json, csv or tsv.\n"
+"                            json, csv and tsv formats include verbose informations\n"
+"      --exporter=HOST:PORT  serve metrics for Prometheus at http://HOST:PORT/metrics,\n"
+"                            adapters are sampled every watch INTERVAL (default 5)\n"
+"      --shm[=NAME]          publish samples to shared memory NAME (default /amdcovc)\n"
+"                            every watch INTERVAL (default 1), can be used with\n"
+"                            '--exporter'\n"
+"      --read-shm[=NAME]     print latest samples from shared memory (without ADL)\n"
+"      --history=FILE        record samples to history FILE (raw, 1-minute and\n"
+"                            1-hour rings)\n"
+"      --fan-control=TEMP    control fan speeds by PID controller to keep temperature\n"
+"                            TEMP (in Celsius), adapters are sampled every watch\n"
+"                            INTERVAL (default 2). Default fan control is restored\n"
+"                            at exit\n"
+"      --fan-pid=KP,KI,KD    PID parameters of fan control (default 4,0.2,1)\n"
+"      --fan-slew=PERCENT    maximal fan speed change per second (default 5)\n"
+"      --thermal-governor=TEMP  lower core clock of top performance level by steps\n"
+"                            if temperature is above TEMP, raise it back if\n"
+"                            temperature is below TEMP minus hysteresis.\n"
+"                            Performance levels are restored at exit\n"
+"      --thermal-hysteresis=DEGREES  hysteresis of thermal governor (default 3)\n"
+"      --thermal-step=CLOCK  core clock step in MHz (default is 1% of clock)\n"
+"      --thermal-max-trim=PERCENT  maximal lowering of core clock (default 10)\n"
+"      --thermal-write-interval=SECONDS  minimal time between changes (default 5)\n"
+"      --mem-governor=CLOCK  lower memory clock of top performance level to CLOCK\n"
+"                            (in MHz) if load is low for some time, restore it\n"
+"                            if load is higher. Performance levels are restored\n"
+"                            at exit\n"
+"      --mem-idle-load=PERCENT  load below which adapter is idle (default 10)\n"
+"      --mem-idle-time=SECONDS  time of low load before lowering (default 30)\n"
+"      --power-budget=WATTS  divide total power budget between adapters by setting\n"
+"                            core clocks of top performance levels and\n"
+"                            PowerControl. Settings are restored at exit\n"
+"      --power-model=IDLE,COEFF  estimated power: IDLE + COEFF*Vddc^2*clock*load\n"
+"                            in Watts, Volts and GHz (default 20,110)\n"
+"      --power-tick=SECONDS  time between rebalancing of budget (default 10)\n"
+"      --parallel            query adapters in parallel (requires ADL2 API)\n"
+"      --early-cl-init       initialize GPU devices by OpenCL in background\n"
+"                            (only if no X11 server and devices are not created)\n"
+"      --params-from=FILE    read parameters from FILE (or standard input if FILE\n"
+"                            is '-'), separated by whitespaces. Comments start\n"
+"                            with '#'\n"
+"      --stdin               execute commands from standard input, one per line,\n"
+"                            and print single-line JSON response to each command.\n"
+"                            Commands: 'get [LIST]', 'snapshot [LIST]',\n"
+"                            'set PARAM ...' and 'quit'\n"
 "      --version             print version\n"
 "  -?, --help                print help\n"
 "\n"
+"Statistics of history file are printed by 'amdcovc query'\n"
+"(see 'amdcovc query --help'). Settings are tuned by 'amdcovc tune'\n"
+"(see 'amdcovc tune --help'). Grids of settings are measured by 'amdcovc sweep'\n"
+"(see 'amdcovc sweep --help'). Profile files are applied by 'amdcovc apply'\n"
+"(see 'amdcovc apply --help'). Daemon serving clients on Unix domain socket\n"
+"is run by 'amdcovc daemon' or 'amdcovcd' (see 'amdcovc daemon --help').\n"
+"\n"
 "Adapter list specified in parameters and '--adapter' option is comma-separated list\n"
 "with ranges 'first-last' or 'all'. Examples: 'all', '0-2', '0,1,3-5'\n"
 "\n"
@@ -1441,6 +7675,14 @@ static const char* helpAndUsageString =
 "    print short informations about state of the all adapters\n"
 "amdcovc -a 1,2,4-6\n"
 "    print short informations about adapter 1, 2 and 4 to 6\n"
+"amdcovc --watch=2\n"
+"    print short informations about all adapters every 2 seconds\n"
+"amdcovc --format=json\n"
+"    print all informations about all adapters as JSON\n"
+"amdcovc --exporter=127.0.0.1:9400\n"
+"    serve metrics of all adapters for Prometheus at port 9400\n"
+"amdcovc --shm --watch=0.5\n"
+"    publish samples of all adapters to shared memory every 0.5 second\n"
 "amdcovc coreclk:1=900 coreclk=1000\n"
 "    set core clock to 900 for adapter 1, set core clock to 1000 for adapter 0\n"
 "amdcovc coreclk:1:0=900 coreclk:0:1=1000\n"
@@ -1461,15 +7703,59 @@ static const char* helpAndUsageString =
 "\n"
 "If no X11 server is running, then this program requires root privileges.\n";
 
+#ifndef AMDCOVC_NO_MAIN
 int main(int argc, const char** argv)
 try
 {
+    // device files are looked up under sysroot if it is given
+    const char* sysRootEnv = getenv("AMDCOVC_SYSROOT");
+    if (sysRootEnv!=nullptr)
+        sysRoot = sysRootEnv;
+    
+    if (argc >= 2 && ::strcmp(argv[1], "query")==0)
+        return runHistoryQuery(argc-1, argv+1);
+    if (argc >= 2 && ::strcmp(argv[1], "tune")==0)
+        return runTune(argc-1, argv+1);
+    if (argc >= 2 && ::strcmp(argv[1], "sweep")==0)
+        return runSweep(argc-1, argv+1);
+    if (argc >= 2 && ::strcmp(argv[1], "apply")==0)
+        return runApply(argc-1, argv+1);
+    if (argc >= 2 && ::strcmp(argv[1], "daemon")==0)
+        return runDaemon(argc-1, argv+1);
+    const char* programName = ::strrchr(argv[0], '/');
+    if (::strcmp((programName!=nullptr) ? programName+1 : argv[0], "amdcovcd")==0)
+        return runDaemon(argc, argv);
+    
     bool printHelp = false;
     bool printVerbose = false;
     std::vector<OVCParameter> ovcParameters;
-    std::vector<int> choosenAdapters;
-    bool useAdaptersList = false;
-    bool chooseAllAdapters = false;
+    AdaptersOption adaptersOption;
+    double watchInterval = 0.0;
+    bool parallelQueries = false;
+    bool useStdin = false;
+    OutputFormat outputFormat = OutputFormat::TEXT;
+    const char* exporterAddress = nullptr;
+    bool useShm = false;
+    const char* shmName = nullptr;
+    bool readShm = false;
+    const char* historyFile = nullptr;
+    bool useFanControl = false;
+    double fanTargetTemperature = 0.0;
+    PIDParameters fanPID = { 4.0, 0.2, 1.0 };
+    double fanSlewRate = 5.0;
+    bool useThermalGovernor = false;
+    double thermalLimit = 0.0;
+    double thermalHysteresis = 3.0;
+    int thermalStep = 0;
+    double thermalMaxTrim = 10.0;
+    double thermalWriteInterval = 5.0;
+    bool useMemoryGovernor = false;
+    int memoryIdleClock = 0;
+    int memoryIdleLoad = 10;
+    double memoryIdleTime = 30.0;
+    double powerBudget = 0.0;
+    PowerModel powerModel = { 20.0, 110.0 };
+    double powerTick = 10.0;
     
     bool failed = false;
     for (int i = 1; i < argc; i++)
@@ -1477,31 +7763,131 @@ try
             printHelp = true;
         else if (::strcmp(argv[i], "--verbose")==0 || ::strcmp(argv[i], "-v")==0)
             printVerbose = true;
-        else if (::strncmp(argv[i], "--adapters=", 11)==0)
+        else if (adaptersOption.parse(argc, argv, i))
+            continue;
+        else if (::strcmp(argv[i], "--parallel")==0)
+            parallelQueries = true;
+        else if (::strcmp(argv[i], "--early-cl-init")==0)
+            // initialization runs while rest of arguments are being parsed
+            openCLInitializer.start(0);
+        else if (::strncmp(argv[i], "--format=", 9)==0)
+            outputFormat = parseOutputFormat(argv[i]+9);
+        else if (::strcmp(argv[i], "--format")==0)
+        {
+            if (i+1 < argc)
+                outputFormat = parseOutputFormat(argv[++i]);
+            else
+                throw Error("Output format not supplied");
+        }
+        else if (::strncmp(argv[i], "--exporter=", 11)==0)
+            exporterAddress = argv[i]+11;
+        else if (::strcmp(argv[i], "--exporter")==0)
+        {
+            if (i+1 < argc)
+                exporterAddress = argv[++i];
+            else
+                throw Error("Exporter address not supplied");
+        }
+        else if (::strcmp(argv[i], "--shm")==0)
+            useShm = true;
+        else if (::strncmp(argv[i], "--shm=", 6)==0)
+        {
+            useShm = true;
+            shmName = argv[i]+6;
+        }
+        else if (::strcmp(argv[i], "--read-shm")==0)
+            readShm = true;
+        else if (::strncmp(argv[i], "--read-shm=", 11)==0)
         {
-            parseAdaptersList(argv[i]+11, choosenAdapters, chooseAllAdapters);
-            useAdaptersList = true;
+            readShm = true;
+            shmName = argv[i]+11;
         }
-        else if (::strcmp(argv[i], "--adapters")==0)
+        else if (::strncmp(argv[i], "--history=", 10)==0)
+            historyFile = argv[i]+10;
+        else if (::strcmp(argv[i], "--history")==0)
         {
             if (i+1 < argc)
-            {
-                parseAdaptersList(argv[++i], choosenAdapters, chooseAllAdapters);
-                useAdaptersList = true;
-            }
+                historyFile = argv[++i];
             else
-                throw Error("Adapter list not supplied");
+                throw Error("History file not supplied");
         }
-        else if (::strncmp(argv[i], "-a", 2)==0)
+        else if (::strncmp(argv[i], "--fan-control=", 14)==0)
+        {
+            fanTargetTemperature = parseOptionNumber(argv[i]+14, 20.0, 110.0,
+                        "target temperature");
+            useFanControl = true;
+        }
+        else if (::strncmp(argv[i], "--fan-pid=", 10)==0)
+        {
+            std::vector<double> values;
+            parseNumberList(argv[i]+10, values);
+            if (values.size()!=3)
+                throw Error("Fan PID parameters must be KP,KI,KD");
+            if (values[0] < 0.0 || values[1] < 0.0 || values[2] < 0.0)
+                throw Error("Fan PID parameters must be non-negative");
+            fanPID = PIDParameters{ values[0], values[1], values[2] };
+        }
+        else if (::strncmp(argv[i], "--fan-slew=", 11)==0)
+            fanSlewRate = parseOptionNumber(argv[i]+11, 0.1, 100.0, "fan slew rate");
+        else if (::strncmp(argv[i], "--thermal-governor=", 19)==0)
         {
-            if (argv[i][2]!=0)
-                parseAdaptersList(argv[i]+2, choosenAdapters, chooseAllAdapters);
-            else if (i+1 < argc)
-                parseAdaptersList(argv[++i], choosenAdapters, chooseAllAdapters);
+            thermalLimit = parseOptionNumber(argv[i]+19, 20.0, 110.0,
+                        "temperature limit");
+            useThermalGovernor = true;
+        }
+        else if (::strncmp(argv[i], "--thermal-hysteresis=", 21)==0)
+            thermalHysteresis = parseOptionNumber(argv[i]+21, 0.0, 30.0,
+                        "thermal hysteresis");
+        else if (::strncmp(argv[i], "--thermal-step=", 15)==0)
+            thermalStep = lround(parseOptionNumber(argv[i]+15, 0.01, 500.0,
+                        "thermal clock step")*100.0);
+        else if (::strncmp(argv[i], "--thermal-max-trim=", 19)==0)
+            thermalMaxTrim = parseOptionNumber(argv[i]+19, 0.0, 50.0,
+                        "thermal maximal trim");
+        else if (::strncmp(argv[i], "--thermal-write-interval=", 25)==0)
+            thermalWriteInterval = parseOptionNumber(argv[i]+25, 0.0, 3600.0,
+                        "thermal write interval");
+        else if (::strncmp(argv[i], "--mem-governor=", 15)==0)
+        {
+            memoryIdleClock = lround(parseOptionNumber(argv[i]+15, 1.0, 10000.0,
+                        "idle memory clock")*100.0);
+            useMemoryGovernor = true;
+        }
+        else if (::strncmp(argv[i], "--mem-idle-load=", 16)==0)
+            memoryIdleLoad = lround(parseOptionNumber(argv[i]+16, 1.0, 100.0,
+                        "idle load"));
+        else if (::strncmp(argv[i], "--mem-idle-time=", 16)==0)
+            memoryIdleTime = parseOptionNumber(argv[i]+16, 0.0, 86400.0, "idle time");
+        else if (::strncmp(argv[i], "--power-budget=", 15)==0)
+            powerBudget = parseOptionNumber(argv[i]+15, 1.0, 1e6, "power budget");
+        else if (::strncmp(argv[i], "--power-model=", 14)==0)
+        {
+            std::vector<double> values;
+            parseNumberList(argv[i]+14, values);
+            if (values.size()!=2)
+                throw Error("Power model must be IDLE,COEFF");
+            if (values[0] < 0.0 || values[1] <= 0.0)
+                throw Error("Wrong power model parameters");
+            powerModel = PowerModel{ values[0], values[1] };
+        }
+        else if (::strncmp(argv[i], "--power-tick=", 13)==0)
+            powerTick = parseOptionNumber(argv[i]+13, 0.001, 86400.0, "power tick");
+        else if (::strncmp(argv[i], "--watch=", 8)==0)
+            watchInterval = parseInterval(argv[i]+8);
+        else if (::strcmp(argv[i], "--watch")==0 || ::strcmp(argv[i], "-w")==0)
+        {
+            if (i+1 < argc)
+                watchInterval = parseInterval(argv[++i]);
             else
-                throw Error("Adapter list not supplied");
-            useAdaptersList = true;
+                throw Error("Watch interval not supplied");
         }
+        else if (::strncmp(argv[i], "--params-from=", 14)==0)
+        {
+            if (!readOVCParameters(argv[i]+14, ovcParameters))
+                failed = true;
+        }
+        else if (::strcmp(argv[i], "--stdin")==0)
+            useStdin = true;
         else if (::strcmp(argv[i], "--version")==0)
         {
             std::cout << "amdcovc " AMDCOVC_VERSION
@@ -1527,40 +7913,206 @@ try
     
     if (failed)
         throw Error("Can't parse parameters");
+    if (watchInterval!=0.0 && !ovcParameters.empty())
+        throw Error("Watch mode can't be used while setting parameters");
+    if (outputFormat!=OutputFormat::TEXT && !ovcParameters.empty())
+        throw Error("Output format can't be used while setting parameters");
+    if (exporterAddress!=nullptr && !ovcParameters.empty())
+        throw Error("Exporter can't be used while setting parameters");
+    if (exporterAddress!=nullptr && outputFormat!=OutputFormat::TEXT)
+        throw Error("Exporter can't be used with output format");
+    if (useShm && (!ovcParameters.empty() || outputFormat!=OutputFormat::TEXT))
+        throw Error("Shared memory publishing can't be used with parameters or format");
+    if (readShm && (useShm || exporterAddress!=nullptr || !ovcParameters.empty() ||
+                outputFormat!=OutputFormat::TEXT))
+        throw Error("Reading shared memory can't be used with other modes");
+    const bool usePowerBudget = powerBudget!=0.0;
+    const bool useControllers = useFanControl || useThermalGovernor ||
+                useMemoryGovernor || usePowerBudget;
+    if (usePowerBudget && useThermalGovernor)
+        throw Error("Power budget scheduler can't be used with thermal governor");
+    if (useControllers && (!ovcParameters.empty() || outputFormat!=OutputFormat::TEXT ||
+                exporterAddress!=nullptr || useShm || readShm || historyFile!=nullptr))
+        throw Error("Fan control and governors can't be used with other modes");
+    if (historyFile!=nullptr && (readShm || !ovcParameters.empty()))
+        throw Error("History can't be recorded while setting parameters or reading "
+                    "shared memory");
+    if (useStdin && (!ovcParameters.empty() || watchInterval!=0.0 ||
+                outputFormat!=OutputFormat::TEXT || exporterAddress!=nullptr || useShm ||
+                readShm || historyFile!=nullptr || useControllers ||
+                adaptersOption.useAdaptersList))
+        throw Error("Command session can't be used with other modes");
     
-    ATIADLHandle handle;
-    ADLMainControl mainControl(handle, 0);
-    int adaptersNum = mainControl.getAdaptersNum();
-    /* list for converting user indices to input indices to ADL interface */
-    std::vector<int> activeAdapters;
-    getActiveAdaptersIndices(mainControl, adaptersNum, activeAdapters);
+    if (readShm)
+    {
+        // ADL is not used at all
+        std::unique_ptr<PeriodicTimer> watchTimer;
+        if (watchInterval!=0.0)
+        {
+            installStopHandlers();
+            watchTimer.reset(new PeriodicTimer(watchInterval));
+        }
+        do {
+            printShmSamples(shmName, adaptersOption.choosenAdapters,
+                        adaptersOption.useChoosen());
+            if (watchTimer)
+                std::cout << std::endl; // separate reports
+        } while (watchTimer && watchTimer->wait());
+        return 0;
+    }
     
-    if (useAdaptersList)
-        // sort and check adapter list
-        for (int adapterIndex: choosenAdapters)
-            if (adapterIndex>=int(activeAdapters.size()) || adapterIndex<0)
-                throw Error("Some adapter indices out of range");
+    ADLAdapters adl;
+    ATIADLHandle& handle = adl.handle;
+    ADLMainControl& mainControl = adl.mainControl;
+    const int adaptersNum = adl.adaptersNum;
+    const std::vector<int>& activeAdapters = adl.activeAdapters;
+    /* adapter infos are fetched once, names resolved by PCI are
+     * kept between watch ticks */
+    AdapterInfo* adapterInfos = adl.adapterInfos.get();
+    const std::vector<int>& choosenAdapters = adaptersOption.choosenAdapters;
+    adaptersOption.checkRange(activeAdapters.size());
     
-    if (!ovcParameters.empty())
-        setOVCParameters(mainControl, adaptersNum, activeAdapters, ovcParameters);
+    if (useControllers)
+    {
+        // all adapters are controlled if no adapter list given
+        std::vector<ControlledAdapter> controlledAdapters;
+        for (int k = 0; k < int(activeAdapters.size()); k++)
+            if (adaptersOption.isChoosen(k))
+                controlledAdapters.push_back(ControlledAdapter{ k, activeAdapters[k] });
+        std::vector<std::unique_ptr<AdapterController> > controllers;
+        if (useFanControl)
+            controllers.push_back(std::unique_ptr<AdapterController>(new FanController(
+                    mainControl, controlledAdapters, fanTargetTemperature, fanPID,
+                    fanSlewRate, printVerbose)));
+        if (useThermalGovernor || useMemoryGovernor || usePowerBudget)
+        {
+            // governors change shared performance levels, written by last controller
+            PerfLevelsControl* perfLevels = new PerfLevelsControl(mainControl,
+                        controlledAdapters);
+            std::unique_ptr<AdapterController> perfLevelsControl(perfLevels);
+            if (useThermalGovernor)
+                controllers.push_back(std::unique_ptr<AdapterController>(
+                        new ThermalGovernor(*perfLevels, controlledAdapters, thermalLimit,
+                        thermalHysteresis, thermalStep, thermalMaxTrim,
+                        thermalWriteInterval, printVerbose)));
+            if (useMemoryGovernor)
+                controllers.push_back(std::unique_ptr<AdapterController>(
+                        new MemoryClockGovernor(*perfLevels, controlledAdapters,
+                        memoryIdleClock, memoryIdleLoad, memoryIdleTime, printVerbose)));
+            if (usePowerBudget)
+                controllers.push_back(std::unique_ptr<AdapterController>(
+                        new PowerBudgetScheduler(mainControl, *perfLevels,
+                        controlledAdapters, powerBudget, powerModel, powerTick,
+                        printVerbose)));
+            controllers.push_back(std::move(perfLevelsControl));
+        }
+        runControllers(mainControl, controlledAdapters,
+                    (watchInterval!=0.0) ? watchInterval : 2.0, controllers);
+    }
+    else if (!ovcParameters.empty())
+        setOVCParameters(handle, mainControl, adaptersNum, activeAdapters, ovcParameters);
+    else if (useStdin)
+    {
+        CommandSession session(handle, mainControl, adaptersNum, activeAdapters,
+                    adapterInfos, parallelQueries);
+        runStdinSession(session);
+    }
     else
     {
-        if (printVerbose)
-            printAdaptersInfoVerbose(mainControl, adaptersNum, activeAdapters,
-                        choosenAdapters, useAdaptersList && !chooseAllAdapters);
-        else
-            printAdaptersInfo(mainControl, adaptersNum, activeAdapters,
-                        choosenAdapters, useAdaptersList && !chooseAllAdapters);
+        const bool useChoosen = adaptersOption.useChoosen();
+        // default interval: 5 seconds for exporter, 1 second for sampler
+        const double sampleInterval = (watchInterval!=0.0) ? watchInterval :
+                    (exporterAddress!=nullptr) ? 5.0 : 1.0;
+        std::unique_ptr<ShmPublisher> shmPublisher;
+        if (useShm)
+            shmPublisher.reset(new ShmPublisher(shmName, useChoosen ?
+                    choosenAdapters.size() : activeAdapters.size(), sampleInterval));
+        std::unique_ptr<HistoryRecorder> history;
+        if (historyFile!=nullptr)
+            history.reset(new HistoryRecorder(historyFile));
+        const SampleSinks sinks = { shmPublisher.get(), history.get() };
+        if (exporterAddress!=nullptr)
+        {
+            runExporter(handle, mainControl, adapterInfos, activeAdapters,
+                    choosenAdapters, useChoosen, sampleInterval, exporterAddress, sinks);
+            shmPublisher.reset();
+            cleanupPCIAccess();
+            return 0;
+        }
+        if (shmPublisher)
+        {
+            // sampler mode: only publish samples
+            installStopHandlers();
+            PeriodicTimer timer(sampleInterval);
+            std::vector<AdapterSnapshot> snapshots;
+            std::unique_ptr<AdapterWorkers> workers;
+            if (parallelQueries)
+                workers = createAdapterWorkers(handle, mainControl, useChoosen ?
+                        choosenAdapters.size() : activeAdapters.size());
+            do {
+                collectAdapterSnapshots(handle, mainControl, adapterInfos,
+                        activeAdapters, choosenAdapters, useChoosen, false,
+                        workers.get(), snapshots);
+                sinks.publish(snapshots, getReportTime());
+            } while (timer.wait());
+            shmPublisher.reset();
+            cleanupPCIAccess();
+            return 0;
+        }
+        
+        std::unique_ptr<PeriodicTimer> watchTimer;
+        if (watchInterval!=0.0)
+        {
+            installStopHandlers();
+            watchTimer.reset(new PeriodicTimer(watchInterval));
+        }
+        std::vector<AdapterSnapshot> snapshots;
+        ReportBuffer report;
+        bool firstReport = true;
+        // machine-readable formats include all verbose informations
+        const bool collectVerbose = printVerbose || outputFormat!=OutputFormat::TEXT;
+        if (outputFormat!=OutputFormat::TEXT)
+            std::cout.flush(); // reports are written directly to stdout
+        // workers (with own ADL2 contexts) are created once for all watch ticks
+        std::unique_ptr<AdapterWorkers> workers;
+        if (parallelQueries)
+            workers = createAdapterWorkers(handle, mainControl, useChoosen ?
+                    choosenAdapters.size() : activeAdapters.size());
+        do {
+            collectAdapterSnapshots(handle, mainControl, adapterInfos,
+                        activeAdapters, choosenAdapters, useChoosen, collectVerbose,
+                        workers.get(), snapshots);
+            sinks.publish(snapshots, getReportTime());
+            if (outputFormat!=OutputFormat::TEXT)
+            {
+                report.clear();
+                if (outputFormat==OutputFormat::JSON)
+                    formatAdaptersInfoJSON(report, getReportTime(), snapshots);
+                else
+                    formatAdaptersInfoDSV(report,
+                            (outputFormat==OutputFormat::CSV) ? ',' : '\t',
+                            firstReport, getReportTime(), snapshots);
+                report.writeTo(1);
+            }
+            else
+            {
+                if (printVerbose)
+                    printAdaptersInfoVerbose(snapshots);
+                else
+                    printAdaptersInfo(snapshots);
+                if (watchTimer)
+                    std::cout << std::endl; // separate reports
+            }
+            firstReport = false;
+        } while (watchTimer && watchTimer->wait());
     }
-    if (pciAccess!=nullptr)
-        pci_cleanup(pciAccess);
+    cleanupPCIAccess();
     return 0;
 }
 catch(const std::exception& ex)
 {
-    if (pciAccess!=nullptr)
-        pci_cleanup(pciAccess);
+    cleanupPCIAccess();
     std::cerr << ex.what() << std::endl;
     return 1;
 }
-
+#endif
@@ -0,0 +1,235 @@
+/*
+ *  AMDCOVC - AMD Console OVerdrive Control utility
+ *  Copyright (C) 2016 Mateusz Szpakowski
+ *  Copyright (C) 2016 Virgil Hou
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Shared-memory telemetry published by 'amdcovc --shm'. Layout of shared memory
+ * and reader API. Readers do not lock anything and do not call ADL: every adapter
+ * slot is guarded by seqlock, reader retries if sampler wrote slot while reading.
+ * Can be used from C and C++ programs (GCC or Clang):
+ *
+ *   AMDCOVCShm shm;
+ *   if (amdcovcShmOpen(&shm, AMDCOVC_SHM_NAME) == 0)
+ *   {
+ *       AMDCOVCShmSample sample;
+ *       if (amdcovcShmReadLatest(&shm, 0, &sample) == 0)
+ *           printf("%d C\n", sample.temperature/1000);
+ *       amdcovcShmClose(&shm);
+ *   }
+ */
+
+#ifndef AMDCOVC_SHM_H
+#define AMDCOVC_SHM_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define AMDCOVC_SHM_NAME "/amdcovc"
+#define AMDCOVC_SHM_MAGIC 0x4d48534356434d41ULL /* "AMCVCSHM" */
+#define AMDCOVC_SHM_VERSION 1
+#define AMDCOVC_SHM_RING_SIZE 256
+#define AMDCOVC_SHM_NAME_SIZE 128
+
+/* single sample. Units as in ADL: clocks in 10 kHz, Vddc in mV,
+ * temperature in millidegrees Celsius */
+typedef struct AMDCOVCShmSample
+{
+    int64_t timeMs;             /* sampling time: milliseconds since epoch */
+    int32_t engineClock;
+    int32_t memoryClock;
+    int32_t vddc;
+    int32_t activityPercent;
+    int32_t currentPerformanceLevel;
+    int32_t currentBusSpeed;
+    int32_t currentBusLanes;
+    int32_t temperature;
+    int32_t fanSpeed;           /* in percents */
+    int32_t powerControl;       /* in percents, valid if powerControlSupported */
+    int32_t powerControlSupported;
+    int32_t reserved;
+} AMDCOVCShmSample;
+
+/* slot of single adapter: adapter description and ring of last samples.
+ * sequence is odd while sampler writes slot */
+typedef struct AMDCOVCShmSlot
+{
+    uint32_t sequence;
+    uint32_t reserved;
+    uint64_t samplesNum;        /* number of written samples (ring head) */
+    int32_t index;              /* adapter index as in amdcovc */
+    int32_t busNumber;
+    int32_t deviceNumber;
+    int32_t functionNumber;
+    char name[AMDCOVC_SHM_NAME_SIZE];
+    AMDCOVCShmSample ring[AMDCOVC_SHM_RING_SIZE];
+} __attribute__((aligned(64))) AMDCOVCShmSlot;
+
+/* description of adapter, copied from slot */
+typedef struct AMDCOVCShmAdapter
+{
+    int32_t index;              /* adapter index as in amdcovc */
+    int32_t busNumber;
+    int32_t deviceNumber;
+    int32_t functionNumber;
+    char name[AMDCOVC_SHM_NAME_SIZE];
+} AMDCOVCShmAdapter;
+
+typedef struct AMDCOVCShmHeader
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t adaptersNum;
+    uint32_t ringSize;
+    uint32_t slotSize;
+    int32_t samplerPid;
+    uint32_t intervalMs;        /* sampling interval */
+} __attribute__((aligned(64))) AMDCOVCShmHeader;
+
+typedef struct AMDCOVCShm
+{
+    const AMDCOVCShmHeader* header;
+    const AMDCOVCShmSlot* slots;
+    size_t size;
+} AMDCOVCShm;
+
+static inline size_t amdcovcShmSize(uint32_t adaptersNum)
+{
+    return sizeof(AMDCOVCShmHeader) + sizeof(AMDCOVCShmSlot)*adaptersNum;
+}
+
+/* open shared memory published by sampler. Returns 0 or negative errno
+ * (-ENOENT if no sampler is running, -EPROTO if layout is not compatible) */
+static inline int amdcovcShmOpen(AMDCOVCShm* shm, const char* name)
+{
+    struct stat st;
+    void* mem;
+    const AMDCOVCShmHeader* header;
+    int fd;
+    shm->header = NULL;
+    shm->slots = NULL;
+    shm->size = 0;
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1)
+        return -errno;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(AMDCOVCShmHeader))
+    {
+        close(fd);
+        return -EPROTO;
+    }
+    mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+        return -errno;
+    header = (const AMDCOVCShmHeader*)mem;
+    if (header->magic != AMDCOVC_SHM_MAGIC || header->version != AMDCOVC_SHM_VERSION ||
+        header->ringSize != AMDCOVC_SHM_RING_SIZE ||
+        header->slotSize != sizeof(AMDCOVCShmSlot) ||
+        amdcovcShmSize(header->adaptersNum) > (size_t)st.st_size)
+    {
+        munmap(mem, st.st_size);
+        return -EPROTO;
+    }
+    shm->header = header;
+    shm->slots = (const AMDCOVCShmSlot*)(header+1);
+    shm->size = st.st_size;
+    return 0;
+}
+
+static inline void amdcovcShmClose(AMDCOVCShm* shm)
+{
+    if (shm->header != NULL)
+        munmap((void*)shm->header, shm->size);
+    shm->header = NULL;
+    shm->slots = NULL;
+}
+
+/* read up to maxSamples last samples of adapter (newest last). Returns number
+ * of read samples, or negative errno (-EINVAL if no such adapter) */
+static inline int amdcovcShmReadRecent(const AMDCOVCShm* shm, uint32_t adapter,
+            AMDCOVCShmSample* samples, uint32_t maxSamples)
+{
+    const AMDCOVCShmSlot* slot;
+    uint32_t seq1, seq2, num, i;
+    uint64_t samplesNum;
+    if (adapter >= shm->header->adaptersNum)
+        return -EINVAL;
+    slot = shm->slots + adapter;
+    if (maxSamples > AMDCOVC_SHM_RING_SIZE)
+        maxSamples = AMDCOVC_SHM_RING_SIZE;
+    do {
+        seq1 = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (seq1 & 1)
+            continue; /* sampler is writing */
+        samplesNum = __atomic_load_n(&slot->samplesNum, __ATOMIC_RELAXED);
+        num = (samplesNum < maxSamples) ? (uint32_t)samplesNum : maxSamples;
+        for (i = 0; i < num; i++)
+            memcpy(samples+i, slot->ring + (samplesNum-num+i)%AMDCOVC_SHM_RING_SIZE,
+                   sizeof(AMDCOVCShmSample));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq2 = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+    } while ((seq1 & 1) || seq1 != seq2);
+    return (int)num;
+}
+
+/* read description of adapter (written by sampler with first sample). Returns 0,
+ * -EAGAIN if adapter is not described yet or -EINVAL if no such adapter */
+static inline int amdcovcShmReadAdapter(const AMDCOVCShm* shm, uint32_t adapter,
+            AMDCOVCShmAdapter* info)
+{
+    const AMDCOVCShmSlot* slot;
+    uint32_t seq1, seq2;
+    uint64_t samplesNum;
+    if (adapter >= shm->header->adaptersNum)
+        return -EINVAL;
+    slot = shm->slots + adapter;
+    do {
+        seq1 = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (seq1 & 1)
+            continue; /* sampler is writing */
+        samplesNum = __atomic_load_n(&slot->samplesNum, __ATOMIC_RELAXED);
+        info->index = slot->index;
+        info->busNumber = slot->busNumber;
+        info->deviceNumber = slot->deviceNumber;
+        info->functionNumber = slot->functionNumber;
+        memcpy(info->name, slot->name, AMDCOVC_SHM_NAME_SIZE);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq2 = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+    } while ((seq1 & 1) || seq1 != seq2);
+    if (samplesNum == 0)
+        return -EAGAIN;
+    info->name[AMDCOVC_SHM_NAME_SIZE-1] = 0;
+    return 0;
+}
+
+/* read latest sample of adapter. Returns 0, -EAGAIN if there is no sample yet
+ * or -EINVAL if no such adapter */
+static inline int amdcovcShmReadLatest(const AMDCOVCShm* shm, uint32_t adapter,
+            AMDCOVCShmSample* sample)
+{
+    int ret = amdcovcShmReadRecent(shm, adapter, sample, 1);
+    if (ret < 0)
+        return ret;
+    return (ret == 1) ? 0 : -EAGAIN;
+}
+
+#endif
@@ -0,0 +1,378 @@
+/*
+ *  AMDCOVC - AMD Console OVerdrive Control utility
+ *  Copyright (C) 2016 Mateusz Szpakowski
+ *  Copyright (C) 2016 Virgil Hou
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Microbenchmarks of CLI pipeline: parameter and adapter list parsing,
+ * validation and apply planning in setOVCParameters and formatting of
+ * adapter informations. Program is compiled together with amdcovc.cpp
+ * (without main), setOVCParameters runs against mock ADL library.
+ *
+ * Results are printed as JSON lines. If baseline file is given, then program
+ * fails if any stage is slower than baseline multiplied by tolerance. */
+
+#define AMDCOVC_NO_MAIN 1
+#include "amdcovc.cpp"
+
+#include <map>
+#include <sstream>
+
+namespace
+{
+
+const int paramsNum = 4000;
+const int adapterListsNum = 4000;
+const int mockAdaptersNum = 256;
+const int snapshotsNum = 2048;
+
+class NullBuffer: public std::streambuf
+{
+protected:
+    int overflow(int c)
+    { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n)
+    { return n; }
+};
+
+struct BenchResult
+{
+    std::string stage;
+    size_t opsNum;
+    double nsPerOp;
+};
+
+double nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+/* run function 'runs' times and returns best time per operation */
+template<typename F>
+BenchResult runBench(const char* stage, size_t opsNum, int runs, F func)
+{
+    double best = 1e300;
+    for (int r = 0; r < runs; r++)
+    {
+        const double start = nowNs();
+        func();
+        best = std::min(best, nowNs()-start);
+    }
+    return BenchResult{ stage, opsNum, best/opsNum };
+}
+
+void generateParams(std::vector<std::string>& params, int adaptersNum)
+{
+    static const char* names[] = { "coreclk", "memclk", "vcore", "icoreclk",
+        "imemclk", "ivcore", "fanspeed", "pwrctrl" };
+    params.clear();
+    unsigned int seed = 1;
+    for (int i = 0; i < paramsNum; i++)
+    {
+        const int type = rand_r(&seed)%8;
+        const int first = rand_r(&seed)%adaptersNum;
+        const int last = std::min(adaptersNum-1, first + rand_r(&seed)%8);
+        char buf[128];
+        char listBuf[48];
+        if (rand_r(&seed)%16 == 0)
+            snprintf(listBuf, 48, "all");
+        else if (first != last)
+            snprintf(listBuf, 48, "%d-%d", first, last);
+        else
+            snprintf(listBuf, 48, "%d", first);
+        switch (type)
+        {
+            case 0:
+                snprintf(buf, 128, "%s:%s=%d", names[type], listBuf,
+                         1000 + rand_r(&seed)%300);
+                break;
+            case 1:
+                snprintf(buf, 128, "%s:%s=%d", names[type], listBuf,
+                         1500 + rand_r(&seed)%500);
+                break;
+            case 2:
+                snprintf(buf, 128, "%s:%s=%.3f", names[type], listBuf,
+                         0.9 + (rand_r(&seed)%200)*0.001);
+                break;
+            case 3:
+            case 4:
+                snprintf(buf, 128, "%s:%s=%d", names[type], listBuf,
+                         300 + rand_r(&seed)%100);
+                break;
+            case 5:
+                snprintf(buf, 128, "%s:%s=default", names[type], listBuf);
+                break;
+            case 6:
+                snprintf(buf, 128, "%s:%s=%d", names[type], listBuf,
+                         30 + rand_r(&seed)%70);
+                break;
+            default:
+                snprintf(buf, 128, "%s:%s=%d", names[type], listBuf,
+                         -20 + rand_r(&seed)%40);
+                break;
+        }
+        params.push_back(buf);
+    }
+}
+
+void generateAdapterLists(std::vector<std::string>& lists)
+{
+    lists.clear();
+    unsigned int seed = 2;
+    for (int i = 0; i < adapterListsNum; i++)
+    {
+        std::string list;
+        const int itemsNum = 1 + rand_r(&seed)%16;
+        for (int k = 0; k < itemsNum; k++)
+        {
+            char buf[32];
+            const int first = rand_r(&seed)%1024;
+            if (rand_r(&seed)%2)
+                snprintf(buf, 32, "%d-%d", first, first + rand_r(&seed)%64);
+            else
+                snprintf(buf, 32, "%d", first);
+            if (k != 0)
+                list += ',';
+            list += buf;
+        }
+        lists.push_back(list);
+    }
+}
+
+void generateSnapshots(std::vector<AdapterSnapshot>& snapshots,
+            std::vector<AdapterInfo>& infos)
+{
+    infos.resize(snapshotsNum);
+    snapshots.resize(snapshotsNum);
+    for (int i = 0; i < snapshotsNum; i++)
+    {
+        AdapterInfo& info = infos[i];
+        ::memset(&info, 0, sizeof(AdapterInfo));
+        snprintf(info.strAdapterName, ADL_MAX_PATH, "Ellesmere [Radeon RX 470/480] %d", i);
+        info.iBusNumber = i+1;
+        info.iVendorID = 0x1002;
+        AdapterSnapshot& snapshot = snapshots[i];
+        snapshot.userIndex = i;
+        snapshot.adapterIndex = i;
+        snapshot.info = &info;
+        snapshot.verbose = true;
+        snapshot.activity = ADLPMActivity{ sizeof(ADLPMActivity), 120000+i, 175000, 1150,
+                    i%100, 7, 8000, 16, 16, 0 };
+        snapshot.temperature = 60000 + (i%30)*500;
+        snapshot.fanSpeed = 40 + i%60;
+        snapshot.powerControlSupported = true;
+        snapshot.powerControl = i%21 - 10;
+        snapshot.powerControlDefault = 0;
+        snapshot.odParams.iNumberOfPerformanceLevels = 8;
+        snapshot.odParams.sEngineClock = ADLODParameterRange{ 30000, 145000, 100 };
+        snapshot.odParams.sMemoryClock = ADLODParameterRange{ 30000, 225000, 500 };
+        snapshot.odParams.sVddc = ADLODParameterRange{ 750, 1250, 5 };
+        snapshot.perfLevels.resize(8);
+        for (int l = 0; l < 8; l++)
+            snapshot.perfLevels[l] = ADLODPerformanceLevel{ 30000+l*12000,
+                    (l==0) ? 30000 : 175000, 800+l*50 };
+        snapshot.defaultPerfLevels = snapshot.perfLevels;
+        snapshot.fanSpeedInfo = ADLFanSpeedInfo{ sizeof(ADLFanSpeedInfo), 3, 0, 100, 0, 3200 };
+        snapshot.powerControlInfo = ADLPowerControlInfo{ -50, 50, 1 };
+    }
+}
+
+bool readBaseline(const char* filename, std::map<std::string, double>& baseline)
+{
+    std::ifstream is(filename);
+    if (!is)
+        return false;
+    std::string line;
+    while (std::getline(is, line))
+    {
+        if (line.empty() || line[0]=='#')
+            continue;
+        std::istringstream lineIs(line);
+        std::string stage;
+        double nsPerOp;
+        if (lineIs >> stage >> nsPerOp)
+            baseline[stage] = nsPerOp;
+    }
+    return true;
+}
+
+}
+
+static const char* usageString =
+"Usage: microbench [-b BASELINE] [-w BASELINE] [-t TOLERANCE] [-r RUNS]\n"
+"  -b BASELINE    compare results with baseline file, fail if regressed\n"
+"  -w BASELINE    write results to baseline file\n"
+"  -t TOLERANCE   maximal allowed ratio to baseline (default 2.0)\n"
+"  -r RUNS        runs of each stage, best is taken (default 5)\n";
+
+int main(int argc, char** argv)
+try
+{
+    const char* baselineFile = nullptr;
+    const char* outBaselineFile = nullptr;
+    double tolerance = 2.0;
+    int runs = 5;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:w:t:r:h")) != -1)
+        switch (opt)
+        {
+            case 'b':
+                baselineFile = optarg;
+                break;
+            case 'w':
+                outBaselineFile = optarg;
+                break;
+            case 't':
+                tolerance = atof(optarg);
+                break;
+            case 'r':
+                runs = std::max(1, atoi(optarg));
+                break;
+            default:
+                std::cerr << usageString;
+                return opt=='h' ? 0 : 1;
+        }
+
+    std::vector<BenchResult> results;
+    NullBuffer nullBuffer;
+
+    // parsing
+    std::vector<std::string> paramStrings;
+    generateParams(paramStrings, mockAdaptersNum);
+    std::vector<OVCParameter> ovcParams(paramStrings.size());
+    results.push_back(runBench("parse_ovc_parameter", paramStrings.size(), runs, [&]()
+    {
+        for (size_t i = 0; i < paramStrings.size(); i++)
+            if (!parseOVCParameter(paramStrings[i].c_str(), ovcParams[i]))
+                throw Error("Can't parse generated parameter");
+    }));
+
+    std::vector<std::string> adapterLists;
+    generateAdapterLists(adapterLists);
+    results.push_back(runBench("parse_adapters_list", adapterLists.size(), runs, [&]()
+    {
+        std::vector<int> adapters;
+        bool allAdapters;
+        for (const std::string& list: adapterLists)
+            parseAdaptersList(list.c_str(), adapters, allAdapters);
+    }));
+
+    // validation and planning against mock ADL library without latency
+    {
+        char numBuf[32];
+        snprintf(numBuf, 32, "%d", mockAdaptersNum);
+        setenv("MOCKADL_ADAPTERS", numBuf, 1);
+        setenv("MOCKADL_LEVELS", "8", 1);
+        setenv("MOCKADL_LATENCY_US", "0", 1);
+        ATIADLHandle handle;
+        ADLMainControl mainControl(handle, 0);
+        int adaptersNum = mainControl.getAdaptersNum();
+        std::vector<int> activeAdapters;
+        getActiveAdaptersIndices(mainControl, adaptersNum, activeAdapters);
+        std::streambuf* oldBuf = std::cout.rdbuf(&nullBuffer);
+        results.push_back(runBench("set_ovc_parameters", ovcParams.size(), runs, [&]()
+        {
+            setOVCParameters(handle, mainControl, adaptersNum, activeAdapters, ovcParams);
+        }));
+        std::cout.rdbuf(oldBuf);
+    }
+
+    // formatting
+    std::vector<AdapterSnapshot> snapshots;
+    std::vector<AdapterInfo> infos;
+    generateSnapshots(snapshots, infos);
+    {
+        std::streambuf* oldBuf = std::cout.rdbuf(&nullBuffer);
+        results.push_back(runBench("print_adapters_info", snapshots.size(), runs, [&]()
+        {
+            printAdaptersInfo(snapshots);
+        }));
+        results.push_back(runBench("print_adapters_info_verbose", snapshots.size(),
+                    runs, [&]()
+        {
+            printAdaptersInfoVerbose(snapshots);
+        }));
+        std::cout.rdbuf(oldBuf);
+        ReportBuffer report;
+        results.push_back(runBench("format_adapters_info_json", snapshots.size(),
+                    runs, [&]()
+        {
+            report.clear();
+            formatAdaptersInfoJSON(report, 1500000000000L, snapshots);
+        }));
+        results.push_back(runBench("format_adapters_info_csv", snapshots.size(),
+                    runs, [&]()
+        {
+            report.clear();
+            formatAdaptersInfoDSV(report, ',', true, 1500000000000L, snapshots);
+        }));
+    }
+
+    std::map<std::string, double> baseline;
+    if (baselineFile!=nullptr && !readBaseline(baselineFile, baseline))
+        throw Error("Can't read baseline file");
+
+    bool regressed = false;
+    for (const BenchResult& result: results)
+    {
+        char lineBuf[256];
+        auto it = baseline.find(result.stage);
+        if (it != baseline.end())
+        {
+            const double ratio = result.nsPerOp / it->second;
+            const bool stageRegressed = ratio > tolerance;
+            regressed |= stageRegressed;
+            snprintf(lineBuf, 256, "{\"stage\":\"%s\",\"ops\":%zu,\"ns_per_op\":%.2f,"
+                    "\"baseline_ns_per_op\":%.2f,\"ratio\":%.3f,\"status\":\"%s\"}",
+                    result.stage.c_str(), result.opsNum, result.nsPerOp, it->second,
+                    ratio, stageRegressed ? "regressed" : "ok");
+        }
+        else
+            snprintf(lineBuf, 256, "{\"stage\":\"%s\",\"ops\":%zu,\"ns_per_op\":%.2f}",
+                    result.stage.c_str(), result.opsNum, result.nsPerOp);
+        std::cout << lineBuf << "\n";
+    }
+    std::cout.flush();
+
+    if (outBaselineFile!=nullptr)
+    {
+        std::ofstream os(outBaselineFile);
+        os << "# stage ns_per_op\n";
+        for (const BenchResult& result: results)
+        {
+            char lineBuf[128];
+            snprintf(lineBuf, 128, "%s %.2f\n", result.stage.c_str(), result.nsPerOp);
+            os << lineBuf;
+        }
+        if (!os)
+            throw Error("Can't write baseline file");
+    }
+    cleanupPCIAccess();
+    if (regressed)
+    {
+        std::cerr << "Some stages regressed past baseline!" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+catch(const std::exception& ex)
+{
+    std::cerr << ex.what() << std::endl;
+    return 1;
+}
@@ -0,0 +1,649 @@
+/*
+ *  AMDCOVC - AMD Console OVerdrive Control utility
+ *  Copyright (C) 2016 Mateusz Szpakowski
+ *  Copyright (C) 2016 Virgil Hou
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Stand-in for libatiadlxx.so. Simulates adapters without Radeon hardware.
+ * Configuration (environment variables):
+ *   MOCKADL_ADAPTERS=N        number of adapters (default 1)
+ *   MOCKADL_LEVELS=N          number of performance levels (default 3)
+ *   MOCKADL_LATENCY_US=N      latency of every call in microseconds (default 0)
+ *   MOCKADL_LOAD=PERCENT      GPU load, 'wave' - changes in time (default 'wave')
+ *   MOCKADL_FAIL=NAME,...     these functions always fail (ADL_ERR)
+ *   MOCKADL_FAIL_ADAPTER=N    functions from MOCKADL_FAIL fail only for adapter N
+ *   MOCKADL_FAIL_RATE=P       any call fails with probability P (0-1)
+ *   MOCKADL_SEED=N            seed for random failures
+ *   MOCKADL_NOX=1             ADL_Main_Control_Create fails until console fd is set
+ *   MOCKADL_NONAME=1          adapter names are empty (program reads them from PCI)
+ *   MOCKADL_NOADL2=1          ADL2 context creation fails
+ *   MOCKADL_NOPOWERCTRL=1     PowerControl functions are not supported by adapters
+ *   MOCKADL_STATS=1           print call counters to stderr at exit
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <time.h>
+
+#ifdef __linux__
+#define LINUX 1
+#endif
+#include "adl_sdk.h"
+
+namespace
+{
+
+enum MockFunc
+{
+    F_MAIN_CONTROL_CREATE = 0,
+    F_MAIN_CONTROL_DESTROY,
+    F_CONSOLEMODE_FD_SET,
+    F_NUMBER_OF_ADAPTERS_GET,
+    F_ADAPTER_ACTIVE_GET,
+    F_ADAPTER_INFO_GET,
+    F_CURRENT_ACTIVITY_GET,
+    F_TEMPERATURE_GET,
+    F_FANSPEEDINFO_GET,
+    F_FANSPEED_GET,
+    F_ODPARAMETERS_GET,
+    F_ODPERFLEVELS_GET,
+    F_FANSPEED_SET,
+    F_FANSPEEDTODEFAULT_SET,
+    F_ODPERFLEVELS_SET,
+    F_POWERCONTROLINFO_GET,
+    F_POWERCONTROL_GET,
+    F_POWERCONTROL_SET,
+    F_FUNCS_NUM
+};
+
+const char* funcNames[F_FUNCS_NUM] =
+{
+    "Main_Control_Create", "Main_Control_Destroy", "ConsoleMode_FileDescriptor_Set",
+    "Adapter_NumberOfAdapters_Get", "Adapter_Active_Get", "Adapter_AdapterInfo_Get",
+    "Overdrive5_CurrentActivity_Get", "Overdrive5_Temperature_Get",
+    "Overdrive5_FanSpeedInfo_Get", "Overdrive5_FanSpeed_Get",
+    "Overdrive5_ODParameters_Get", "Overdrive5_ODPerformanceLevels_Get",
+    "Overdrive5_FanSpeed_Set", "Overdrive5_FanSpeedToDefault_Set",
+    "Overdrive5_ODPerformanceLevels_Set", "Overdrive5_PowerControlInfo_Get",
+    "Overdrive5_PowerControl_Get", "Overdrive5_PowerControl_Set"
+};
+
+struct MockAdapter
+{
+    std::vector<ADLODPerformanceLevel> perfLevels;
+    std::vector<ADLODPerformanceLevel> defaultPerfLevels;
+    int fanSpeed;
+    bool fanUserDefined;
+    int powerControl;
+};
+
+struct MockState
+{
+    std::mutex mutex;
+    int adaptersNum;
+    int levelsNum;
+    long latencyUs;
+    int load;   // -1 - wave
+    bool failFuncs[F_FUNCS_NUM];
+    int failAdapter;    // -1 - all adapters
+    double failRate;
+    unsigned int seed;
+    bool noX;
+    bool noName;
+    bool noADL2;
+    bool noPowerControl;
+    bool stats;
+    bool consoleFdSet;
+    std::atomic<unsigned long> calls[F_FUNCS_NUM];
+    std::vector<MockAdapter> adapters;
+    timespec startTime;
+
+    MockState();
+    ~MockState();
+};
+
+MockState::MockState() : adaptersNum(1), levelsNum(3), latencyUs(0), load(-1),
+        failAdapter(-1), failRate(0.0), seed(1), noX(false), noName(false), noADL2(false),
+        noPowerControl(false), stats(false), consoleFdSet(false)
+{
+    const char* env;
+    if ((env = getenv("MOCKADL_ADAPTERS"))!=nullptr)
+        adaptersNum = std::max(0, atoi(env));
+    if ((env = getenv("MOCKADL_LEVELS"))!=nullptr)
+        levelsNum = std::max(1, atoi(env));
+    if ((env = getenv("MOCKADL_LATENCY_US"))!=nullptr)
+        latencyUs = std::max(0L, atol(env));
+    if ((env = getenv("MOCKADL_LOAD"))!=nullptr && ::strcmp(env, "wave")!=0)
+        load = std::min(100, std::max(0, atoi(env)));
+    if ((env = getenv("MOCKADL_FAIL_ADAPTER"))!=nullptr)
+        failAdapter = atoi(env);
+    if ((env = getenv("MOCKADL_FAIL_RATE"))!=nullptr)
+        failRate = atof(env);
+    if ((env = getenv("MOCKADL_SEED"))!=nullptr)
+        seed = atoi(env);
+    noX = getenv("MOCKADL_NOX")!=nullptr;
+    noName = getenv("MOCKADL_NONAME")!=nullptr;
+    noADL2 = getenv("MOCKADL_NOADL2")!=nullptr;
+    noPowerControl = getenv("MOCKADL_NOPOWERCTRL")!=nullptr;
+    stats = getenv("MOCKADL_STATS")!=nullptr;
+
+    std::fill(failFuncs, failFuncs+F_FUNCS_NUM, false);
+    if ((env = getenv("MOCKADL_FAIL"))!=nullptr)
+    {
+        std::string failList(env);
+        size_t pos = 0;
+        while (pos <= failList.size())
+        {
+            size_t end = failList.find(',', pos);
+            if (end == std::string::npos)
+                end = failList.size();
+            std::string name = failList.substr(pos, end-pos);
+            // accept names with or without prefix
+            if (name.compare(0, 4, "ADL_")==0)
+                name = name.substr(4);
+            else if (name.compare(0, 5, "ADL2_")==0)
+                name = name.substr(5);
+            for (int f = 0; f < F_FUNCS_NUM; f++)
+                if (name == funcNames[f])
+                    failFuncs[f] = true;
+            pos = end+1;
+        }
+    }
+    for (int f = 0; f < F_FUNCS_NUM; f++)
+        calls[f] = 0;
+
+    adapters.resize(adaptersNum);
+    for (MockAdapter& adapter: adapters)
+    {
+        adapter.perfLevels.resize(levelsNum);
+        for (int l = 0; l < levelsNum; l++)
+        {
+            // clocks in 10 kHz, voltages in mV
+            ADLODPerformanceLevel& level = adapter.perfLevels[l];
+            level.iEngineClock = 30000 + (120000-30000)*l/std::max(1, levelsNum-1);
+            level.iMemoryClock = (l==0) ? 30000 : 175000;
+            level.iVddc = 800 + (1150-800)*l/std::max(1, levelsNum-1);
+        }
+        adapter.defaultPerfLevels = adapter.perfLevels;
+        adapter.fanSpeed = 30;
+        adapter.fanUserDefined = false;
+        adapter.powerControl = 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+}
+
+MockState::~MockState()
+{
+    if (!stats)
+        return;
+    for (int f = 0; f < F_FUNCS_NUM; f++)
+        if (calls[f] != 0)
+            fprintf(stderr, "mockadl: %s: %lu\n", funcNames[f], (unsigned long)calls[f]);
+}
+
+MockState& state()
+{
+    static MockState mockState;
+    return mockState;
+}
+
+/* called at begin of each function: counts call, waits latency and injects faults.
+ * adapterIndex is -1 for functions without adapter. Returns true if call must fail */
+bool enterCall(MockFunc func, int adapterIndex = -1)
+{
+    MockState& st = state();
+    st.calls[func]++;
+    if (st.latencyUs != 0)
+        usleep(st.latencyUs);
+    if (st.failFuncs[func] && (st.failAdapter < 0 || adapterIndex==st.failAdapter))
+        return true;
+    if (st.failRate > 0.0)
+    {
+        std::lock_guard<std::mutex> lock(st.mutex);
+        if (rand_r(&st.seed) < st.failRate*RAND_MAX)
+            return true;
+    }
+    return false;
+}
+
+bool checkAdapter(int adapterIndex)
+{
+    return adapterIndex >= 0 && adapterIndex < state().adaptersNum;
+}
+
+int currentLoad(int adapterIndex)
+{
+    MockState& st = state();
+    if (st.load >= 0)
+        return st.load;
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double t = (now.tv_sec-st.startTime.tv_sec) + (now.tv_nsec-st.startTime.tv_nsec)*1e-9;
+    return int(50.0 + 50.0*sin(t*0.2 + adapterIndex));
+}
+
+/* plain thermal model: heat from clock and load, cooling from fan */
+int currentTemperature(int adapterIndex)
+{
+    const MockAdapter& adapter = state().adapters[adapterIndex];
+    const ADLODPerformanceLevel& top = adapter.perfLevels.back();
+    const ADLODPerformanceLevel& defTop = adapter.defaultPerfLevels.back();
+    double clockRatio = double(top.iEngineClock)/defTop.iEngineClock;
+    double temp = 35.0 + 0.5*currentLoad(adapterIndex)*clockRatio -
+            0.25*(adapter.fanSpeed-30);
+    return int(std::max(25.0, temp)*1000.0);
+}
+
+int mainControlCreate()
+{
+    if (enterCall(F_MAIN_CONTROL_CREATE))
+        return ADL_ERR;
+    MockState& st = state();
+    if (st.noX && !st.consoleFdSet)
+        return ADL_ERR;
+    return ADL_OK;
+}
+
+int consoleModeFdSet(int fd)
+{
+    if (enterCall(F_CONSOLEMODE_FD_SET))
+        return ADL_ERR;
+    if (fd < 0)
+        return ADL_ERR_INVALID_PARAM;
+    state().consoleFdSet = true;
+    return ADL_OK;
+}
+
+int numberOfAdaptersGet(int* num)
+{
+    if (enterCall(F_NUMBER_OF_ADAPTERS_GET))
+        return ADL_ERR;
+    *num = state().adaptersNum;
+    return ADL_OK;
+}
+
+int adapterActiveGet(int adapterIndex, int* status)
+{
+    if (enterCall(F_ADAPTER_ACTIVE_GET, adapterIndex))
+        return ADL_ERR;
+    if (!checkAdapter(adapterIndex))
+        return ADL_ERR_INVALID_PARAM;
+    *status = ADL_TRUE;
+    return ADL_OK;
+}
+
+int adapterInfoGet(LPAdapterInfo info, int inputSize)
+{
+    if (enterCall(F_ADAPTER_INFO_GET))
+        return ADL_ERR;
+    MockState& st = state();
+    if (inputSize < int(sizeof(AdapterInfo))*st.adaptersNum)
+        return ADL_ERR_INVALID_PARAM;
+    for (int i = 0; i < st.adaptersNum; i++)
+    {
+        AdapterInfo& ai = info[i];
+        ai.iAdapterIndex = i;
+        ai.iBusNumber = i+1;
+        ai.iDeviceNumber = 0;
+        ai.iFunctionNumber = 0;
+        ai.iVendorID = 0x1002;
+        ai.iPresent = 1;
+        if (!st.noName)
+            snprintf(ai.strAdapterName, ADL_MAX_PATH, "Mock Radeon %d", i);
+        else
+            ai.strAdapterName[0] = 0;
+        snprintf(ai.strUDID, ADL_MAX_PATH, "PCI_VEN_1002&DEV_67DF&SUBSYS_0000&REV_00_%d", i);
+    }
+    return ADL_OK;
+}
+
+int currentActivityGet(int adapterIndex, ADLPMActivity* activity)
+{
+    if (enterCall(F_CURRENT_ACTIVITY_GET, adapterIndex))
+        return ADL_ERR;
+    if (!checkAdapter(adapterIndex))
+        return ADL_ERR_INVALID_PARAM;
+    MockState& st = state();
+    std::lock_guard<std::mutex> lock(st.mutex);
+    const MockAdapter& adapter = st.adapters[adapterIndex];
+    const int load = currentLoad(adapterIndex);
+    const int level = (load > 10) ? st.levelsNum-1 : 0;
+    activity->iEngineClock = adapter.perfLevels[level].iEngineClock;
+    activity->iMemoryClock = adapter.perfLevels[level].iMemoryClock;
+    activity->iVddc = adapter.perfLevels[level].iVddc;
+    activity->iActivityPercent = load;
+    activity->iCurrentPerformanceLevel = level;
+    activity->iCurrentBusSpeed = 8000;
+    activity->iCurrentBusLanes = 16;
+    activity->iMaximumBusLanes = 16;
+    return ADL_OK;
+}
+
+int temperatureGet(int adapterIndex, int thermalCtrlIndex, ADLTemperature* temperature)
+{
+    if (enterCall(F_TEMPERATURE_GET, adapterIndex))
+        return ADL_ERR;
+    if (!checkAdapter(adapterIndex) || thermalCtrlIndex != 0)
+        return ADL_ERR_INVALID_PARAM;
+    std::lock_guard<std::mutex> lock(state().mutex);
+    temperature->iTemperature = currentTemperature(adapterIndex);
+    return ADL_OK;
+}
+
+int fanSpeedInfoGet(int adapterIndex, int thermalCtrlIndex, ADLFanSpeedInfo* info)
+{
+    if (enterCall(F_FANSPEEDINFO_GET, adapterIndex))
+        return ADL_ERR;
+    if (!checkAdapter(adapterIndex) || thermalCtrlIndex != 0)
+        return ADL_ERR_INVALID_PARAM;
+    info->iFlags = 7; // read and write percent, read RPM
+    info->iMinPercent = 0;
+    info->iMaxPercent = 100;
+    info->iMinRPM = 640;
+    info->iMaxRPM = 3200;
+    return ADL_OK;
+}
+
+int fanSpeedGet(int adapterIndex, int thermalCtrlIndex, ADLFanSpeedValue* value)
+{
+    if (enterCall(F_FANSPEED_GET, adapterIndex))
+        return ADL_ERR;
+    if (!checkAdapter(adapterIndex) || thermalCtrlIndex != 0)
+        return ADL_ERR_INVALID_PARAM;
+    MockState& st = state();
+    std::lock_guard<std::mutex> lock(st.mutex);
+    const MockAdapter& adapter = st.adapters[adapterIndex];
+    if (value->iSpeedType == ADL_DL_FANCTRL_SPEED_TYPE_RPM)
+        value->iFanSpeed = adapter.fanSpeed*32;
+    else
+        value->iFanSpeed = adapter.fanSpeed;
+    value->iFlags = adapter.fanUserDefined ? ADL_DL_FANCTRL_FLAG_USER_DEFINED_SPEED : 0;
+    return ADL_OK;
+}
+
+int odParametersGet(int adapterIndex, ADLODParameters* params)
+{
+    if (enterCall(F_ODPARAMETERS_GET, adapterIndex))
+        return ADL_ERR;
+    if (!checkAdapter(adapterIndex))
+        return ADL_ERR_INVALID_PARAM;
+    params->iNumberOfPerformanceLevels = state().levelsNum;
+    params->iActivityReportingSupported = 1;
+    params->iDiscretePerformanceLevels = 1;
+    params->iReserved = 0;
+    params->sEngineClock = ADLODParameterRange{ 30000, 145000, 100 };
+    params->sMemoryClock = ADLODParameterRange{ 30000, 225000, 500 };
+    params->sVddc = ADLODParameterRange{ 750, 1250, 5 };
+    return ADL_OK;
+}
+
+bool checkPerfLevelsSize(const ADLODPerformanceLevels* levels)
+{
+    const int levelsNum = (levels->iSize - int(sizeof(ADLODPerformanceLevels))) /
+                int(sizeof(ADLODPerformanceLevel)) + 1;
+    return levelsNum == state().levelsNum;
+}
+
+int odPerformanceLevelsGet(int adapterIndex, int isDefault, ADLODPerformanceLevels* levels)
+{
+    if (enterCall(F_ODPERFLEVELS_GET, adapterIndex))
+        return ADL_ERR;
+    if (!checkAdapter(adapterIndex) || !checkPerfLevelsSize(levels))
+        return ADL_ERR_INVALID_PARAM;
+    MockState& st = state();
+    std::lock_guard<std::mutex> lock(st.mutex);
+    const MockAdapter& adapter = st.adapters[adapterIndex];
+    const std::vector<ADLODPerformanceLevel>& src = isDefault ?
+                adapter.defaultPerfLevels : adapter.perfLevels;
+    std::copy(src.begin(), src.end(), levels->aLevels);
+    return ADL_OK;
+}
+
+int fanSpeedSet(int adapterIndex, int thermalCtrlIndex, ADLFanSpeedValue* value)
+{
+    if (enterCall(F_FANSPEED_SET, adapterIndex))
+        return ADL_ERR;
+    if (!checkAdapter(adapterIndex) || thermalCtrlIndex != 0 ||
+        value->iFanSpeed < 0 || value->iFanSpeed > 100)
+        return ADL_ERR_INVALID_PARAM;
+    MockState& st = state();
+    std::lock_guard<std::mutex> lock(st.mutex);
+    st.adapters[adapterIndex].fanSpeed = value->iFanSpeed;
+    st.adapters[adapterIndex].fanUserDefined = true;
+    return ADL_OK;
+}
+
+int fanSpeedToDefaultSet(int adapterIndex, int thermalCtrlIndex)
+{
+    if (enterCall(F_FANSPEEDTODEFAULT_SET, adapterIndex))
+        return ADL_ERR;
+    if (!checkAdapter(adapterIndex) || thermalCtrlIndex != 0)
+        return ADL_ERR_INVALID_PARAM;
+    MockState& st = state();
+    std::lock_guard<std::mutex> lock(st.mutex);
+    st.adapters[adapterIndex].fanSpeed = 30;
+    st.adapters[adapterIndex].fanUserDefined = false;
+    return ADL_OK;
+}
+
+int odPerformanceLevelsSet(int adapterIndex, ADLODPerformanceLevels* levels)
+{
+    if (enterCall(F_ODPERFLEVELS_SET, adapterIndex))
+        return ADL_ERR;
+    if (!checkAdapter(adapterIndex) || !checkPerfLevelsSize(levels))
+        return ADL_ERR_INVALID_PARAM;
+    MockState& st = state();
+    std::lock_guard<std::mutex> lock(st.mutex);
+    std::copy(levels->aLevels, levels->aLevels+st.levelsNum,
+              st.adapters[adapterIndex].perfLevels.begin());
+    return ADL_OK;
+}
+
+int powerControlInfoGet(int adapterIndex, ADLPowerControlInfo* info)
+{
+    if (enterCall(F_POWERCONTROLINFO_GET, adapterIndex))
+        return ADL_ERR;
+    if (state().noPowerControl)
+        return ADL_ERR_NOT_SUPPORTED;
+    if (!checkAdapter(adapterIndex))
+        return ADL_ERR_INVALID_PARAM;
+    info->iMinValue = -50;
+    info->iMaxValue = 50;
+    info->iStepValue = 1;
+    return ADL_OK;
+}
+
+int powerControlGet(int adapterIndex, int* currentValue, int* defaultValue)
+{
+    if (enterCall(F_POWERCONTROL_GET, adapterIndex))
+        return ADL_ERR;
+    if (state().noPowerControl)
+        return ADL_ERR_NOT_SUPPORTED;
+    if (!checkAdapter(adapterIndex))
+        return ADL_ERR_INVALID_PARAM;
+    MockState& st = state();
+    std::lock_guard<std::mutex> lock(st.mutex);
+    *currentValue = st.adapters[adapterIndex].powerControl;
+    *defaultValue = 0;
+    return ADL_OK;
+}
+
+int powerControlSet(int adapterIndex, int value)
+{
+    if (enterCall(F_POWERCONTROL_SET, adapterIndex))
+        return ADL_ERR;
+    if (state().noPowerControl)
+        return ADL_ERR_NOT_SUPPORTED;
+    if (!checkAdapter(adapterIndex) || value < -50 || value > 50)
+        return ADL_ERR_INVALID_PARAM;
+    MockState& st = state();
+    std::lock_guard<std::mutex> lock(st.mutex);
+    st.adapters[adapterIndex].powerControl = value;
+    return ADL_OK;
+}
+
+// dummy non-null context
+int contextDummy;
+
+}
+
+extern "C"
+{
+
+int ADL_Main_Control_Create(ADL_MAIN_MALLOC_CALLBACK, int)
+{ return mainControlCreate(); }
+
+int ADL_Main_Control_Destroy()
+{ return enterCall(F_MAIN_CONTROL_DESTROY) ? ADL_ERR : ADL_OK; }
+
+int ADL_ConsoleMode_FileDescriptor_Set(int fileDescriptor)
+{ return consoleModeFdSet(fileDescriptor); }
+
+int ADL_Adapter_NumberOfAdapters_Get(int* numAdapters)
+{ return numberOfAdaptersGet(numAdapters); }
+
+int ADL_Adapter_Active_Get(int adapterIndex, int* status)
+{ return adapterActiveGet(adapterIndex, status); }
+
+int ADL_Adapter_AdapterInfo_Get(LPAdapterInfo info, int inputSize)
+{ return adapterInfoGet(info, inputSize); }
+
+int ADL_Overdrive5_CurrentActivity_Get(int adapterIndex, ADLPMActivity* activity)
+{ return currentActivityGet(adapterIndex, activity); }
+
+int ADL_Overdrive5_Temperature_Get(int adapterIndex, int thermalCtrlIndex,
+            ADLTemperature* temperature)
+{ return temperatureGet(adapterIndex, thermalCtrlIndex, temperature); }
+
+int ADL_Overdrive5_FanSpeedInfo_Get(int adapterIndex, int thermalCtrlIndex,
+            ADLFanSpeedInfo* fanSpeedInfo)
+{ return fanSpeedInfoGet(adapterIndex, thermalCtrlIndex, fanSpeedInfo); }
+
+int ADL_Overdrive5_FanSpeed_Get(int adapterIndex, int thermalCtrlIndex,
+            ADLFanSpeedValue* fanSpeedValue)
+{ return fanSpeedGet(adapterIndex, thermalCtrlIndex, fanSpeedValue); }
+
+int ADL_Overdrive5_ODParameters_Get(int adapterIndex, ADLODParameters* odParameters)
+{ return odParametersGet(adapterIndex, odParameters); }
+
+int ADL_Overdrive5_ODPerformanceLevels_Get(int adapterIndex, int idefault,
+            ADLODPerformanceLevels* odPerformanceLevels)
+{ return odPerformanceLevelsGet(adapterIndex, idefault, odPerformanceLevels); }
+
+int ADL_Overdrive5_FanSpeed_Set(int adapterIndex, int thermalCtrlIndex,
+            ADLFanSpeedValue* fanSpeedValue)
+{ return fanSpeedSet(adapterIndex, thermalCtrlIndex, fanSpeedValue); }
+
+int ADL_Overdrive5_FanSpeedToDefault_Set(int adapterIndex, int thermalCtrlIndex)
+{ return fanSpeedToDefaultSet(adapterIndex, thermalCtrlIndex); }
+
+int ADL_Overdrive5_ODPerformanceLevels_Set(int adapterIndex,
+            ADLODPerformanceLevels* odPerformanceLevels)
+{ return odPerformanceLevelsSet(adapterIndex, odPerformanceLevels); }
+
+int ADL_Overdrive5_PowerControlInfo_Get(int adapterIndex,
+            ADLPowerControlInfo* powerControlInfo)
+{ return powerControlInfoGet(adapterIndex, powerControlInfo); }
+
+int ADL_Overdrive5_PowerControl_Get(int adapterIndex, int* currentValue, int* defaultValue)
+{ return powerControlGet(adapterIndex, currentValue, defaultValue); }
+
+int ADL_Overdrive5_PowerControl_Set(int adapterIndex, int value)
+{ return powerControlSet(adapterIndex, value); }
+
+/* ADL2 API - context is ignored */
+
+int ADL2_Main_Control_Create(ADL_MAIN_MALLOC_CALLBACK, int, ADL_CONTEXT_HANDLE* context)
+{
+    if (state().noADL2)
+        return ADL_ERR_NOT_SUPPORTED;
+    int error = mainControlCreate();
+    if (error == ADL_OK)
+        *context = &contextDummy;
+    return error;
+}
+
+int ADL2_Main_Control_Destroy(ADL_CONTEXT_HANDLE)
+{ return enterCall(F_MAIN_CONTROL_DESTROY) ? ADL_ERR : ADL_OK; }
+
+int ADL2_ConsoleMode_FileDescriptor_Set(ADL_CONTEXT_HANDLE, int fileDescriptor)
+{ return consoleModeFdSet(fileDescriptor); }
+
+int ADL2_Adapter_NumberOfAdapters_Get(ADL_CONTEXT_HANDLE, int* numAdapters)
+{ return numberOfAdaptersGet(numAdapters); }
+
+int ADL2_Adapter_Active_Get(ADL_CONTEXT_HANDLE, int adapterIndex, int* status)
+{ return adapterActiveGet(adapterIndex, status); }
+
+int ADL2_Adapter_AdapterInfo_Get(ADL_CONTEXT_HANDLE, LPAdapterInfo info, int inputSize)
+{ return adapterInfoGet(info, inputSize); }
+
+int ADL2_Overdrive5_CurrentActivity_Get(ADL_CONTEXT_HANDLE, int adapterIndex,
+            ADLPMActivity* activity)
+{ return currentActivityGet(adapterIndex, activity); }
+
+int ADL2_Overdrive5_Temperature_Get(ADL_CONTEXT_HANDLE, int adapterIndex,
+            int thermalCtrlIndex, ADLTemperature* temperature)
+{ return temperatureGet(adapterIndex, thermalCtrlIndex, temperature); }
+
+int ADL2_Overdrive5_FanSpeedInfo_Get(ADL_CONTEXT_HANDLE, int adapterIndex,
+            int thermalCtrlIndex, ADLFanSpeedInfo* fanSpeedInfo)
+{ return fanSpeedInfoGet(adapterIndex, thermalCtrlIndex, fanSpeedInfo); }
+
+int ADL2_Overdrive5_FanSpeed_Get(ADL_CONTEXT_HANDLE, int adapterIndex,
+            int thermalCtrlIndex, ADLFanSpeedValue* fanSpeedValue)
+{ return fanSpeedGet(adapterIndex, thermalCtrlIndex, fanSpeedValue); }
+
+int ADL2_Overdrive5_ODParameters_Get(ADL_CONTEXT_HANDLE, int adapterIndex,
+            ADLODParameters* odParameters)
+{ return odParametersGet(adapterIndex, odParameters); }
+
+int ADL2_Overdrive5_ODPerformanceLevels_Get(ADL_CONTEXT_HANDLE, int adapterIndex,
+            int idefault, ADLODPerformanceLevels* odPerformanceLevels)
+{ return odPerformanceLevelsGet(adapterIndex, idefault, odPerformanceLevels); }
+
+int ADL2_Overdrive5_FanSpeed_Set(ADL_CONTEXT_HANDLE, int adapterIndex,
+            int thermalCtrlIndex, ADLFanSpeedValue* fanSpeedValue)
+{ return fanSpeedSet(adapterIndex, thermalCtrlIndex, fanSpeedValue); }
+
+int ADL2_Overdrive5_FanSpeedToDefault_Set(ADL_CONTEXT_HANDLE, int adapterIndex,
+            int thermalCtrlIndex)
+{ return fanSpeedToDefaultSet(adapterIndex, thermalCtrlIndex); }
+
+int ADL2_Overdrive5_ODPerformanceLevels_Set(ADL_CONTEXT_HANDLE, int adapterIndex,
+            ADLODPerformanceLevels* odPerformanceLevels)
+{ return odPerformanceLevelsSet(adapterIndex, odPerformanceLevels); }
+
+int ADL2_Overdrive5_PowerControlInfo_Get(ADL_CONTEXT_HANDLE, int adapterIndex,
+            ADLPowerControlInfo* powerControlInfo)
+{ return powerControlInfoGet(adapterIndex, powerControlInfo); }
+
+int ADL2_Overdrive5_PowerControl_Get(ADL_CONTEXT_HANDLE, int adapterIndex,
+            int* currentValue, int* defaultValue)
+{ return powerControlGet(adapterIndex, currentValue, defaultValue); }
+
+int ADL2_Overdrive5_PowerControl_Set(ADL_CONTEXT_HANDLE, int adapterIndex, int value)
+{ return powerControlSet(adapterIndex, value); }
+
+}
@@ -0,0 +1,246 @@
+/*
+ *  AMDCOVC - AMD Console OVerdrive Control utility
+ *  Copyright (C) 2016 Mateusz Szpakowski
+ *  Copyright (C) 2016 Virgil Hou
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* End-to-end scaling benchmark. Runs amdcovc against mock ADL library
+ * and fake /proc/ati and /dev/ati tree for 1 to 64 simulated adapters and
+ * reports median latencies of info, verbose info and set invocations. */
+
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+static const char* usageString =
+"Usage: scaling [-p AMDCOVC] [-m MOCKDIR] [-r RUNS] [-l LATENCY_US] [-n MAXADAPTERS]\n"
+"  -p AMDCOVC        path to amdcovc binary (default build/amdcovc)\n"
+"  -m MOCKDIR        directory with mock libatiadlxx.so (default build/mock)\n"
+"  -r RUNS           runs per measurement (default 5)\n"
+"  -l LATENCY_US     simulated latency of ADL call (default 100)\n"
+"  -n MAXADAPTERS    maximal number of adapters (default 64)\n";
+
+static void makeDir(const std::string& path)
+{
+    if (mkdir(path.c_str(), 0755)!=0 && errno!=EEXIST)
+    {
+        perror(path.c_str());
+        exit(1);
+    }
+}
+
+static void writeFile(const std::string& path, const std::string& content)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file==nullptr)
+    {
+        perror(path.c_str());
+        exit(1);
+    }
+    fwrite(content.data(), 1, content.size(), file);
+    fclose(file);
+}
+
+/* create fake device tree: ROOT/dev/ati/cardN, ROOT/proc/ati/N/name and
+ * ROOT/sys/bus/pci/devices/BDF/{vendor,device}. Mock adapter N is at bus N+1 */
+static void makeFakeRoot(const std::string& root, int adaptersNum)
+{
+    makeDir(root+"/dev");
+    makeDir(root+"/dev/ati");
+    makeDir(root+"/proc");
+    makeDir(root+"/proc/ati");
+    makeDir(root+"/sys");
+    makeDir(root+"/sys/bus");
+    makeDir(root+"/sys/bus/pci");
+    makeDir(root+"/sys/bus/pci/devices");
+    for (int i = 0; i < adaptersNum; i++)
+    {
+        char buf[128];
+        snprintf(buf, 128, "/dev/ati/card%d", i);
+        writeFile(root+buf, "");
+        snprintf(buf, 128, "/proc/ati/%d", i);
+        makeDir(root+buf);
+        char nameBuf[64];
+        snprintf(nameBuf, 64, "fglrx 0x%x PCI:%d:0:0\n", i, i+1);
+        writeFile(root+buf+"/name", nameBuf);
+        snprintf(buf, 128, "/sys/bus/pci/devices/0000:%02x:00.0", i+1);
+        makeDir(root+buf);
+        writeFile(root+buf+"/vendor", "0x1002\n");
+        writeFile(root+buf+"/device", "0x67df\n");
+    }
+}
+
+static double nowMs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec*1e-6;
+}
+
+/* run amdcovc with arguments, returns wall time in ms or -1 if failed */
+static double runOnce(const std::string& amdcovc, const std::vector<std::string>& args)
+{
+    std::vector<const char*> argv;
+    argv.push_back(amdcovc.c_str());
+    for (const std::string& arg: args)
+        argv.push_back(arg.c_str());
+    argv.push_back(nullptr);
+    const double start = nowMs();
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0)
+    {
+        int nullFd = open("/dev/null", O_WRONLY);
+        if (nullFd >= 0)
+        {
+            dup2(nullFd, 1);
+            close(nullFd);
+        }
+        execv(amdcovc.c_str(), (char* const*)argv.data());
+        perror("execv");
+        _exit(127);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    const double elapsed = nowMs()-start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status)!=0)
+    {
+        std::string command = amdcovc;
+        for (const std::string& arg: args)
+            command += " " + arg;
+        if (WIFEXITED(status))
+            std::cerr << "Command '" << command << "' failed with exit status " <<
+                    WEXITSTATUS(status) << std::endl;
+        else
+            std::cerr << "Command '" << command << "' killed by signal " <<
+                    WTERMSIG(status) << std::endl;
+        return -1.0;
+    }
+    return elapsed;
+}
+
+static double measure(const std::string& amdcovc, const std::vector<std::string>& args,
+            int runs)
+{
+    std::vector<double> times;
+    for (int r = 0; r < runs; r++)
+    {
+        double t = runOnce(amdcovc, args);
+        if (t < 0.0)
+            return -1.0;
+        times.push_back(t);
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size()/2];
+}
+
+int main(int argc, char** argv)
+{
+    std::string amdcovc = "build/amdcovc";
+    std::string mockDir = "build/mock";
+    int runs = 5;
+    int latencyUs = 100;
+    int maxAdapters = 64;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:m:r:l:n:h")) != -1)
+        switch (opt)
+        {
+            case 'p':
+                amdcovc = optarg;
+                break;
+            case 'm':
+                mockDir = optarg;
+                break;
+            case 'r':
+                runs = std::max(1, atoi(optarg));
+                break;
+            case 'l':
+                latencyUs = std::max(0, atoi(optarg));
+                break;
+            case 'n':
+                maxAdapters = std::max(1, atoi(optarg));
+                break;
+            default:
+                std::cerr << usageString;
+                return opt=='h' ? 0 : 1;
+        }
+
+    char rootTemplate[] = "/tmp/amdcovc-root-XXXXXX";
+    if (mkdtemp(rootTemplate)==nullptr)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string root = rootTemplate;
+    makeFakeRoot(root, maxAdapters);
+
+    char latencyBuf[32];
+    snprintf(latencyBuf, 32, "%d", latencyUs);
+    std::string libraryPath = mockDir;
+    const char* oldLibraryPath = getenv("LD_LIBRARY_PATH");
+    if (oldLibraryPath!=nullptr && *oldLibraryPath!=0)
+        libraryPath = libraryPath + ":" + oldLibraryPath;
+    setenv("LD_LIBRARY_PATH", libraryPath.c_str(), 1);
+    setenv("AMDCOVC_SYSROOT", root.c_str(), 1);
+    setenv("MOCKADL_LATENCY_US", latencyBuf, 1);
+
+    bool failed = false;
+    std::cout << "# latency per ADL call: " << latencyUs << " us, runs: " << runs << "\n"
+            "adapters\tinfo_ms\tverbose_ms\tverbose_parallel_ms\tset_ms\t"
+            "info_pci_names_ms" << std::endl;
+    for (int adaptersNum = 1; adaptersNum <= maxAdapters; adaptersNum *= 2)
+    {
+        char numBuf[32];
+        snprintf(numBuf, 32, "%d", adaptersNum);
+        setenv("MOCKADL_ADAPTERS", numBuf, 1);
+        const double infoMs = measure(amdcovc, { }, runs);
+        const double verboseMs = measure(amdcovc, { "-v" }, runs);
+        const double parallelMs = measure(amdcovc, { "-v", "--parallel" }, runs);
+        const double setMs = measure(amdcovc, { "coreclk:all=1100", "fanspeed:all=60" },
+                        runs);
+        // adapter names resolved from fake sysfs and PCI database
+        setenv("MOCKADL_NONAME", "1", 1);
+        const double pciNamesMs = measure(amdcovc, { }, runs);
+        unsetenv("MOCKADL_NONAME");
+        if (infoMs < 0.0 || verboseMs < 0.0 || parallelMs < 0.0 || setMs < 0.0 ||
+            pciNamesMs < 0.0)
+            failed = true;
+        char lineBuf[128];
+        snprintf(lineBuf, 128, "%d\t%.2f\t%.2f\t%.2f\t%.2f\t%.2f", adaptersNum, infoMs,
+                 verboseMs, parallelMs, setMs, pciNamesMs);
+        std::cout << lineBuf << std::endl;
+    }
+
+    std::string rmCommand = "rm -rf '" + root + "'";
+    if (system(rmCommand.c_str())!=0)
+        std::cerr << "Can't remove " << root << std::endl;
+    return failed ? 1 : 0;
+}